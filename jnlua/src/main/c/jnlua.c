@@ -3,6 +3,7 @@
  * See LICENSE.txt for license terms.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <setjmp.h>
@@ -21,12 +22,66 @@
 #define JNLUA_THREADLOCAL static __thread
 #endif
 
+/* Include monotonic clock */
+#ifdef LUA_WIN
+#include <windows.h>
+#endif
+#ifdef LUA_USE_POSIX
+#include <time.h>
+#endif
+
+/* Include SIMD intrinsics */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JNLUA_SSE2
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#define JNLUA_AVX2
+#endif
+
 /* ---- Definitions ---- */
-#define JNLUA_APIVERSION 3
+#define JNLUA_APIVERSION 4
 #define JNLUA_JNIVERSION JNI_VERSION_1_6
 #define JNLUA_JAVASTATE "jnlua.JavaState"
 #define JNLUA_OBJECT "jnlua.Object"
+#define JNLUA_OBJECTCACHE "jnlua.ObjectCache"
+#define JNLUA_JAVAERROR "jnlua.JavaError"
 #define JNLUA_MINSTACK LUA_MINSTACK
+#define JNLUA_STRINGBUFFER 1024
+#define JNLUA_DOUBLEARRAY 0
+#define JNLUA_INTARRAY 1
+#define JNLUA_LONGARRAY 2
+#define JNLUA_BOOLEANARRAY 3
+#define JNLUA_STRINGARRAY 4
+#define JNLUA_DESCRIBEJAVA 0x100
+#define JNLUA_DESCRIBECHUNK 32
+#define JNLUA_HEADERSIZE 18
+#define JNLUA_ALLOCATOR_POOL 1
+#define JNLUA_REFERENCES_HANDLETABLE 1
+#define JNLUA_HANDLES 1024
+#define JNLUA_HANDLEBATCH 256
+#define JNLUA_POOLGRANULE 8
+#define JNLUA_POOLCLASSES 32
+#define JNLUA_POOLMAX (JNLUA_POOLGRANULE * JNLUA_POOLCLASSES)
+#define JNLUA_POOLCLASS(size) (((size) - 1) / JNLUA_POOLGRANULE)
+#define JNLUA_SLABSIZE 16384
+#define JNLUA_SLABHEADER 16
+#define JNLUA_MEMORYUSED 0
+#define JNLUA_MEMORYPEAK 1
+#define JNLUA_MEMORYALLOCATIONS 2
+#define JNLUA_MEMORYLIMIT 3
+#define JNLUA_MEMORYGLOBALREFS 4
+#define JNLUA_MEMORYHANDLES 5
+#define JNLUA_HOOKCOUNT 1000
+#define JNLUA_PROFILEBUFFER 65536
+#define JNLUA_PROFILEDEPTH 64
+#define JNLUA_LATENCYBUCKETS 40
+#define JNLUA_KEYCACHE 64
+#define JNLUA_KEYLENGTH 40
+#define JNLUA_TRACENONE 0
+#define JNLUA_TRACEDISABLED 1
+#define JNLUA_TRACERECORDED 2
 #define JNLUA_ENV(env) {\
 	thread_env = env;\
 }
@@ -36,6 +91,34 @@
 		throw(L, status);\
 	}\
 }
+#define JNLUA_BATCH_PUSHNIL 0
+#define JNLUA_BATCH_PUSHBOOLEAN 1
+#define JNLUA_BATCH_PUSHINTEGER 2
+#define JNLUA_BATCH_PUSHNUMBER 3
+#define JNLUA_BATCH_PUSHSTRING 4
+#define JNLUA_BATCH_PUSHVALUE 5
+#define JNLUA_BATCH_POP 6
+#define JNLUA_BATCH_SETTOP 7
+#define JNLUA_BATCH_INSERT 8
+#define JNLUA_BATCH_REMOVE 9
+#define JNLUA_BATCH_NEWTABLE 10
+#define JNLUA_BATCH_GETTABLE 11
+#define JNLUA_BATCH_SETTABLE 12
+#define JNLUA_BATCH_GETFIELD 13
+#define JNLUA_BATCH_SETFIELD 14
+#define JNLUA_BATCH_RAWGET 15
+#define JNLUA_BATCH_RAWSET 16
+#define JNLUA_BATCH_RAWGETI 17
+#define JNLUA_BATCH_RAWSETI 18
+#define JNLUA_BATCH_GETGLOBAL 19
+#define JNLUA_BATCH_SETGLOBAL 20
+#define JNLUA_BATCH_GETTOP 21
+#define JNLUA_BATCH_TYPE 22
+#define JNLUA_BATCH_TOBOOLEAN 23
+#define JNLUA_BATCH_TOINTEGER 24
+#define JNLUA_BATCH_TONUMBER 25
+#define JNLUA_BATCH_TOSTRING 26
+#define JNLUA_BATCH_RAWLEN 27
 
 /* ---- Types ---- */
 /* Structure for reading and writing Java streams. */
@@ -46,22 +129,202 @@ typedef struct StreamStruct  {
 	jboolean is_copy;
 } Stream;
 
+/* Structure for reading a chunk from memory. */
+typedef struct ChunkStruct {
+	const char *bytes;
+	size_t size;
+} Chunk;
+
+/* Structure for writing a chunk to memory. */
+typedef struct DumpStruct {
+	char *bytes;
+	size_t size;
+	size_t capacity;
+} Dump;
+
+/* Structure for stripping debug information from a chunk. */
+typedef struct StripStruct {
+	const char *src;
+	const char *end;
+	char *dst;
+	size_t instructionsize;
+} Strip;
+
+/* Structure for interpreting a batch of stack operations. */
+typedef struct BatchStruct {
+	const char *pc;
+	const char *end;
+	const char *pool;
+	jdouble *results;
+	jint nresults;
+	jint maxresults;
+} Batch;
+
+/* Structure for a pool allocator with free lists per size class. */
+typedef struct PoolStruct {
+	void *free[JNLUA_POOLCLASSES];
+	void *slabs;
+} Pool;
+
+/*
+ * Structure for a table of Java object handles. The free list holds the free
+ * slots followed by the slots pending release.
+ */
+typedef struct HandlesStruct {
+	jobjectArray objects;
+	jint capacity;
+	jint next;
+	jint *free;
+	jint freecount;
+	jint pendingcount;
+	jlong count;
+} Handles;
+
+/* Structure for a sampling profiler with interned stack frames. */
+typedef struct ProfilerStruct {
+	int active;
+	jlong interval;
+	jlong next;
+	jint *samples;
+	jint size;
+	jint capacity;
+	jint dropped;
+	char **frames;
+	jint framecount;
+	jint framecapacity;
+	jint *slots;
+	jint slotcount;
+} Profiler;
+
+/* Structure for the error value representing a parked Java exception. */
+typedef struct JavaErrorStruct {
+	unsigned int sequence;
+	jobject throwable;
+	char where[LUA_IDSIZE + 16];
+} JavaError;
+
+/* Structure for a key string anchored in the registry. */
+typedef struct KeyStruct {
+	int ref;
+	size_t length;
+	unsigned int hash;
+} Key;
+
+/* Structure for the native state of a Lua state. */
+typedef struct NativeStateStruct {
+	lua_Alloc allocf;
+	void *allocud;
+	Pool *pool;
+	size_t used;
+	size_t peak;
+	size_t limit;
+	jlong allocations;
+	lua_State * volatile running;
+	volatile int interrupted;
+	jlong budget;
+	jlong deadline;
+	int poll;
+	const char *stopped;
+	Profiler *profiler;
+	jlong *metrics;
+	jlong globalrefs;
+	int cacheprobes;
+	int stacktrace;
+	int tracestatus;
+	char *trace;
+	size_t tracelength;
+	size_t tracecapacity;
+	int lightweighterrors;
+	const void *javaerror;
+	const void *javaobject;
+	JavaError *pendingerror;
+	unsigned int errorsequence;
+	unsigned int errorcount;
+	Handles *handles;
+	jobject javastate;
+	lua_State *luathread;
+	int yield;
+	jobject continuation;
+	int refs;
+	Key keys[JNLUA_KEYCACHE];
+} NativeState;
+
+/* Structure for instrumenting a native method. */
+typedef struct InstrumentationStruct {
+	void *function;
+	void *instrumented;
+	int *id;
+} Instrumentation;
+
 /* ---- JNI helpers ---- */
 static jclass referenceclass(JNIEnv *env, const char *className);
 static jbyteArray newbytearray(jsize length);
 static const char *getstringchars(jstring string);
 static void releasestringchars(jstring string, const char *chars);
+static char *getutf8chars(jstring string, char *buffer, size_t capacity, size_t *size);
+static void releaseutf8chars(char *utf8, char *buffer);
+static jstring newstring(const char *utf8, size_t size);
+static int dumpchunk(lua_State *L, int strip, Dump *dump);
 
 /* ---- Java state operations ---- */
 static lua_State *getluastate(jobject javastate);
 static void setluastate(jobject javastate, lua_State *L);
 static lua_State *getluathread(jobject javastate);
 static void setluathread(jobject javastate, lua_State *L);
-static int getyield(jobject javastate);
-static void setyield(jobject javastate, int yield);
 static lua_Debug *getluadebug(jobject javadebug);
 static void setluadebug(jobject javadebug, lua_Debug *ar);
 
+/* ---- Native state ---- */
+static NativeState *newnativestate(lua_Alloc allocf, void *allocud, int pool);
+static void releasenativestate(lua_State *L, NativeState *ns);
+static NativeState *getnativestate(lua_State *L);
+static void *allocate(void *ud, void *ptr, size_t osize, size_t nsize);
+static int panic(lua_State *L);
+
+/* ---- Pool allocator ---- */
+static Pool *newpool(void);
+static void freepool(Pool *pool);
+static void *poolrealloc(Pool *pool, void *ptr, size_t osize, size_t nsize);
+static void *poolalloc(Pool *pool, size_t size);
+static void poolfree(Pool *pool, void *block, size_t size);
+
+/* ---- Handles ---- */
+static Handles *newhandles(void);
+static void freehandles(Handles *handles);
+static jint newhandle(Handles *handles, jobject object);
+static void releasehandle(Handles *handles, jint slot);
+static void flushhandles(Handles *handles);
+static int growhandles(Handles *handles);
+
+/* ---- Hooks ---- */
+static int startbudget(lua_State *L, jlong instructions, jlong timeout, int poll);
+static void endbudget(lua_State *L);
+static void sethook(lua_State *L, NativeState *ns);
+static void counthook(lua_State *L, lua_Debug *ar);
+static jlong currenttime(void);
+
+/* ---- Sampling profiler ---- */
+static Profiler *newprofiler(void);
+static void freeprofiler(Profiler *profiler);
+static void sample(lua_State *L, Profiler *profiler);
+static jint profileframe(Profiler *profiler, lua_Debug *ar);
+static unsigned int hashlabel(const char *label);
+
+/* ---- Instrumentation ---- */
+static void JNICALL jnlua_instrument(JNIEnv *env, jclass clazz);
+static jlongArray JNICALL jnlua_metrics(JNIEnv *env, jclass clazz, jlong luastate);
+static jobjectArray JNICALL jnlua_nativenames(JNIEnv *env, jclass clazz);
+static void recordcrossing(jlong luathread, int id, jlong start);
+
+/* ---- Fast paths ---- */
+static int pushcachedkey(lua_State *L, const char *k);
+static void cachekey(lua_State *L, const char *k);
+static int rawgetfield(lua_State *L, int index, const char *k);
+static int rawsetfield(lua_State *L, int index, const char *k);
+static int haskey(lua_State *L, int index, int key);
+static int haskeyi(lua_State *L, int index, int n);
+static int rawtable(lua_State *L, int index);
+
 /* ---- Checks ---- */
 static int validindex(lua_State *L, int index);
 static int checkstack(lua_State *L, int space);
@@ -76,25 +339,63 @@ static int check(int cond, jthrowable throwable_class, const char *msg);
 
 /* ---- Java objects and functions ---- */
 static void pushjavaobject(lua_State *L, jobject object);
+static void newjavaobject(lua_State *L, jobject object, jint hash);
+static int pushcachedjavaobject(lua_State *L, jobject object, jint hash);
+static void cachejavaobject(lua_State *L, jint hash);
+static int refjavaobject(lua_State *L, void *user_data, jobject object);
+static void countglobalref(lua_State *L, int delta);
+static jobject getjavaobject(lua_State *L, int index);
+static void releasejavaobject(lua_State *L, jobject object);
 static jobject tojavaobject(lua_State *L, int index, jclass class);
 static jstring tostring(lua_State *L, int index);
 static int gcjavaobject(lua_State *L);
 static int calljavafunction(lua_State *L);
+static int continuejavafunction(lua_State *L);
+static int invokejavafunction(lua_State *L, jobject javafunction, int local);
+static void parkjavaerror(lua_State *L, NativeState *ns, jthrowable throwable);
+static void detachjavaerror(lua_State *L, NativeState *ns);
+static void clearjavaerror(NativeState *ns);
+static int isjavaerror(lua_State *L, int index);
+static jobject newjavaerror(lua_State *L, int index);
+static int tostringjavaerror(lua_State *L);
+static int gcjavaerror(lua_State *L);
 
 /* ---- Error handling ---- */
 static int messagehandler(lua_State *L);
+static int addtrace(NativeState *ns, const char *s, size_t length);
 static int isrelevant(lua_Debug *ar);
 static void throw(lua_State *L, int status);
 
 /* ---- Stream adapters ---- */
 static const char *readhandler(lua_State *L, void *ud, size_t *size);
+static const char *chunkhandler(lua_State *L, void *ud, size_t *size);
 static int writehandler(lua_State *L, const void *data, size_t size, void *ud);
+static int dumphandler(lua_State *L, const void *data, size_t size, void *ud);
+
+/* ---- Chunk stripping ---- */
+static int stripchunk(Dump *dump);
+static int stripfunction(Strip *strip);
+static int stripcopy(Strip *strip, size_t size);
+static int stripskip(Strip *strip, size_t size);
+static int stripint(Strip *strip, int *value);
+static int stripsize(Strip *strip, size_t *value);
+
+/* ---- String transcoding ---- */
+static size_t utf8size(const jchar *chars, size_t length);
+static size_t encodeutf8(const jchar *chars, size_t length, char *utf8);
+static size_t decodeutf8(const char *utf8, size_t size, jchar *chars);
+
+/* ---- Batch operands ---- */
+static jint batchint(Batch *batch);
+static jdouble batchdouble(Batch *batch);
+static const char *batchstring(Batch *batch, size_t *length);
+static int batchresult(Batch *batch, jdouble value);
 
 /* ---- Variables ---- */
 static jclass luastate_class = NULL;
 static jfieldID luastate_id = 0;
 static jfieldID luathread_id = 0;
-static jfieldID yield_id = 0;
+static jfieldID pendingthrowable_id = 0;
 static jclass luadebug_class = NULL;
 static jmethodID luadebug_init_id = 0;
 static jfieldID luadebug_field_id = 0;
@@ -111,8 +412,8 @@ static jclass luagcmetamethodexception_class = NULL;
 static jmethodID luagcmetamethodexception_id = 0;
 static jclass luamessagehandlerexception_class = NULL;
 static jmethodID luamessagehandlerexception_id = 0;
-static jclass luastacktraceelement_class = NULL;
-static jmethodID luastacktraceelement_id = 0;
+static jclass luainterruptedexception_class = NULL;
+static jmethodID luainterruptedexception_id = 0;
 static jclass luaerror_class = NULL;
 static jmethodID luaerror_id = 0;
 static jmethodID setluastacktrace_id = 0;
@@ -129,17 +430,25 @@ static jmethodID read_id = 0;
 static jclass outputstream_class = NULL;
 static jmethodID write_id = 0;
 static jclass ioexception_class = NULL;
+static jclass string_class = NULL;
+static jclass bytebuffer_class = NULL;
+static jmethodID allocatedirect_id = 0;
+static jclass system_class = NULL;
+static jmethodID identityhashcode_id = 0;
+static jclass object_class = NULL;
+static jclass arrays_class = NULL;
+static jmethodID copyof_id = 0;
 static int initialized = 0;
 JNLUA_THREADLOCAL JNIEnv *thread_env;
 
 /* ---- Fields ---- */
 /* lua_registryindex() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1registryindex(JNIEnv *env, jobject obj) {
+static jint JNICALL jnlua_registryindex (JNIEnv *env, jclass clazz) {
 	return (jint) LUA_REGISTRYINDEX;
 }
 
 /* lua_version() */
-JNIEXPORT jstring JNICALL Java_com_naef_jnlua_LuaState_lua_1version(JNIEnv *env, jobject obj) {
+static jstring JNICALL jnlua_version (JNIEnv *env, jclass clazz) {
 	const char *luaVersion;
 	
 	luaVersion = LUA_VERSION;
@@ -170,21 +479,45 @@ static int newstate_protected (lua_State *L) {
 	}
 	lua_setmetatable(L, -2);
 	lua_setfield(L, LUA_REGISTRYINDEX, JNLUA_JAVASTATE);
+	getnativestate(L)->javastate = *ref;
+	
+	/* Create the meta table for error values representing parked Java exceptions. */
+	lua_createtable(L, 0, 3);
+	lua_pushboolean(L, 0);
+	lua_setfield(L, -2, "__metatable");
+	lua_pushcfunction(L, tostringjavaerror);
+	lua_setfield(L, -2, "__tostring");
+	lua_pushcfunction(L, gcjavaerror);
+	lua_setfield(L, -2, "__gc");
+	getnativestate(L)->javaerror = lua_topointer(L, -1);
+	lua_setfield(L, LUA_REGISTRYINDEX, JNLUA_JAVAERROR);
 	
 	/*
 	 * Create the meta table for Java objects and return it. Population will
 	 * be finished on the Java side.
 	 */
 	luaL_newmetatable(L, JNLUA_OBJECT);
+	getnativestate(L)->javaobject = lua_topointer(L, -1);
 	lua_pushboolean(L, 0);
 	lua_setfield(L, -2, "__metatable");
 	lua_pushboolean(L, 0); /* non-weak global reference */
 	lua_pushcclosure(L, gcjavaobject, 1);
 	lua_setfield(L, -2, "__gc");
+	
+	/* Create the weak-valued cache of Java object userdata. */
+	lua_newtable(L);
+	lua_newtable(L);
+	lua_pushliteral(L, "v");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_setfield(L, LUA_REGISTRYINDEX, JNLUA_OBJECTCACHE);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1newstate (JNIEnv *env, jobject obj, int apiversion, jlong existing) {
+static void JNICALL jnlua_newstate (JNIEnv *env, jobject obj, int apiversion, jlong existing, jint allocator, jint references) {
 	lua_State *L;
+	NativeState *ns;
+	lua_Alloc allocf;
+	void *allocud;
 	
 	/* Initialized? */
 	if (!initialized) {
@@ -197,14 +530,35 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1newstate (JNIEnv *env,
 	}
 
 	/* Create or attach to Lua state. */
-	L = !existing ? luaL_newstate() : (lua_State *) (uintptr_t) existing;
-	if (!L) {
-		return;
+	if (!existing) {
+		if (!(ns = newnativestate(NULL, NULL, allocator == JNLUA_ALLOCATOR_POOL))) {
+			return;
+		}
+		if (!(L = lua_newstate(allocate, ns))) {
+			releasenativestate(NULL, ns);
+			return;
+		}
+		lua_atpanic(L, panic);
+	} else {
+		L = (lua_State *) (uintptr_t) existing;
+		if ((ns = getnativestate(L))) {
+			ns->refs++;
+		} else {
+			allocf = lua_getallocf(L, &allocud);
+			if (!(ns = newnativestate(allocf, allocud, 0))) {
+				return;
+			}
+			lua_setallocf(L, allocate, ns);
+		}
 	}
 	
 	/* Setup Lua state. */
 	JNLUA_ENV(env);
-	if (checkstack(L, JNLUA_MINSTACK)) {
+	if (!existing && references == JNLUA_REFERENCES_HANDLETABLE) {
+		ns->handles = newhandles();
+		check(ns->handles != NULL, luamemoryallocationexception_class, "JNI error: failed creating handle table");
+	}
+	if (!(*env)->ExceptionCheck(env) && checkstack(L, JNLUA_MINSTACK)) {
 		newstate_obj = obj;
 		lua_pushcfunction(L, newstate_protected);
 		JNLUA_PCALL(L, 0, 1);
@@ -212,26 +566,39 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1newstate (JNIEnv *env,
 	if ((*env)->ExceptionCheck(env)) {
 		if (!existing) {
 			lua_close(L);
+			L = NULL;
 		}
+		releasenativestate(L, ns);
 		return;
 	}
 	
 	/* Set the Lua state in the Java state. */
 	setluathread(obj, L);
 	setluastate(obj, L);
+	ns->luathread = L;
 }
 
 /* lua_close() */
 static int close_protected (lua_State *L) {
+	NativeState *ns;
+	
 	/* Unset the Java state in the Lua state. */
 	lua_pushnil(L);
 	lua_setfield(L, LUA_REGISTRYINDEX, JNLUA_JAVASTATE);
+	ns = getnativestate(L);
+	if (ns) {
+		ns->javastate = NULL;
+		ns->luathread = NULL;
+		ns->pendingerror = NULL;
+		ns->errorsequence = 0;
+	}
 	
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1close (JNIEnv *env, jobject obj, jboolean ownstate) {
+static void JNICALL jnlua_close (JNIEnv *env, jobject obj, jboolean ownstate) {
 	lua_State *L, *T;
 	lua_Debug ar;
+	NativeState *ns;
 
 	JNLUA_ENV(env);
 	L = getluastate(obj);
@@ -247,7 +614,9 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1close (JNIEnv *env, job
 		setluathread(obj, NULL);
 		
 		/* Close Lua state. */
+		ns = getnativestate(L);
 		lua_close(L);
+		releasenativestate(NULL, ns);
 	} else {
 		/* Can close? */
 		if (!lua_checkstack(L, JNLUA_MINSTACK)) {
@@ -264,6 +633,9 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1close (JNIEnv *env, job
 		/* Unset the Lua state in the Java state. */
 		setluastate(obj, NULL);
 		setluathread(obj, NULL);
+		
+		/* Release native state. */
+		releasenativestate(L, getnativestate(L));
 
 		/* Unset environment. */
 		JNLUA_ENV(NULL);
@@ -278,20 +650,68 @@ static int gc_protected (lua_State *L) {
 	gc_result = lua_gc(L, gc_what, gc_data);
 	return 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1gc (JNIEnv *env, jobject obj, jint what, jint data) {
+static jint JNICALL jnlua_gc (JNIEnv *env, jclass clazz, jlong luathread, jint what, jint data) {
 	lua_State *L;
+	NativeState *ns;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if(checkstack(L, JNLUA_MINSTACK)) {
 		gc_what = what;
 		gc_data = data;
 		lua_pushcfunction(L, gc_protected);
 		JNLUA_PCALL(L, 0, 0);
+		ns = getnativestate(L);
+		if (ns && ns->handles) {
+			flushhandles(ns->handles);
+		}
 	}
 	return (jint) gc_result;
 }
 
+/* lua_memory() */
+static jlong JNICALL jnlua_memory (JNIEnv *env, jclass clazz, jlong luathread, jint what) {
+	lua_State *L;
+	NativeState *ns;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (!ns) {
+		return 0;
+	}
+	switch (what) {
+	case JNLUA_MEMORYUSED:
+		return (jlong) ns->used;
+	case JNLUA_MEMORYPEAK:
+		return (jlong) ns->peak;
+	case JNLUA_MEMORYALLOCATIONS:
+		return ns->allocations;
+	case JNLUA_MEMORYLIMIT:
+		return (jlong) ns->limit;
+	case JNLUA_MEMORYGLOBALREFS:
+		return ns->globalrefs;
+	case JNLUA_MEMORYHANDLES:
+		return ns->handles ? ns->handles->count : 0;
+	}
+	return 0;
+}
+
+/* lua_setmemorylimit() */
+static void JNICALL jnlua_setmemorylimit (JNIEnv *env, jclass clazz, jlong luathread, jlong limit) {
+	lua_State *L;
+	NativeState *ns;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkarg(limit >= 0 && (jlong) (size_t) limit == limit, "illegal limit")) {
+		ns = getnativestate(L);
+		if (ns) {
+			ns->limit = (size_t) limit;
+		}
+	}
+}
+
 /* ---- Registration ---- */
 /* lua_openlib() */
 JNLUA_THREADLOCAL int openlib_lib;
@@ -346,11 +766,11 @@ static int openlib_protected (lua_State *L) {
 	luaL_requiref(L, libname, openfunc, 1);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1openlib (JNIEnv *env, jobject obj, jint lib) {
+static void JNICALL jnlua_openlib (JNIEnv *env, jclass clazz, jlong luathread, jint lib) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkarg(lib >= 0 && lib <= 9, "illegal library")) {
 		openlib_lib = lib;
@@ -361,14 +781,14 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1openlib (JNIEnv *env, j
 
 /* ---- Load and dump ---- */
 /* lua_load() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1load (JNIEnv *env, jobject obj, jobject inputStream, jstring chunkname, jstring mode) {
+static void JNICALL jnlua_load (JNIEnv *env, jclass clazz, jlong luathread, jobject inputStream, jstring chunkname, jstring mode) {
 	lua_State *L;
 	const char *chunkname_utf = NULL, *mode_utf = NULL;
 	Stream stream = { inputStream, NULL, NULL, 0 };
 	int status;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& (chunkname_utf = getstringchars(chunkname))
 			&& (mode_utf = getstringchars(mode)) 
@@ -392,13 +812,78 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1load (JNIEnv *env, jobj
 	}
 }
 
+/* lua_loadbuffer() */
+static void JNICALL jnlua_loadbuffer (JNIEnv *env, jclass clazz, jlong luathread, jobject buffer, jint position, jint length, jstring chunkname, jstring mode) {
+	lua_State *L;
+	const char *chunkname_utf = NULL, *mode_utf = NULL;
+	char *address;
+	Chunk chunk;
+	int status;
+
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
+			&& checknotnull(buffer)
+			&& checkarg((address = (char *) (*env)->GetDirectBufferAddress(env, buffer)) != NULL, "buffer is not direct")
+			&& checkarg(position >= 0 && length >= 0 && (jlong) position + length <= (*env)->GetDirectBufferCapacity(env, buffer), "illegal buffer range")
+			&& (chunkname_utf = getstringchars(chunkname))
+			&& (mode_utf = getstringchars(mode))) {
+		chunk.bytes = address + position;
+		chunk.size = (size_t) length;
+		status = lua_load(L, chunkhandler, &chunk, chunkname_utf, mode_utf);
+		if (status != LUA_OK) {
+			throw(L, status);
+		}
+	}
+	if (chunkname_utf) {
+		releasestringchars(chunkname, chunkname_utf);
+	}
+	if (mode_utf) {
+		releasestringchars(mode, mode_utf);
+	}
+}
+
+/* lua_loadbytearray() */
+static void JNICALL jnlua_loadbytearray (JNIEnv *env, jclass clazz, jlong luathread, jbyteArray ba, jint offset, jint length, jstring chunkname, jstring mode) {
+	lua_State *L;
+	const char *chunkname_utf = NULL, *mode_utf = NULL;
+	jbyte *b = NULL;
+	Chunk chunk;
+	int status;
+
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
+			&& checknotnull(ba)
+			&& checkarg(offset >= 0 && length >= 0 && (jlong) offset + length <= (*env)->GetArrayLength(env, ba), "illegal array range")
+			&& (chunkname_utf = getstringchars(chunkname))
+			&& (mode_utf = getstringchars(mode))
+			&& (b = (*env)->GetByteArrayElements(env, ba, NULL))) {
+		chunk.bytes = (const char *) b + offset;
+		chunk.size = (size_t) length;
+		status = lua_load(L, chunkhandler, &chunk, chunkname_utf, mode_utf);
+		if (status != LUA_OK) {
+			throw(L, status);
+		}
+	}
+	if (b) {
+		(*env)->ReleaseByteArrayElements(env, ba, b, JNI_ABORT);
+	}
+	if (chunkname_utf) {
+		releasestringchars(chunkname, chunkname_utf);
+	}
+	if (mode_utf) {
+		releasestringchars(mode, mode_utf);
+	}
+}
+
 /* lua_dump() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1dump (JNIEnv *env, jobject obj, jobject outputStream) {
+static void JNICALL jnlua_dump (JNIEnv *env, jclass clazz, jlong luathread, jobject outputStream) {
 	lua_State *L;
 	Stream stream = { outputStream, NULL, NULL, 0 };
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checknelems(L, 1)
 			&& (stream.byte_array = newbytearray(1024))) {
@@ -412,18 +897,63 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1dump (JNIEnv *env, jobj
 	}
 }
 
+/* lua_dumpbytearray() */
+static jbyteArray JNICALL jnlua_dumpbytearray (JNIEnv *env, jclass clazz, jlong luathread, jboolean strip) {
+	lua_State *L;
+	Dump dump = { NULL, 0, 0 };
+	jbyteArray ba = NULL;
+
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
+			&& checknelems(L, 1)
+			&& dumpchunk(L, strip, &dump)
+			&& (ba = newbytearray((jsize) dump.size))) {
+		(*env)->SetByteArrayRegion(env, ba, 0, (jsize) dump.size, (const jbyte *) dump.bytes);
+	}
+	free(dump.bytes);
+	return ba;
+}
+
+/* lua_dumpbytebuffer() */
+static jobject JNICALL jnlua_dumpbytebuffer (JNIEnv *env, jclass clazz, jlong luathread, jboolean strip) {
+	lua_State *L;
+	Dump dump = { NULL, 0, 0 };
+	jobject buffer = NULL;
+	void *address;
+
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
+			&& checknelems(L, 1)
+			&& dumpchunk(L, strip, &dump)
+			&& (buffer = (*env)->CallStaticObjectMethod(env, bytebuffer_class, allocatedirect_id, (jint) dump.size))) {
+		address = (*env)->GetDirectBufferAddress(env, buffer);
+		if (check(address != NULL, luamemoryallocationexception_class, "JNI error: GetDirectBufferAddress() failed")) {
+			memcpy(address, dump.bytes, dump.size);
+		} else {
+			buffer = NULL;
+		}
+	}
+	free(dump.bytes);
+	return buffer;
+}
+
 /* ---- Call ---- */
 /* lua_pcall() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pcall (JNIEnv *env, jobject obj, jint nargs, jint nresults) {
+static void JNICALL jnlua_pcall (JNIEnv *env, jclass clazz, jlong luathread, jint nargs, jint nresults, jlong instructions, jlong timeout) {
 	lua_State *L;
-	int index, status;
+	int index, status, budget;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkarg(nargs >= 0, "illegal argument count")
 			&& checknelems(L, nargs + 1)
 			&& checkarg(nresults >= 0 || nresults == LUA_MULTRET, "illegal return count")
-			&& (nresults == LUA_MULTRET || checkstack(L, nresults - (nargs + 1)))) {
+			&& (nresults == LUA_MULTRET || checkstack(L, nresults - (nargs + 1)))
+			&& checkarg(instructions >= 0, "illegal instruction limit")
+			&& checkarg(timeout >= 0, "illegal timeout")) {
+		budget = startbudget(L, instructions, timeout, 0);
 		index = lua_absindex(L, -nargs - 1);
 		lua_pushcfunction(L, messagehandler);
 		lua_insert(L, index);
@@ -432,6 +962,28 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pcall (JNIEnv *env, job
 		if (status != LUA_OK) {
 			throw(L, status);
 		}
+		if (budget) {
+			endbudget(L);
+		}
+	}
+}
+
+/* lua_interrupt() */
+static void JNICALL jnlua_interrupt (JNIEnv *env, jclass clazz, jlong luastate) {
+	lua_State *L;
+	NativeState *ns;
+
+	L = (lua_State *) (uintptr_t) luastate;
+	ns = getnativestate(L);
+	if (ns && ns->running) {
+		/*
+		 * Setting a hook is safe while the Lua state is running. The hook is
+		 * set in the main thread, which lives as long as the Lua state. Other
+		 * threads check the interrupt flag if the call has a budget, and a
+		 * resumed thread checks it periodically.
+		 */
+		ns->interrupted = 1;
+		lua_sethook(L, counthook, LUA_MASKCOUNT, 1);
 	}
 }
 
@@ -439,19 +991,26 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pcall (JNIEnv *env, job
 /* lua_getglobal() */
 JNLUA_THREADLOCAL const char *getglobal_name;
 static int getglobal_protected (lua_State *L) {
+	cachekey(L, getglobal_name);
 	lua_getglobal(L, getglobal_name);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1getglobal (JNIEnv *env, jobject obj, jstring name) {
+static void JNICALL jnlua_getglobal (JNIEnv *env, jclass clazz, jlong luathread, jstring name) {
 	lua_State *L;
 
 	getglobal_name = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& (getglobal_name = getstringchars(name))) {
-		lua_pushcfunction(L, getglobal_protected);
-		JNLUA_PCALL(L, 0, 1);
+		lua_pushglobaltable(L);
+		if (rawgetfield(L, -1, getglobal_name)) {
+			lua_remove(L, -2);
+		} else {
+			lua_pop(L, 1);
+			lua_pushcfunction(L, getglobal_protected);
+			JNLUA_PCALL(L, 0, 1);
+		}
 	}
 	if (getglobal_name) {
 		releasestringchars(name, getglobal_name);
@@ -461,21 +1020,29 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1getglobal (JNIEnv *env,
 /* lua_setglobal() */
 JNLUA_THREADLOCAL const char *setglobal_name;
 static int setglobal_protected (lua_State *L) {
+	cachekey(L, setglobal_name);
 	lua_setglobal(L, setglobal_name);
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1setglobal (JNIEnv *env, jobject obj, jstring name) {
+static void JNICALL jnlua_setglobal (JNIEnv *env, jclass clazz, jlong luathread, jstring name) {
 	lua_State *L;
 
 	setglobal_name = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checknelems(L, 1)
 			&& (setglobal_name = getstringchars(name))) {
-		lua_pushcfunction(L, setglobal_protected);
+		lua_pushglobaltable(L);
 		lua_insert(L, -2);
-		JNLUA_PCALL(L, 1, 0);
+		if (rawsetfield(L, -2, setglobal_name)) {
+			lua_pop(L, 1);
+		} else {
+			lua_remove(L, -2);
+			lua_pushcfunction(L, setglobal_protected);
+			lua_insert(L, -2);
+			JNLUA_PCALL(L, 1, 0);
+		}
 	}
 	if (setglobal_name) {
 		releasestringchars(name, setglobal_name);
@@ -484,11 +1051,11 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1setglobal (JNIEnv *env,
 
 /* ---- Stack push ---- */
 /* lua_pushboolean() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushboolean (JNIEnv *env, jobject obj, jint b) {
+static void JNICALL jnlua_pushboolean (JNIEnv *env, jclass clazz, jlong luathread, jint b) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)) {
 		lua_pushboolean(L, b);
 	}
@@ -501,12 +1068,12 @@ static int pushbytearray_protected (lua_State *L) {
 	lua_pushlstring(L, pushbytearray_b, pushbytearray_length);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushbytearray (JNIEnv *env, jobject obj, jbyteArray ba) {
+static void JNICALL jnlua_pushbytearray (JNIEnv *env, jclass clazz, jlong luathread, jbyteArray ba) {
 	lua_State *L;
 	
 	pushbytearray_b = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& (pushbytearray_b = (*env)->GetByteArrayElements(env, ba, NULL))) {
 		pushbytearray_length = (*env)->GetArrayLength(env, ba);
@@ -518,12 +1085,30 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushbytearray (JNIEnv *
 	}
 }
 
+/* lua_pushbytebuffer() */
+static void JNICALL jnlua_pushbytebuffer (JNIEnv *env, jclass clazz, jlong luathread, jobject buffer, jint position, jint length) {
+	lua_State *L;
+	char *address;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
+			&& checknotnull(buffer)
+			&& checkarg((address = (char *) (*env)->GetDirectBufferAddress(env, buffer)) != NULL, "buffer is not direct")
+			&& checkarg(position >= 0 && length >= 0 && (jlong) position + length <= (*env)->GetDirectBufferCapacity(env, buffer), "illegal buffer range")) {
+		pushbytearray_b = (jbyte *) (address + position);
+		pushbytearray_length = length;
+		lua_pushcfunction(L, pushbytearray_protected);
+		JNLUA_PCALL(L, 0, 1);
+	}
+}
+
 /* lua_pushinteger() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushinteger (JNIEnv *env, jobject obj, jint n) {
+static void JNICALL jnlua_pushinteger (JNIEnv *env, jclass clazz, jlong luathread, jint n) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)) {
 		lua_pushinteger(L, n);
 	}
@@ -533,14 +1118,15 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushinteger (JNIEnv *en
 JNLUA_THREADLOCAL jobject pushjavafunction_f;
 static int pushjavafunction_protected (lua_State *L) {
 	pushjavaobject(L, pushjavafunction_f);
-	lua_pushcclosure(L, calljavafunction, 1);
+	lua_pushlightuserdata(L, lua_touserdata(L, -1));
+	lua_pushcclosure(L, calljavafunction, 2);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushjavafunction (JNIEnv *env, jobject obj, jobject f) {
+static void JNICALL jnlua_pushjavafunction (JNIEnv *env, jclass clazz, jlong luathread, jobject f) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checknotnull(f)) {
 		pushjavafunction_f = f;
@@ -551,40 +1137,43 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushjavafunction (JNIEn
 
 /* lua_pushjavaobject() */
 JNLUA_THREADLOCAL jobject pushjavaobject_object;
+JNLUA_THREADLOCAL jint pushjavaobject_hash;
 static int pushjavaobject_protected (lua_State *L) {
-	pushjavaobject(L, pushjavaobject_object);
+	newjavaobject(L, pushjavaobject_object, pushjavaobject_hash);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushjavaobject (JNIEnv *env, jobject obj, jobject object) {
+static void JNICALL jnlua_pushjavaobject (JNIEnv *env, jclass clazz, jlong luathread, jobject object, jint hash) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
-			&& checknotnull(object)) {
+			&& checknotnull(object)
+			&& !pushcachedjavaobject(L, object, hash)) {
 		pushjavaobject_object = object;
+		pushjavaobject_hash = hash;
 		lua_pushcfunction(L, pushjavaobject_protected);
 		JNLUA_PCALL(L, 0, 1);
 	}
 }
 
 /* lua_pushnil() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushnil (JNIEnv *env, jobject obj) {
+static void JNICALL jnlua_pushnil (JNIEnv *env, jclass clazz, jlong luathread) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)) {
 		lua_pushnil(L);
 	}
 }
 
 /* lua_pushnumber() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushnumber (JNIEnv *env, jobject obj, jdouble n) {
+static void JNICALL jnlua_pushnumber (JNIEnv *env, jclass clazz, jlong luathread, jdouble n) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)) {
 		lua_pushnumber(L, n);
 	}
@@ -592,35 +1181,39 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushnumber (JNIEnv *env
 
 /* lua_pushstring() */
 JNLUA_THREADLOCAL const char *pushstring_s;
-JNLUA_THREADLOCAL jsize pushstring_length;
+JNLUA_THREADLOCAL size_t pushstring_length;
 static int pushstring_protected (lua_State *L) {
 	lua_pushlstring(L, pushstring_s, pushstring_length);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushstring (JNIEnv *env, jobject obj, jstring s) {
+static void JNICALL jnlua_pushstring (JNIEnv *env, jclass clazz, jlong luathread, jstring s) {
 	lua_State *L;
+	char buffer[JNLUA_STRINGBUFFER];
+	char *utf8 = NULL;
+	size_t size;
 	
-	pushstring_s = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
-			&& (pushstring_s = getstringchars(s))) {
-		pushstring_length = (*env)->GetStringUTFLength(env, s);
+			&& checknotnull(s)
+			&& (utf8 = getutf8chars(s, buffer, sizeof(buffer), &size))) {
+		pushstring_s = utf8;
+		pushstring_length = size;
 		lua_pushcfunction(L, pushstring_protected);
 		JNLUA_PCALL(L, 0, 1);
 	}
-	if (pushstring_s) {
-		releasestringchars(s, pushstring_s);
+	if (utf8) {
+		releaseutf8chars(utf8, buffer);
 	}
 }
 
 /* ---- Stack type test ---- */
 /* lua_isboolean() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isboolean (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isboolean (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -628,12 +1221,12 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isboolean (JNIEnv *env,
 }
 
 /* lua_iscfunction() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1iscfunction (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_iscfunction (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	lua_CFunction c_function = NULL;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -642,11 +1235,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1iscfunction (JNIEnv *en
 }
 
 /* lua_isfunction() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isfunction (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isfunction (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -654,11 +1247,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isfunction (JNIEnv *env
 }
 
 /* lua_isjavafunction() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isjavafunction (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isjavafunction (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -668,14 +1261,18 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isjavafunction (JNIEnv
 /* lua_isjavaobject() */
 JNLUA_THREADLOCAL int isjavaobject_result;
 static int isjavaobject_protected (lua_State *L) {
-	isjavaobject_result = tojavaobject(L, 1, NULL) != NULL;
+	jobject object;
+	
+	object = tojavaobject(L, 1, NULL);
+	isjavaobject_result = object != NULL;
+	releasejavaobject(L, object);
 	return 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isjavaobject (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isjavaobject (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -689,11 +1286,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isjavaobject (JNIEnv *e
 }
 
 /* lua_isnil() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnil (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isnil (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -701,20 +1298,20 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnil (JNIEnv *env, job
 }
 
 /* lua_isnone() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnone (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isnone (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	return (jint) !validindex(L, index);
 }
 
 /* lua_isnoneornil() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnoneornil (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isnoneornil (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 1;
 	}
@@ -722,11 +1319,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnoneornil (JNIEnv *en
 }
 
 /* lua_isnumber() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnumber (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isnumber (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -734,11 +1331,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isnumber (JNIEnv *env,
 }
 
 /* lua_isstring() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isstring (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isstring (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -746,11 +1343,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isstring (JNIEnv *env,
 }
 
 /* lua_istable() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1istable (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_istable (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -758,11 +1355,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1istable (JNIEnv *env, j
 }
 
 /* lua_isthread() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1isthread (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_isthread (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -777,11 +1374,11 @@ static int compare_protected (lua_State *L) {
 	compare_result = lua_compare(L, 1, 2, compare_operator);
 	return 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1compare (JNIEnv *env, jobject obj, jint index1, jint index2, jint operator) {
+static jint JNICALL jnlua_compare (JNIEnv *env, jclass clazz, jlong luathread, jint index1, jint index2, jint operator) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index1) || !validindex(L, index2)) {
 		return (jint) 0;
 	}
@@ -798,11 +1395,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1compare (JNIEnv *env, j
 }
 
 /* lua_rawequal() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1rawequal (JNIEnv *env, jobject obj, jint index1, jint index2) {
+static jint JNICALL jnlua_rawequal (JNIEnv *env, jclass clazz, jlong luathread, jint index1, jint index2) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index1) || !validindex(L, index2)) {
 		return (jint) 0;
 	}
@@ -810,12 +1407,12 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1rawequal (JNIEnv *env,
 }
 
 /* lua_rawlen() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1rawlen (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_rawlen (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	size_t result = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)) {
 		result = lua_rawlen(L, index);
 	}
@@ -823,11 +1420,11 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1rawlen (JNIEnv *env, jo
 }
 
 /* lua_toboolean() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1toboolean (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_toboolean (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return 0;
 	}
@@ -841,14 +1438,14 @@ static int tobytearray_protected (lua_State *L) {
 	tobytearray_result = lua_tolstring(L, 1, &tobytearray_length);
 	return 0;
 }
-JNIEXPORT jbyteArray JNICALL Java_com_naef_jnlua_LuaState_lua_1tobytearray (JNIEnv *env, jobject obj, jint index) {
+static jbyteArray JNICALL jnlua_tobytearray (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	jbyteArray ba;
 	jbyte *b;
 
 	tobytearray_result = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		index = lua_absindex(L, index);
@@ -872,13 +1469,42 @@ JNIEXPORT jbyteArray JNICALL Java_com_naef_jnlua_LuaState_lua_1tobytearray (JNIE
 	return ba;
 }
 
+/* lua_tobytebuffer() */
+static jobject JNICALL jnlua_tobytebuffer (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
+	lua_State *L;
+	jobject buffer;
+
+	tobytearray_result = NULL;
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
+			&& checkindex(L, index)) {
+		if (lua_type(L, index) == LUA_TSTRING) {
+			tobytearray_result = lua_tolstring(L, index, &tobytearray_length);
+		} else {
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, tobytearray_protected);
+			lua_pushvalue(L, index);
+			JNLUA_PCALL(L, 1, 0);
+		}
+	}
+	if (!tobytearray_result) {
+		return NULL;
+	}
+	buffer = (*env)->NewDirectByteBuffer(env, (void *) tobytearray_result, (jlong) tobytearray_length);
+	if (!check(buffer != NULL, luamemoryallocationexception_class, "JNI error: NewDirectByteBuffer() failed")) {
+		return NULL;
+	}
+	return buffer;
+}
+
 /* lua_tointeger() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1tointeger (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_tointeger (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	lua_Integer result = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)) {
 		result = lua_tointeger(L, index);
 	}
@@ -886,13 +1512,13 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1tointeger (JNIEnv *env,
 }
 
 /* lua_tointegerx() */
-JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1tointegerx (JNIEnv *env, jobject obj, jint index) {
+static jobject JNICALL jnlua_tointegerx (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	lua_Integer result = 0;
 	int isnum = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)) {
 		result = lua_tointegerx(L, index, &isnum);
 	}
@@ -910,11 +1536,11 @@ static int tojavafunction_protected (lua_State *L) {
 	}
 	return 0;
 }
-JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1tojavafunction (JNIEnv *env, jobject obj, jint index) {
+static jobject JNICALL jnlua_tojavafunction (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		index = lua_absindex(L, index);
@@ -931,11 +1557,11 @@ static int tojavaobject_protected (lua_State *L) {
 	tojavaobject_result = tojavaobject(L, 1, NULL);
 	return 0;
 }
-JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1tojavaobject (JNIEnv *env, jobject obj, jint index) {
+static jobject JNICALL jnlua_tojavaobject (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		index = lua_absindex(L, index);
@@ -947,12 +1573,12 @@ JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1tojavaobject (JNIEnv
 }
 
 /* lua_tonumber() */
-JNIEXPORT jdouble JNICALL Java_com_naef_jnlua_LuaState_lua_1tonumber (JNIEnv *env, jobject obj, jint index) {
+static jdouble JNICALL jnlua_tonumber (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	lua_Number result = 0.0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)) {
 		result = lua_tonumber(L, index);
 	}
@@ -960,13 +1586,13 @@ JNIEXPORT jdouble JNICALL Java_com_naef_jnlua_LuaState_lua_1tonumber (JNIEnv *en
 }
 
 /* lua_tonumberx() */
-JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1tonumberx (JNIEnv *env, jobject obj, jint index) {
+static jobject JNICALL jnlua_tonumberx (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	lua_Number result = 0.0;
 	int isnum = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)) {
 		result = lua_tonumberx(L, index, &isnum);
 	}
@@ -974,12 +1600,12 @@ JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1tonumberx (JNIEnv *e
 }
 
 /* lua_topointer() */
-JNIEXPORT jlong JNICALL Java_com_naef_jnlua_LuaState_lua_1topointer (JNIEnv *env, jobject obj, jint index) {
+static jlong JNICALL jnlua_topointer (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	const void *result = NULL;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)) {
 		result = lua_topointer(L, index);
 	}
@@ -988,16 +1614,17 @@ JNIEXPORT jlong JNICALL Java_com_naef_jnlua_LuaState_lua_1topointer (JNIEnv *env
 
 /* lua_tostring() */
 JNLUA_THREADLOCAL const char *tostring_result;
+JNLUA_THREADLOCAL size_t tostring_length;
 static int tostring_protected (lua_State *L) {
-	tostring_result = lua_tostring(L, 1);
+	tostring_result = lua_tolstring(L, 1, &tostring_length);
 	return 0;
 }
-JNIEXPORT jstring JNICALL Java_com_naef_jnlua_LuaState_lua_1tostring (JNIEnv *env, jobject obj, jint index) {
+static jstring JNICALL jnlua_tostring (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	tostring_result = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		index = lua_absindex(L, index);
@@ -1005,28 +1632,106 @@ JNIEXPORT jstring JNICALL Java_com_naef_jnlua_LuaState_lua_1tostring (JNIEnv *en
 		lua_pushvalue(L, index);
 		JNLUA_PCALL(L, 1, 0);
 	}
-	return tostring_result ? (*env)->NewStringUTF(env, tostring_result) : NULL;
+	return tostring_result ? newstring(tostring_result, tostring_length) : NULL;
 }
 
 /* lua_type() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1type (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_type (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (!validindex(L, index)) {
 		return LUA_TNONE;
 	}
 	return (jint) lua_type(L, index);
 }
 
+/* lua_describestack() */
+/*
+ * Describes the values in a range of the stack. The type codes are collected
+ * in a local buffer and stored with one JNI call per chunk. Only the Java
+ * objects are stored individually.
+ */
+static void describevalues (lua_State *L, int from, int to, jintArray types, jobjectArray objects) {
+	jint buffer[JNLUA_DESCRIBECHUNK];
+	int i, n;
+	jint type;
+	jobject object;
+
+	n = 0;
+	for (i = from; i <= to; i++) {
+		type = (jint) lua_type(L, i);
+		switch (type) {
+		case LUA_TFUNCTION:
+			if (lua_tocfunction(L, i) == calljavafunction) {
+				type |= JNLUA_DESCRIBEJAVA;
+			}
+			break;
+		case LUA_TUSERDATA:
+			object = tojavaobject(L, i, NULL);
+			if (object) {
+				type |= JNLUA_DESCRIBEJAVA;
+				(*thread_env)->SetObjectArrayElement(thread_env, objects, i - from, object);
+				releasejavaobject(L, object);
+			}
+			break;
+		}
+		buffer[n++] = type;
+		if (n == JNLUA_DESCRIBECHUNK || i == to) {
+			(*thread_env)->SetIntArrayRegion(thread_env, types, i - from + 1 - n, n, buffer);
+			n = 0;
+		}
+	}
+}
+JNLUA_THREADLOCAL jintArray describestack_types;
+JNLUA_THREADLOCAL jobjectArray describestack_objects;
+static int describestack_protected (lua_State *L) {
+	describevalues(L, 1, lua_gettop(L), describestack_types, describestack_objects);
+	return 0;
+}
+static void JNICALL jnlua_describestack (JNIEnv *env, jclass clazz, jlong luathread, jint from, jint to, jintArray types, jobjectArray objects) {
+	lua_State *L;
+	NativeState *ns;
+	int i, count;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkindex(L, from)
+			&& checkindex(L, to)
+			&& checknotnull(types)
+			&& checknotnull(objects)) {
+		from = lua_absindex(L, from);
+		to = lua_absindex(L, to);
+		count = to - from + 1;
+		if (count > 0
+				&& checkarg(count <= (*env)->GetArrayLength(env, types) && count <= (*env)->GetArrayLength(env, objects), "array too short")) {
+			ns = getnativestate(L);
+			if (ns && ns->javaobject) {
+				/* Identifying Java objects by their metatable pointer cannot raise errors */
+				if (checkstack(L, JNLUA_MINSTACK)) {
+					describevalues(L, from, to, types, objects);
+				}
+			} else if (checkstack(L, count + JNLUA_MINSTACK)) {
+				describestack_types = types;
+				describestack_objects = objects;
+				lua_pushcfunction(L, describestack_protected);
+				for (i = from; i <= to; i++) {
+					lua_pushvalue(L, i);
+				}
+				JNLUA_PCALL(L, count, 0);
+			}
+		}
+	}
+}
+
 /* ---- Stack operations ---- */
 /* lua_absindex() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1absindex (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_absindex (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	return (jint) lua_absindex(L, index);
 }
 
@@ -1036,11 +1741,11 @@ static int arith_protected (lua_State *L) {
 	lua_arith(L, arith_operator);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1arith (JNIEnv *env, jobject obj, jint operator) {
+static void JNICALL jnlua_arith (JNIEnv *env, jclass clazz, jlong luathread, jint operator) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checknelems(L, operator != LUA_OPUNM ? 2 : 1)) {
 		arith_operator = operator;
@@ -1061,11 +1766,11 @@ static int concat_protected (lua_State *L) {
 	lua_concat(L, concat_n);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1concat (JNIEnv *env, jobject obj, jint n) {
+static void JNICALL jnlua_concat (JNIEnv *env, jclass clazz, jlong luathread, jint n) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkarg(n >= 0, "illegal count")
 			&& checknelems(L, n)) {
@@ -1077,11 +1782,11 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1concat (JNIEnv *env, jo
 }
 
 /* lua_copy() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1copy (JNIEnv *env, jobject obj, jint from_index, jint to_index) {
+static void JNICALL jnlua_copy (JNIEnv *env, jclass clazz, jlong luathread, jint from_index, jint to_index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, from_index)
 			&& checkindex(L, to_index)) {
 		lua_copy(L, from_index, to_index);
@@ -1089,11 +1794,11 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1copy (JNIEnv *env, jobj
 }
 
 /* lua_gettop() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1gettop (JNIEnv *env, jobject obj) {
+static jint JNICALL jnlua_gettop (JNIEnv *env, jclass clazz, jlong luathread) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	return (jint) lua_gettop(L);
 }
 
@@ -1102,11 +1807,11 @@ static int len_protected (lua_State *L) {
 	lua_len(L, 1);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1len (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_len (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		index = lua_absindex(L, index);
@@ -1117,33 +1822,33 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1len (JNIEnv *env, jobje
 }
 
 /* lua_insert() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1insert (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_insert (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkrealindex(L, index)) {
 		lua_insert(L, index);
 	}
 }
 
 /* lua_pop() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pop (JNIEnv *env, jobject obj, jint n) {
+static void JNICALL jnlua_pop (JNIEnv *env, jclass clazz, jlong luathread, jint n) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkarg(n >= 0 && n <= lua_gettop(L), "illegal count")) {
 		lua_pop(L, n);
 	}
 }
 
 /* lua_pushvalue() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushvalue (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_pushvalue (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		lua_pushvalue(L, index);
@@ -1151,22 +1856,22 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1pushvalue (JNIEnv *env,
 }
 
 /* lua_remove() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1remove (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_remove (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkrealindex(L, index)) {
 		lua_remove(L, index);
 	}
 }
 
 /* lua_replace() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1replace (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_replace (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)
 			&& checknelems(L, 1)) {
 		lua_replace(L, index);
@@ -1174,11 +1879,11 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1replace (JNIEnv *env, j
 }
 
 /* lua_settop() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1settop (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_settop (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if ((index >= 0 && (index <= lua_gettop(L) || checkstack(L, index - lua_gettop(L))))
 			|| (index < 0 && checkrealindex(L, index))) {
 		lua_settop(L, index);
@@ -1193,11 +1898,11 @@ static int createtable_protected (lua_State *L) {
 	lua_createtable(L, createtable_narr, createtable_nrec);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1createtable (JNIEnv *env, jobject obj, jint narr, jint nrec) {
+static void JNICALL jnlua_createtable (JNIEnv *env, jclass clazz, jlong luathread, jint narr, jint nrec) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkarg(narr >= 0, "illegal array count")
 			&& checkarg(nrec >= 0, "illegal record count")) {
@@ -1215,12 +1920,12 @@ static int getsubtable_protected (lua_State *L) {
 	getsubtable_result = luaL_getsubtable(L, 1, getsubtable_fname);
 	return 1;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1getsubtable (JNIEnv *env, jobject obj, jint index, jstring fname) {
+static jint JNICALL jnlua_getsubtable (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring fname) {
 	lua_State *L;
 	
 	getsubtable_fname = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)
 			&& (getsubtable_fname = getstringchars(fname))) {
@@ -1238,22 +1943,27 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1getsubtable (JNIEnv *en
 /* lua_getfield() */
 JNLUA_THREADLOCAL const char *getfield_k;
 static int getfield_protected (lua_State *L) {
+	if (rawtable(L, 1)) {
+		cachekey(L, getfield_k);
+	}
 	lua_getfield(L, 1, getfield_k);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1getfield (JNIEnv *env, jobject obj, jint index, jstring k) {
+static void JNICALL jnlua_getfield (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring k) {
 	lua_State *L;
 
 	getfield_k = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)
 			&& (getfield_k = getstringchars(k))) {
-		index = lua_absindex(L, index);
-		lua_pushcfunction(L, getfield_protected);
-		lua_pushvalue(L, index);
-		JNLUA_PCALL(L, 1, 1);
+		if (!rawgetfield(L, index, getfield_k)) {
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, getfield_protected);
+			lua_pushvalue(L, index);
+			JNLUA_PCALL(L, 1, 1);
+		}
 	}
 	if (getfield_k) {
 		releasestringchars(k, getfield_k);
@@ -1265,19 +1975,23 @@ static int gettable_protected (lua_State *L) {
 	lua_gettable(L, 1);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1gettable (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_gettable (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
-		index = lua_absindex(L, index);
-		lua_pushcfunction(L, gettable_protected);
-		lua_insert(L, -2);
-		lua_pushvalue(L, index);
-		lua_insert(L, -2);
-		JNLUA_PCALL(L, 2, 1);
+		if (rawtable(L, index)) {
+			lua_gettable(L, index);
+		} else {
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, gettable_protected);
+			lua_insert(L, -2);
+			lua_pushvalue(L, index);
+			lua_insert(L, -2);
+			JNLUA_PCALL(L, 2, 1);
+		}
 	}
 }
 
@@ -1286,11 +2000,11 @@ static int newtable_protected (lua_State *L) {
 	lua_newtable(L);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1newtable (JNIEnv *env, jobject obj) {
+static void JNICALL jnlua_newtable (JNIEnv *env, jclass clazz, jlong luathread) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)) {
 		lua_pushcfunction(L, newtable_protected);
 		JNLUA_PCALL(L, 0, 1);
@@ -1303,11 +2017,11 @@ static int next_protected (lua_State *L) {
 	next_result = lua_next(L, 1);
 	return next_result ? 2 : 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1next (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_next (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
 		index = lua_absindex(L, index);
@@ -1321,22 +2035,22 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1next (JNIEnv *env, jobj
 }
 
 /* lua_rawget() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1rawget (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_rawget (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checktype(L, index, LUA_TTABLE)) {
 		lua_rawget(L, index);
 	}
 }
 
 /* lua_rawgeti() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1rawgeti (JNIEnv *env, jobject obj, jint index, jint n) {
+static void JNICALL jnlua_rawgeti (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint n) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
 		lua_rawgeti(L, index, n);
@@ -1348,20 +2062,24 @@ static int rawset_protected (lua_State *L) {
 	lua_rawset(L, 1);
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1rawset (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_rawset (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)
 			&& checknelems(L, 2)) {
-		index = lua_absindex(L, index);
-		lua_pushcfunction(L, rawset_protected);
-		lua_insert(L, -3);
-		lua_pushvalue(L, index);
-		lua_insert(L, -3);
-		JNLUA_PCALL(L, 3, 0);
+		if (haskey(L, index, -2)) {
+			lua_rawset(L, index);
+		} else {
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, rawset_protected);
+			lua_insert(L, -3);
+			lua_pushvalue(L, index);
+			lua_insert(L, -3);
+			JNLUA_PCALL(L, 3, 0);
+		}
 	}
 }
 
@@ -1371,20 +2089,24 @@ static int rawseti_protected (lua_State *L) {
 	lua_rawseti(L, 1, rawseti_n);
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1rawseti (JNIEnv *env, jobject obj, jint index, jint n) {
+static void JNICALL jnlua_rawseti (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint n) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
-		rawseti_n = n;
-		index = lua_absindex(L, index);
-		lua_pushcfunction(L, rawseti_protected);
-		lua_insert(L, -2);
-		lua_pushvalue(L, index);
-		lua_insert(L, -2);
-		JNLUA_PCALL(L, 2, 0);
+		if (haskeyi(L, index, n)) {
+			lua_rawseti(L, index, n);
+		} else {
+			rawseti_n = n;
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, rawseti_protected);
+			lua_insert(L, -2);
+			lua_pushvalue(L, index);
+			lua_insert(L, -2);
+			JNLUA_PCALL(L, 2, 0);
+		}
 	}
 }
 
@@ -1393,44 +2115,53 @@ static int settable_protected (lua_State *L) {
 	lua_settable(L, 1);
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1settable (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_settable (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)
 			&& checknelems(L, 2)) {
-		index = lua_absindex(L, index);
-		lua_pushcfunction(L, settable_protected);
-		lua_insert(L, -3);
-		lua_pushvalue(L, index);
-		lua_insert(L, -3);
-		JNLUA_PCALL(L, 3, 0);
+		if (rawtable(L, index) && haskey(L, index, -2)) {
+			lua_settable(L, index);
+		} else {
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, settable_protected);
+			lua_insert(L, -3);
+			lua_pushvalue(L, index);
+			lua_insert(L, -3);
+			JNLUA_PCALL(L, 3, 0);
+		}
 	}
 }
 
 /* lua_setfield() */
 JNLUA_THREADLOCAL const char *setfield_k;
 static int setfield_protected (lua_State *L) {
+	if (rawtable(L, 1)) {
+		cachekey(L, setfield_k);
+	}
 	lua_setfield(L, 1, setfield_k);
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1setfield (JNIEnv *env, jobject obj, jint index, jstring k) {
+static void JNICALL jnlua_setfield (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring k) {
 	lua_State *L;
 	
 	setfield_k = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)
 			&& (setfield_k = getstringchars(k))) {
-		index = lua_absindex(L, index);
-		lua_pushcfunction(L, setfield_protected);
-		lua_insert(L, -2);
-		lua_pushvalue(L, index);
-		lua_insert(L, -2);
-		JNLUA_PCALL(L, 2, 0);
+		if (!rawsetfield(L, index, setfield_k)) {
+			index = lua_absindex(L, index);
+			lua_pushcfunction(L, setfield_protected);
+			lua_insert(L, -2);
+			lua_pushvalue(L, index);
+			lua_insert(L, -2);
+			JNLUA_PCALL(L, 2, 0);
+		}
 	}
 	if (setfield_k) {
 		releasestringchars(k, setfield_k);
@@ -1439,12 +2170,12 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1setfield (JNIEnv *env,
 
 /* ---- Metatable ---- */
 /* lua_getmetatable() */
-JNIEXPORT int JNICALL Java_com_naef_jnlua_LuaState_lua_1getmetatable (JNIEnv *env, jobject obj, jint index) {
+static int JNICALL jnlua_getmetatable (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	int result = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (lua_checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)) {
 		result = lua_getmetatable(L, index);
@@ -1453,11 +2184,11 @@ JNIEXPORT int JNICALL Java_com_naef_jnlua_LuaState_lua_1getmetatable (JNIEnv *en
 }
 
 /* lua_setmetatable() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1setmetatable (JNIEnv *env, jobject obj, jint index) {
+static void JNICALL jnlua_setmetatable (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkindex(L, index)
 			&& checknelems(L, 1)
 			&& checkarg(lua_type(L, -1) == LUA_TTABLE || lua_type(L, -1) == LUA_TNIL, "illegal type")) {
@@ -1472,12 +2203,12 @@ static int getmetafield_protected (lua_State *L) {
 	getmetafield_result = luaL_getmetafield(L, 1, getmetafield_k);
 	return getmetafield_result ? 1 : 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1getmetafield (JNIEnv *env, jobject obj, jint index, jstring k) {
+static jint JNICALL jnlua_getmetafield (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring k) {
 	lua_State *L;
 	
 	getmetafield_k = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checkindex(L, index)
 			&& (getmetafield_k = getstringchars(k))) {
@@ -1502,11 +2233,11 @@ static int newthread_protected (lua_State *L) {
 	lua_xmove(L, T, 1);
 	return 1;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1newthread (JNIEnv *env, jobject obj) {
+static void JNICALL jnlua_newthread (JNIEnv *env, jclass clazz, jlong luathread) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, -1, LUA_TFUNCTION)) {
 		lua_pushcfunction(L, newthread_protected);
@@ -1516,19 +2247,20 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1newthread (JNIEnv *env,
 }
 
 /* lua_resume() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1resume (JNIEnv *env, jobject obj, jint index, jint nargs) {
+static jint JNICALL jnlua_resume (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint nargs) {
 	lua_State *L, *T;
-	int status;
+	int status, budget;
 	int nresults = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checktype(L, index, LUA_TTHREAD)
 			&& checkarg(nargs >= 0, "illegal argument count")
 			&& checknelems(L, nargs + 1)) {
 		T = lua_tothread(L, index);
 		if (checkstack(T, nargs)) {
 			lua_xmove(L, T, nargs);
+			budget = startbudget(T, 0, 0, 1);
 			status = lua_resume(T, L, nargs);
 			switch (status) {
 			case LUA_OK:
@@ -1539,7 +2271,14 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1resume (JNIEnv *env, jo
 				}
 				break;
 			default:
-				throw(L, status);
+				/* The error value is on the stack of the thread. */
+				if (checkstack(L, JNLUA_MINSTACK)) {
+					lua_xmove(T, L, 1);
+					throw(L, status);
+				}
+			}
+			if (budget) {
+				endbudget(T);
 			}
 		}
 	}
@@ -1547,18 +2286,67 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1resume (JNIEnv *env, jo
 }
 
 /* lua_status() */
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1status (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_status (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	int result = 0;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checktype(L, index, LUA_TTHREAD)) {
 		result = lua_status(lua_tothread(L, index));
 	}
 	return (jint) result;	
 }
 
+/* lua_setstacktrace() */
+static void JNICALL jnlua_setstacktrace (JNIEnv *env, jclass clazz, jlong luathread, jint enabled) {
+	lua_State *L;
+	NativeState *ns;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (ns) {
+		ns->stacktrace = enabled != 0;
+	}
+}
+
+/* lua_setlightweighterrors() */
+static void JNICALL jnlua_setlightweighterrors (JNIEnv *env, jclass clazz, jlong luathread, jint enabled) {
+	lua_State *L;
+	NativeState *ns;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (ns) {
+		ns->lightweighterrors = enabled != 0;
+	}
+}
+
+/* lua_yield() */
+static void JNICALL jnlua_yield (JNIEnv *env, jclass clazz, jlong luathread, jobject continuation) {
+	lua_State *L;
+	NativeState *ns;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (ns) {
+		if (ns->continuation) {
+			(*env)->DeleteGlobalRef(env, ns->continuation);
+			ns->continuation = NULL;
+		}
+		if (continuation) {
+			ns->continuation = (*env)->NewGlobalRef(env, continuation);
+			if (!check(ns->continuation != NULL, luamemoryallocationexception_class, "JNI error: NewGlobalRef() failed setting continuation")) {
+				return;
+			}
+		}
+		ns->yield = 1;
+	}
+}
+
 /* ---- Reference ---- */
 /* lua_ref() */
 JNLUA_THREADLOCAL int ref_result;
@@ -1566,11 +2354,11 @@ static int ref_protected (lua_State *L) {
 	ref_result = luaL_ref(L, 1);
 	return 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1ref (JNIEnv *env, jobject obj, jint index) {
+static jint JNICALL jnlua_ref (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
 		index = lua_absindex(L, index);
@@ -1589,11 +2377,11 @@ static int unref_protected (lua_State *L) {
 	luaL_unref(L, 1, unref_ref);
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1unref (JNIEnv *env, jobject obj, jint index, jint ref) {
+static void JNICALL jnlua_unref (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint ref) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
 		unref_ref = ref;
@@ -1606,13 +2394,13 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1unref (JNIEnv *env, job
 
 /* ---- Debug ---- */
 /* lua_getstack() */
-JNIEXPORT jobject JNICALL Java_com_naef_jnlua_LuaState_lua_1getstack (JNIEnv *env, jobject obj, jint level) {
+static jobject JNICALL jnlua_getstack (JNIEnv *env, jclass clazz, jlong luathread, jint level) {
 	lua_State *L;
 	lua_Debug *ar = NULL;
 	jobject result = NULL;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkarg(level >= 0, "illegal level")) {
 		ar = malloc(sizeof(lua_Debug));
 		if (ar) {
@@ -1636,12 +2424,12 @@ static int getinfo_protected (lua_State *L) {
 	getinfo_result = lua_getinfo(L, getinfo_what, getluadebug(getinfo_ar));
 	return 0;
 }
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1getinfo (JNIEnv *env, jobject obj, jstring what, jobject ar) {
+static jint JNICALL jnlua_getinfo (JNIEnv *env, jclass clazz, jlong luathread, jstring what, jobject ar) {
 	lua_State *L;
 	
 	getinfo_what = NULL;
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& (getinfo_what = getstringchars(what))
 			&& checknotnull(ar)) {
@@ -1655,26 +2443,115 @@ JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1getinfo (JNIEnv *env, j
 	return getinfo_result;
 }
 
-/* ---- Optimization ---- */
-/* lua_tablesize() */
-JNLUA_THREADLOCAL int tablesize_result;
-static int tablesize_protected (lua_State *L) {
-	int count = 0;
-	
-	lua_pushnil(L);
-	while (lua_next(L, -2)) {
-		lua_pop(L, 1);
-		count++;
-	}
-	tablesize_result = count;
-	return 0;
-}
-JNIEXPORT jint JNICALL Java_com_naef_jnlua_LuaState_lua_1tablesize (JNIEnv *env, jobject obj, jint index) {
+/* lua_startprofiler() */
+static void JNICALL jnlua_startprofiler (JNIEnv *env, jclass clazz, jlong luathread, jint interval) {
 	lua_State *L;
+	NativeState *ns;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
-	if (checkstack(L, JNLUA_MINSTACK)
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (checkarg(interval > 0, "illegal interval")
+			&& checkstate(ns != NULL, "no native state")) {
+		if (!ns->profiler) {
+			ns->profiler = newprofiler();
+		}
+		if (check(ns->profiler != NULL, luamemoryallocationexception_class, "JNI error: malloc() failed")) {
+			ns->profiler->active = 1;
+			ns->profiler->interval = (jlong) interval * 1000;
+			ns->profiler->next = 0;
+			sethook(L, ns);
+		}
+	}
+}
+
+/* lua_stopprofiler() */
+static void JNICALL jnlua_stopprofiler (JNIEnv *env, jclass clazz, jlong luathread) {
+	lua_State *L;
+	NativeState *ns;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (ns && ns->profiler) {
+		ns->profiler->active = 0;
+		sethook(L, ns);
+	}
+}
+
+/* lua_drainprofiler() */
+static jintArray JNICALL jnlua_drainprofiler (JNIEnv *env, jclass clazz, jlong luathread) {
+	lua_State *L;
+	NativeState *ns;
+	Profiler *profiler;
+	jintArray array;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	profiler = ns ? ns->profiler : NULL;
+	array = (*env)->NewIntArray(env, profiler ? profiler->size + 1 : 1);
+	if (!check(array != NULL, luamemoryallocationexception_class, "JNI error: NewIntArray() failed")) {
+		return NULL;
+	}
+	if (profiler) {
+		(*env)->SetIntArrayRegion(env, array, 0, 1, &profiler->dropped);
+		(*env)->SetIntArrayRegion(env, array, 1, profiler->size, profiler->samples);
+		profiler->size = 0;
+		profiler->dropped = 0;
+	}
+	return array;
+}
+
+/* lua_profilerframes() */
+static jobjectArray JNICALL jnlua_profilerframes (JNIEnv *env, jclass clazz, jlong luathread, jint first) {
+	lua_State *L;
+	NativeState *ns;
+	Profiler *profiler;
+	jobjectArray array;
+	jstring frame;
+	jint count, i;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	profiler = ns ? ns->profiler : NULL;
+	count = profiler && first >= 0 && first < profiler->framecount ? profiler->framecount - first : 0;
+	array = (*env)->NewObjectArray(env, count, string_class, NULL);
+	if (!check(array != NULL, luamemoryallocationexception_class, "JNI error: NewObjectArray() failed")) {
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		frame = newstring(profiler->frames[first + i], strlen(profiler->frames[first + i]));
+		if (!frame) {
+			return NULL;
+		}
+		(*env)->SetObjectArrayElement(env, array, i, frame);
+		(*env)->DeleteLocalRef(env, frame);
+	}
+	return array;
+}
+
+/* ---- Optimization ---- */
+/* lua_tablesize() */
+JNLUA_THREADLOCAL int tablesize_result;
+static int tablesize_protected (lua_State *L) {
+	int count = 0;
+	
+	lua_pushnil(L);
+	while (lua_next(L, -2)) {
+		lua_pop(L, 1);
+		count++;
+	}
+	tablesize_result = count;
+	return 0;
+}
+static jint JNICALL jnlua_tablesize (JNIEnv *env, jclass clazz, jlong luathread, jint index) {
+	lua_State *L;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)) {
 		index = lua_absindex(L, index);
 		lua_pushcfunction(L, tablesize_protected);
@@ -1705,11 +2582,11 @@ static int tablemove_protected (lua_State *L) {
 	}
 	return 0;
 }
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1tablemove (JNIEnv *env, jobject obj, jint index, jint from, jint to, jint count) {
+static void JNICALL jnlua_tablemove (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint from, jint to, jint count) {
 	lua_State *L;
 	
 	JNLUA_ENV(env);
-	L = getluathread(obj);
+	L = (lua_State *) (uintptr_t) luathread;
 	if (checkstack(L, JNLUA_MINSTACK)
 			&& checktype(L, index, LUA_TTABLE)
 			&& checkarg(count >= 0, "illegal count")) {
@@ -1723,9 +2600,511 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_lua_1tablemove (JNIEnv *env,
 	}
 }
 
+/* lua_pusharray() */
+static void JNICALL jnlua_pusharray (JNIEnv *env, jclass clazz, jlong luathread, jarray array, jint type) {
+	lua_State *L;
+	jsize length, i;
+	void *elements;
+	jstring string;
+	char buffer[JNLUA_STRINGBUFFER];
+	char *utf8;
+	size_t size;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (!checkstack(L, JNLUA_MINSTACK)
+			|| !checknotnull(array)) {
+		return;
+	}
+	
+	/* Create a table presized for the elements. */
+	length = (*env)->GetArrayLength(env, array);
+	createtable_narr = length;
+	createtable_nrec = 0;
+	lua_pushcfunction(L, createtable_protected);
+	JNLUA_PCALL(L, 0, 1);
+	if ((*env)->ExceptionCheck(env)) {
+		return;
+	}
+	
+	/* Set strings one by one, as they are pushed with allocation. */
+	if (type == JNLUA_STRINGARRAY) {
+		for (i = 0; i < length; i++) {
+			if (!(string = (*env)->GetObjectArrayElement(env, array, i))) {
+				continue;
+			}
+			utf8 = getutf8chars(string, buffer, sizeof(buffer), &size);
+			(*env)->DeleteLocalRef(env, string);
+			if (!utf8) {
+				lua_pop(L, 1);
+				return;
+			}
+			pushstring_s = utf8;
+			pushstring_length = size;
+			lua_pushcfunction(L, pushstring_protected);
+			JNLUA_PCALL(L, 0, 1);
+			releaseutf8chars(utf8, buffer);
+			if ((*env)->ExceptionCheck(env)) {
+				lua_pop(L, 1);
+				return;
+			}
+			lua_rawseti(L, -2, i + 1);
+		}
+		return;
+	}
+	
+	/*
+	 * Set primitive values directly from the array. Setting the array part of
+	 * the presized table does not allocate and cannot raise an error.
+	 */
+	elements = (*env)->GetPrimitiveArrayCritical(env, array, NULL);
+	if (!check(elements != NULL, luamemoryallocationexception_class, "JNI error: GetPrimitiveArrayCritical() failed")) {
+		lua_pop(L, 1);
+		return;
+	}
+	switch (type) {
+	case JNLUA_DOUBLEARRAY:
+		for (i = 0; i < length; i++) {
+			lua_pushnumber(L, (lua_Number) ((jdouble *) elements)[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		break;
+	case JNLUA_INTARRAY:
+		for (i = 0; i < length; i++) {
+			lua_pushinteger(L, (lua_Integer) ((jint *) elements)[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		break;
+	case JNLUA_LONGARRAY:
+		for (i = 0; i < length; i++) {
+			lua_pushnumber(L, (lua_Number) ((jlong *) elements)[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		break;
+	default:
+		for (i = 0; i < length; i++) {
+			lua_pushboolean(L, ((jboolean *) elements)[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+	}
+	(*env)->ReleasePrimitiveArrayCritical(env, array, elements, JNI_ABORT);
+}
+
+/* lua_toarray() */
+static jarray JNICALL jnlua_toarray (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint type) {
+	lua_State *L;
+	jsize length, i;
+	jarray array;
+	void *elements;
+	jstring string;
+	const char *s;
+	size_t size;
+	int valid = 1;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	if (!checkstack(L, JNLUA_MINSTACK)
+			|| !checkindex(L, index)
+			|| !lua_istable(L, index)) {
+		return NULL;
+	}
+	index = lua_absindex(L, index);
+	length = (jsize) lua_rawlen(L, index);
+	
+	/* Create the array. */
+	switch (type) {
+	case JNLUA_DOUBLEARRAY:
+		array = (*env)->NewDoubleArray(env, length);
+		break;
+	case JNLUA_INTARRAY:
+		array = (*env)->NewIntArray(env, length);
+		break;
+	case JNLUA_LONGARRAY:
+		array = (*env)->NewLongArray(env, length);
+		break;
+	case JNLUA_BOOLEANARRAY:
+		array = (*env)->NewBooleanArray(env, length);
+		break;
+	default:
+		array = (*env)->NewObjectArray(env, length, string_class, NULL);
+	}
+	if (!check(array != NULL, luamemoryallocationexception_class, "JNI error: failed to create array")) {
+		return NULL;
+	}
+	
+	/* Get strings one by one, as they are created with JNI calls. */
+	if (type == JNLUA_STRINGARRAY) {
+		for (i = 0; i < length; i++) {
+			lua_rawgeti(L, index, i + 1);
+			if (lua_type(L, -1) != LUA_TSTRING) {
+				lua_pop(L, 1);
+				return NULL;
+			}
+			s = lua_tolstring(L, -1, &size);
+			string = newstring(s, size);
+			lua_pop(L, 1);
+			if (!string) {
+				return NULL;
+			}
+			(*env)->SetObjectArrayElement(env, array, i, string);
+			(*env)->DeleteLocalRef(env, string);
+		}
+		return array;
+	}
+	
+	/*
+	 * Get primitive values directly into the array. Raw gets do not allocate
+	 * and cannot raise an error.
+	 */
+	elements = (*env)->GetPrimitiveArrayCritical(env, array, NULL);
+	if (!check(elements != NULL, luamemoryallocationexception_class, "JNI error: GetPrimitiveArrayCritical() failed")) {
+		return NULL;
+	}
+	switch (type) {
+	case JNLUA_DOUBLEARRAY:
+		for (i = 0; i < length && valid; i++) {
+			lua_rawgeti(L, index, i + 1);
+			if ((valid = lua_type(L, -1) == LUA_TNUMBER)) {
+				((jdouble *) elements)[i] = (jdouble) lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		break;
+	case JNLUA_INTARRAY:
+		for (i = 0; i < length && valid; i++) {
+			lua_rawgeti(L, index, i + 1);
+			if ((valid = lua_type(L, -1) == LUA_TNUMBER)) {
+				((jint *) elements)[i] = (jint) lua_tointeger(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		break;
+	case JNLUA_LONGARRAY:
+		for (i = 0; i < length && valid; i++) {
+			lua_rawgeti(L, index, i + 1);
+			if ((valid = lua_type(L, -1) == LUA_TNUMBER)) {
+				((jlong *) elements)[i] = (jlong) lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		break;
+	default:
+		for (i = 0; i < length && valid; i++) {
+			lua_rawgeti(L, index, i + 1);
+			if ((valid = lua_type(L, -1) == LUA_TBOOLEAN)) {
+				((jboolean *) elements)[i] = (jboolean) lua_toboolean(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+	}
+	(*env)->ReleasePrimitiveArrayCritical(env, array, elements, valid ? 0 : JNI_ABORT);
+	return valid ? array : NULL;
+}
+
+/* ---- Batch ---- */
+/* lua_batch() */
+static void JNICALL jnlua_batch (JNIEnv *env, jclass clazz, jlong luathread, jobject commands, jint size, jobject pool, jobject results, jobjectArray strings) {
+	lua_State *L;
+	Batch batch;
+	jint op, index, n, m;
+	size_t length;
+	jstring string;
+
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luathread;
+	batch.pc = (const char *) (*env)->GetDirectBufferAddress(env, commands);
+	batch.pool = (const char *) (*env)->GetDirectBufferAddress(env, pool);
+	batch.results = (jdouble *) (*env)->GetDirectBufferAddress(env, results);
+	if (!checkarg(batch.pc != NULL && batch.pool != NULL && batch.results != NULL, "illegal batch buffer")
+			|| !checkarg(size >= 0 && size <= (*env)->GetDirectBufferCapacity(env, commands), "illegal batch size")) {
+		return;
+	}
+	batch.end = batch.pc + size;
+	batch.nresults = 0;
+	batch.maxresults = (jint) ((*env)->GetDirectBufferCapacity(env, results) / sizeof(jdouble));
+	
+	/* Interpret operations until done or an exception is pending. */
+	while (batch.pc < batch.end && !(*env)->ExceptionCheck(env)) {
+		op = batchint(&batch);
+		switch (op) {
+		case JNLUA_BATCH_PUSHNIL:
+			if (checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushnil(L);
+			}
+			break;
+		case JNLUA_BATCH_PUSHBOOLEAN:
+			n = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushboolean(L, n);
+			}
+			break;
+		case JNLUA_BATCH_PUSHINTEGER:
+			n = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushinteger(L, n);
+			}
+			break;
+		case JNLUA_BATCH_PUSHNUMBER:
+			if (checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushnumber(L, batchdouble(&batch));
+			}
+			break;
+		case JNLUA_BATCH_PUSHSTRING:
+			pushstring_s = batchstring(&batch, &length);
+			pushstring_length = length;
+			if (checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushcfunction(L, pushstring_protected);
+				JNLUA_PCALL(L, 0, 1);
+			}
+			break;
+		case JNLUA_BATCH_PUSHVALUE:
+			index = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checkindex(L, index)) {
+				lua_pushvalue(L, index);
+			}
+			break;
+		case JNLUA_BATCH_POP:
+			n = batchint(&batch);
+			if (checkarg(n >= 0 && n <= lua_gettop(L), "illegal count")) {
+				lua_pop(L, n);
+			}
+			break;
+		case JNLUA_BATCH_SETTOP:
+			index = batchint(&batch);
+			if ((index >= 0 && (index <= lua_gettop(L) || checkstack(L, index - lua_gettop(L))))
+					|| (index < 0 && checkrealindex(L, index))) {
+				lua_settop(L, index);
+			}
+			break;
+		case JNLUA_BATCH_INSERT:
+			index = batchint(&batch);
+			if (checkrealindex(L, index)) {
+				lua_insert(L, index);
+			}
+			break;
+		case JNLUA_BATCH_REMOVE:
+			index = batchint(&batch);
+			if (checkrealindex(L, index)) {
+				lua_remove(L, index);
+			}
+			break;
+		case JNLUA_BATCH_NEWTABLE:
+			n = batchint(&batch);
+			m = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checkarg(n >= 0, "illegal array count")
+					&& checkarg(m >= 0, "illegal record count")) {
+				createtable_narr = n;
+				createtable_nrec = m;
+				lua_pushcfunction(L, createtable_protected);
+				JNLUA_PCALL(L, 0, 1);
+			}
+			break;
+		case JNLUA_BATCH_GETTABLE:
+			index = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)
+					&& checknelems(L, 1)) {
+				if (rawtable(L, index)) {
+					lua_gettable(L, index);
+				} else {
+					index = lua_absindex(L, index);
+					lua_pushcfunction(L, gettable_protected);
+					lua_insert(L, -2);
+					lua_pushvalue(L, index);
+					lua_insert(L, -2);
+					JNLUA_PCALL(L, 2, 1);
+				}
+			}
+			break;
+		case JNLUA_BATCH_SETTABLE:
+			index = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)
+					&& checknelems(L, 2)) {
+				if (rawtable(L, index) && haskey(L, index, -2)) {
+					lua_settable(L, index);
+				} else {
+					index = lua_absindex(L, index);
+					lua_pushcfunction(L, settable_protected);
+					lua_insert(L, -3);
+					lua_pushvalue(L, index);
+					lua_insert(L, -3);
+					JNLUA_PCALL(L, 3, 0);
+				}
+			}
+			break;
+		case JNLUA_BATCH_GETFIELD:
+			index = batchint(&batch);
+			getfield_k = batchstring(&batch, NULL);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)) {
+				if (!rawgetfield(L, index, getfield_k)) {
+					index = lua_absindex(L, index);
+					lua_pushcfunction(L, getfield_protected);
+					lua_pushvalue(L, index);
+					JNLUA_PCALL(L, 1, 1);
+				}
+			}
+			break;
+		case JNLUA_BATCH_SETFIELD:
+			index = batchint(&batch);
+			setfield_k = batchstring(&batch, NULL);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)
+					&& checknelems(L, 1)) {
+				if (!rawsetfield(L, index, setfield_k)) {
+					index = lua_absindex(L, index);
+					lua_pushcfunction(L, setfield_protected);
+					lua_insert(L, -2);
+					lua_pushvalue(L, index);
+					lua_insert(L, -2);
+					JNLUA_PCALL(L, 2, 0);
+				}
+			}
+			break;
+		case JNLUA_BATCH_RAWGET:
+			index = batchint(&batch);
+			if (checktype(L, index, LUA_TTABLE)
+					&& checknelems(L, 1)) {
+				lua_rawget(L, index);
+			}
+			break;
+		case JNLUA_BATCH_RAWSET:
+			index = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)
+					&& checknelems(L, 2)) {
+				if (haskey(L, index, -2)) {
+					lua_rawset(L, index);
+				} else {
+					index = lua_absindex(L, index);
+					lua_pushcfunction(L, rawset_protected);
+					lua_insert(L, -3);
+					lua_pushvalue(L, index);
+					lua_insert(L, -3);
+					JNLUA_PCALL(L, 3, 0);
+				}
+			}
+			break;
+		case JNLUA_BATCH_RAWGETI:
+			index = batchint(&batch);
+			n = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)) {
+				lua_rawgeti(L, index, n);
+			}
+			break;
+		case JNLUA_BATCH_RAWSETI:
+			index = batchint(&batch);
+			n = batchint(&batch);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checktype(L, index, LUA_TTABLE)
+					&& checknelems(L, 1)) {
+				if (haskeyi(L, index, n)) {
+					lua_rawseti(L, index, n);
+				} else {
+					rawseti_n = n;
+					index = lua_absindex(L, index);
+					lua_pushcfunction(L, rawseti_protected);
+					lua_insert(L, -2);
+					lua_pushvalue(L, index);
+					lua_insert(L, -2);
+					JNLUA_PCALL(L, 2, 0);
+				}
+			}
+			break;
+		case JNLUA_BATCH_GETGLOBAL:
+			getglobal_name = batchstring(&batch, NULL);
+			if (checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushglobaltable(L);
+				if (rawgetfield(L, -1, getglobal_name)) {
+					lua_remove(L, -2);
+				} else {
+					lua_pop(L, 1);
+					lua_pushcfunction(L, getglobal_protected);
+					JNLUA_PCALL(L, 0, 1);
+				}
+			}
+			break;
+		case JNLUA_BATCH_SETGLOBAL:
+			setglobal_name = batchstring(&batch, NULL);
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checknelems(L, 1)) {
+				lua_pushglobaltable(L);
+				lua_insert(L, -2);
+				if (rawsetfield(L, -2, setglobal_name)) {
+					lua_pop(L, 1);
+				} else {
+					lua_remove(L, -2);
+					lua_pushcfunction(L, setglobal_protected);
+					lua_insert(L, -2);
+					JNLUA_PCALL(L, 1, 0);
+				}
+			}
+			break;
+		case JNLUA_BATCH_GETTOP:
+			batchresult(&batch, (jdouble) lua_gettop(L));
+			break;
+		case JNLUA_BATCH_TYPE:
+			index = batchint(&batch);
+			batchresult(&batch, (jdouble) (validindex(L, index) ? lua_type(L, index) : LUA_TNONE));
+			break;
+		case JNLUA_BATCH_TOBOOLEAN:
+			index = batchint(&batch);
+			batchresult(&batch, (jdouble) (validindex(L, index) ? lua_toboolean(L, index) : 0));
+			break;
+		case JNLUA_BATCH_TOINTEGER:
+			index = batchint(&batch);
+			if (checkindex(L, index)) {
+				batchresult(&batch, (jdouble) (jint) lua_tointeger(L, index));
+			}
+			break;
+		case JNLUA_BATCH_TONUMBER:
+			index = batchint(&batch);
+			if (checkindex(L, index)) {
+				batchresult(&batch, (jdouble) lua_tonumber(L, index));
+			}
+			break;
+		case JNLUA_BATCH_TOSTRING:
+			index = batchint(&batch);
+			tostring_result = NULL;
+			if (checkstack(L, JNLUA_MINSTACK)
+					&& checkindex(L, index)) {
+				index = lua_absindex(L, index);
+				lua_pushcfunction(L, tostring_protected);
+				lua_pushvalue(L, index);
+				JNLUA_PCALL(L, 1, 0);
+			}
+			if ((*env)->ExceptionCheck(env)) {
+				break;
+			}
+			if (tostring_result) {
+				if (!(string = newstring(tostring_result, tostring_length))) {
+					break;
+				}
+				(*env)->SetObjectArrayElement(env, strings, batch.nresults, string);
+				(*env)->DeleteLocalRef(env, string);
+			}
+			batchresult(&batch, tostring_result ? 1.0 : 0.0);
+			break;
+		case JNLUA_BATCH_RAWLEN:
+			index = batchint(&batch);
+			if (checkindex(L, index)) {
+				batchresult(&batch, (jdouble) lua_rawlen(L, index));
+			}
+			break;
+		default:
+			checkarg(0, "illegal batch operation");
+			break;
+		}
+	}
+}
+
 /* ---- Debug structure ---- */
 /* lua_debugfree() */
-JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_00024LuaDebug_lua_1debugfree (JNIEnv *env, jobject obj) {
+static void JNICALL jnlua_debugfree (JNIEnv *env, jobject obj) {
 	lua_Debug *ar;
 	
 	JNLUA_ENV(env);
@@ -1735,24 +3114,139 @@ JNIEXPORT void JNICALL Java_com_naef_jnlua_LuaState_00024LuaDebug_lua_1debugfree
 }
 
 /* lua_debugname() */
-JNIEXPORT jstring JNICALL Java_com_naef_jnlua_LuaState_00024LuaDebug_lua_1debugname (JNIEnv *env, jobject obj) {
+static jstring JNICALL jnlua_debugname (JNIEnv *env, jobject obj) {
 	lua_Debug *ar;
 	
 	JNLUA_ENV(env);
 	ar = getluadebug(obj);
-	return ar != NULL && ar->name != NULL ? (*env)->NewStringUTF(env, ar->name) : NULL;
+	return ar != NULL && ar->name != NULL ? newstring(ar->name, strlen(ar->name)) : NULL;
 }
 
 /* lua_debugnamewhat() */
-JNIEXPORT jstring JNICALL Java_com_naef_jnlua_LuaState_00024LuaDebug_lua_1debugnamewhat (JNIEnv *env, jobject obj) {
+static jstring JNICALL jnlua_debugnamewhat (JNIEnv *env, jobject obj) {
 	lua_Debug *ar;
 	
 	JNLUA_ENV(env);
 	ar = getluadebug(obj);
-	return ar != NULL && ar->namewhat != NULL ? (*env)->NewStringUTF(env, ar->namewhat) : NULL;
+	return ar != NULL && ar->namewhat != NULL ? newstring(ar->namewhat, strlen(ar->namewhat)) : NULL;
 }
 
 /* ---- JNI ---- */
+/* Native methods of the Java state. */
+static JNINativeMethod luastate_natives[] = {
+	{ "lua_registryindex", "()I", (void *) jnlua_registryindex },
+	{ "lua_version", "()Ljava/lang/String;", (void *) jnlua_version },
+	{ "lua_newstate", "(IJII)V", (void *) jnlua_newstate },
+	{ "lua_close", "(Z)V", (void *) jnlua_close },
+	{ "lua_gc", "(JII)I", (void *) jnlua_gc },
+	{ "lua_memory", "(JI)J", (void *) jnlua_memory },
+	{ "lua_setmemorylimit", "(JJ)V", (void *) jnlua_setmemorylimit },
+	{ "lua_instrument", "()V", (void *) jnlua_instrument },
+	{ "lua_metrics", "(J)[J", (void *) jnlua_metrics },
+	{ "lua_nativenames", "()[Ljava/lang/String;", (void *) jnlua_nativenames },
+	{ "lua_openlib", "(JI)V", (void *) jnlua_openlib },
+	{ "lua_load", "(JLjava/io/InputStream;Ljava/lang/String;Ljava/lang/String;)V", (void *) jnlua_load },
+	{ "lua_loadbuffer", "(JLjava/nio/ByteBuffer;IILjava/lang/String;Ljava/lang/String;)V", (void *) jnlua_loadbuffer },
+	{ "lua_loadbytearray", "(J[BIILjava/lang/String;Ljava/lang/String;)V", (void *) jnlua_loadbytearray },
+	{ "lua_dump", "(JLjava/io/OutputStream;)V", (void *) jnlua_dump },
+	{ "lua_dumpbytearray", "(JZ)[B", (void *) jnlua_dumpbytearray },
+	{ "lua_dumpbytebuffer", "(JZ)Ljava/nio/ByteBuffer;", (void *) jnlua_dumpbytebuffer },
+	{ "lua_pcall", "(JIIJJ)V", (void *) jnlua_pcall },
+	{ "lua_interrupt", "(J)V", (void *) jnlua_interrupt },
+	{ "lua_getglobal", "(JLjava/lang/String;)V", (void *) jnlua_getglobal },
+	{ "lua_setglobal", "(JLjava/lang/String;)V", (void *) jnlua_setglobal },
+	{ "lua_pushboolean", "(JI)V", (void *) jnlua_pushboolean },
+	{ "lua_pushbytearray", "(J[B)V", (void *) jnlua_pushbytearray },
+	{ "lua_pushbytebuffer", "(JLjava/nio/ByteBuffer;II)V", (void *) jnlua_pushbytebuffer },
+	{ "lua_pushinteger", "(JI)V", (void *) jnlua_pushinteger },
+	{ "lua_pushjavafunction", "(JLcom/naef/jnlua/JavaFunction;)V", (void *) jnlua_pushjavafunction },
+	{ "lua_pushjavaobject", "(JLjava/lang/Object;I)V", (void *) jnlua_pushjavaobject },
+	{ "lua_pushnil", "(J)V", (void *) jnlua_pushnil },
+	{ "lua_pushnumber", "(JD)V", (void *) jnlua_pushnumber },
+	{ "lua_pushstring", "(JLjava/lang/String;)V", (void *) jnlua_pushstring },
+	{ "lua_isboolean", "(JI)I", (void *) jnlua_isboolean },
+	{ "lua_iscfunction", "(JI)I", (void *) jnlua_iscfunction },
+	{ "lua_isfunction", "(JI)I", (void *) jnlua_isfunction },
+	{ "lua_isjavafunction", "(JI)I", (void *) jnlua_isjavafunction },
+	{ "lua_isjavaobject", "(JI)I", (void *) jnlua_isjavaobject },
+	{ "lua_isnil", "(JI)I", (void *) jnlua_isnil },
+	{ "lua_isnone", "(JI)I", (void *) jnlua_isnone },
+	{ "lua_isnoneornil", "(JI)I", (void *) jnlua_isnoneornil },
+	{ "lua_isnumber", "(JI)I", (void *) jnlua_isnumber },
+	{ "lua_isstring", "(JI)I", (void *) jnlua_isstring },
+	{ "lua_istable", "(JI)I", (void *) jnlua_istable },
+	{ "lua_isthread", "(JI)I", (void *) jnlua_isthread },
+	{ "lua_compare", "(JIII)I", (void *) jnlua_compare },
+	{ "lua_rawequal", "(JII)I", (void *) jnlua_rawequal },
+	{ "lua_rawlen", "(JI)I", (void *) jnlua_rawlen },
+	{ "lua_toboolean", "(JI)I", (void *) jnlua_toboolean },
+	{ "lua_tobytearray", "(JI)[B", (void *) jnlua_tobytearray },
+	{ "lua_tobytebuffer", "(JI)Ljava/nio/ByteBuffer;", (void *) jnlua_tobytebuffer },
+	{ "lua_tointeger", "(JI)I", (void *) jnlua_tointeger },
+	{ "lua_tointegerx", "(JI)Ljava/lang/Integer;", (void *) jnlua_tointegerx },
+	{ "lua_tojavafunction", "(JI)Lcom/naef/jnlua/JavaFunction;", (void *) jnlua_tojavafunction },
+	{ "lua_tojavaobject", "(JI)Ljava/lang/Object;", (void *) jnlua_tojavaobject },
+	{ "lua_tonumber", "(JI)D", (void *) jnlua_tonumber },
+	{ "lua_tonumberx", "(JI)Ljava/lang/Double;", (void *) jnlua_tonumberx },
+	{ "lua_topointer", "(JI)J", (void *) jnlua_topointer },
+	{ "lua_tostring", "(JI)Ljava/lang/String;", (void *) jnlua_tostring },
+	{ "lua_type", "(JI)I", (void *) jnlua_type },
+	{ "lua_describestack", "(JII[I[Ljava/lang/Object;)V", (void *) jnlua_describestack },
+	{ "lua_absindex", "(JI)I", (void *) jnlua_absindex },
+	{ "lua_arith", "(JI)I", (void *) jnlua_arith },
+	{ "lua_concat", "(JI)V", (void *) jnlua_concat },
+	{ "lua_copy", "(JII)I", (void *) jnlua_copy },
+	{ "lua_gettop", "(J)I", (void *) jnlua_gettop },
+	{ "lua_len", "(JI)V", (void *) jnlua_len },
+	{ "lua_insert", "(JI)V", (void *) jnlua_insert },
+	{ "lua_pop", "(JI)V", (void *) jnlua_pop },
+	{ "lua_pushvalue", "(JI)V", (void *) jnlua_pushvalue },
+	{ "lua_remove", "(JI)V", (void *) jnlua_remove },
+	{ "lua_replace", "(JI)V", (void *) jnlua_replace },
+	{ "lua_settop", "(JI)V", (void *) jnlua_settop },
+	{ "lua_createtable", "(JII)V", (void *) jnlua_createtable },
+	{ "lua_getsubtable", "(JILjava/lang/String;)I", (void *) jnlua_getsubtable },
+	{ "lua_gettable", "(JI)V", (void *) jnlua_gettable },
+	{ "lua_getfield", "(JILjava/lang/String;)V", (void *) jnlua_getfield },
+	{ "lua_newtable", "(J)V", (void *) jnlua_newtable },
+	{ "lua_next", "(JI)I", (void *) jnlua_next },
+	{ "lua_rawget", "(JI)V", (void *) jnlua_rawget },
+	{ "lua_rawgeti", "(JII)V", (void *) jnlua_rawgeti },
+	{ "lua_rawset", "(JI)V", (void *) jnlua_rawset },
+	{ "lua_rawseti", "(JII)V", (void *) jnlua_rawseti },
+	{ "lua_settable", "(JI)V", (void *) jnlua_settable },
+	{ "lua_setfield", "(JILjava/lang/String;)V", (void *) jnlua_setfield },
+	{ "lua_getmetatable", "(JI)I", (void *) jnlua_getmetatable },
+	{ "lua_setmetatable", "(JI)V", (void *) jnlua_setmetatable },
+	{ "lua_getmetafield", "(JILjava/lang/String;)I", (void *) jnlua_getmetafield },
+	{ "lua_newthread", "(J)V", (void *) jnlua_newthread },
+	{ "lua_resume", "(JII)I", (void *) jnlua_resume },
+	{ "lua_status", "(JI)I", (void *) jnlua_status },
+	{ "lua_yield", "(JLcom/naef/jnlua/JavaFunction;)V", (void *) jnlua_yield },
+	{ "lua_setstacktrace", "(JI)V", (void *) jnlua_setstacktrace },
+	{ "lua_setlightweighterrors", "(JI)V", (void *) jnlua_setlightweighterrors },
+	{ "lua_ref", "(JI)I", (void *) jnlua_ref },
+	{ "lua_unref", "(JII)V", (void *) jnlua_unref },
+	{ "lua_getstack", "(JI)Lcom/naef/jnlua/LuaState$LuaDebug;", (void *) jnlua_getstack },
+	{ "lua_getinfo", "(JLjava/lang/String;Lcom/naef/jnlua/LuaState$LuaDebug;)I", (void *) jnlua_getinfo },
+	{ "lua_startprofiler", "(JI)V", (void *) jnlua_startprofiler },
+	{ "lua_stopprofiler", "(J)V", (void *) jnlua_stopprofiler },
+	{ "lua_drainprofiler", "(J)[I", (void *) jnlua_drainprofiler },
+	{ "lua_profilerframes", "(JI)[Ljava/lang/String;", (void *) jnlua_profilerframes },
+	{ "lua_tablesize", "(JI)I", (void *) jnlua_tablesize },
+	{ "lua_tablemove", "(JIIII)V", (void *) jnlua_tablemove },
+	{ "lua_pusharray", "(JLjava/lang/Object;I)V", (void *) jnlua_pusharray },
+	{ "lua_toarray", "(JII)Ljava/lang/Object;", (void *) jnlua_toarray },
+	{ "lua_batch", "(JLjava/nio/ByteBuffer;ILjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;[Ljava/lang/Object;)V", (void *) jnlua_batch }
+};
+
+/* Native methods of the Java debug structure. */
+static JNINativeMethod luadebug_natives[] = {
+	{ "lua_debugfree", "()V", (void *) jnlua_debugfree },
+	{ "lua_debugname", "()Ljava/lang/String;", (void *) jnlua_debugname },
+	{ "lua_debugnamewhat", "()Ljava/lang/String;", (void *) jnlua_debugnamewhat }
+};
+
 /* Handles the loading of this library. */
 JNIEXPORT jint JNICALL JNI_OnLoad (JavaVM *vm, void *reserved) {
 	JNIEnv *env;
@@ -1766,7 +3260,7 @@ JNIEXPORT jint JNICALL JNI_OnLoad (JavaVM *vm, void *reserved) {
 	if (!(luastate_class = referenceclass(env, "com/naef/jnlua/LuaState"))
 			|| !(luastate_id = (*env)->GetFieldID(env, luastate_class, "luaState", "J"))
 			|| !(luathread_id = (*env)->GetFieldID(env, luastate_class, "luaThread", "J"))
-			|| !(yield_id = (*env)->GetFieldID(env, luastate_class, "yield", "Z"))) {
+			|| !(pendingthrowable_id = (*env)->GetFieldID(env, luastate_class, "pendingThrowable", "Ljava/lang/Throwable;"))) {
 		return JNLUA_JNIVERSION;
 	}
 	if (!(luadebug_class = referenceclass(env, "com/naef/jnlua/LuaState$LuaDebug"))
@@ -1799,13 +3293,13 @@ JNIEXPORT jint JNICALL JNI_OnLoad (JavaVM *vm, void *reserved) {
 			|| !(luamessagehandlerexception_id = (*env)->GetMethodID(env, luamessagehandlerexception_class, "<init>", "(Ljava/lang/String;)V"))) {
 		return JNLUA_JNIVERSION;
 	}
-	if (!(luastacktraceelement_class = referenceclass(env, "com/naef/jnlua/LuaStackTraceElement"))
-			|| !(luastacktraceelement_id = (*env)->GetMethodID(env, luastacktraceelement_class, "<init>", "(Ljava/lang/String;Ljava/lang/String;I)V"))) {
+	if (!(luainterruptedexception_class = referenceclass(env, "com/naef/jnlua/LuaInterruptedException"))
+			|| !(luainterruptedexception_id = (*env)->GetMethodID(env, luainterruptedexception_class, "<init>", "(Ljava/lang/String;)V"))) {
 		return JNLUA_JNIVERSION;
 	}
 	if (!(luaerror_class = referenceclass(env, "com/naef/jnlua/LuaError"))
 			|| !(luaerror_id = (*env)->GetMethodID(env, luaerror_class, "<init>", "(Ljava/lang/String;Ljava/lang/Throwable;)V"))
-			|| !(setluastacktrace_id = (*env)->GetMethodID(env, luaerror_class, "setLuaStackTrace", "([Lcom/naef/jnlua/LuaStackTraceElement;)V"))) {
+			|| !(setluastacktrace_id = (*env)->GetMethodID(env, luaerror_class, "setLuaStackTrace", "(Ljava/lang/String;)V"))) {
 		return JNLUA_JNIVERSION;
 	}
 	if (!(nullpointerexception_class = referenceclass(env, "java/lang/NullPointerException"))) {
@@ -1839,6 +3333,30 @@ JNIEXPORT jint JNICALL JNI_OnLoad (JavaVM *vm, void *reserved) {
 	if (!(ioexception_class = referenceclass(env, "java/io/IOException"))) {
 		return JNLUA_JNIVERSION;
 	}
+	if (!(string_class = referenceclass(env, "java/lang/String"))) {
+		return JNLUA_JNIVERSION;
+	}
+	if (!(bytebuffer_class = referenceclass(env, "java/nio/ByteBuffer"))
+			|| !(allocatedirect_id = (*env)->GetStaticMethodID(env, bytebuffer_class, "allocateDirect", "(I)Ljava/nio/ByteBuffer;"))) {
+		return JNLUA_JNIVERSION;
+	}
+	if (!(system_class = referenceclass(env, "java/lang/System"))
+			|| !(identityhashcode_id = (*env)->GetStaticMethodID(env, system_class, "identityHashCode", "(Ljava/lang/Object;)I"))) {
+		return JNLUA_JNIVERSION;
+	}
+	if (!(object_class = referenceclass(env, "java/lang/Object"))) {
+		return JNLUA_JNIVERSION;
+	}
+	if (!(arrays_class = referenceclass(env, "java/util/Arrays"))
+			|| !(copyof_id = (*env)->GetStaticMethodID(env, arrays_class, "copyOf", "([Ljava/lang/Object;I)[Ljava/lang/Object;"))) {
+		return JNLUA_JNIVERSION;
+	}
+
+	/* Register native methods */
+	if ((*env)->RegisterNatives(env, luastate_class, luastate_natives, sizeof(luastate_natives) / sizeof(JNINativeMethod)) != JNI_OK
+			|| (*env)->RegisterNatives(env, luadebug_class, luadebug_natives, sizeof(luadebug_natives) / sizeof(JNINativeMethod)) != JNI_OK) {
+		return JNLUA_JNIVERSION;
+	}
 
 	/* OK */
 	initialized = 1;
@@ -1876,8 +3394,8 @@ JNIEXPORT void JNICALL JNI_OnUnload (JavaVM *vm, void *reserved) {
 	if (luamessagehandlerexception_class) {
 		(*env)->DeleteGlobalRef(env, luamessagehandlerexception_class);
 	}
-	if (luastacktraceelement_class) {
-		(*env)->DeleteGlobalRef(env, luastacktraceelement_class);
+	if (luainterruptedexception_class) {
+		(*env)->DeleteGlobalRef(env, luainterruptedexception_class);
 	}
 	if (luaerror_class) {
 		(*env)->DeleteGlobalRef(env, luaerror_class);
@@ -1909,6 +3427,21 @@ JNIEXPORT void JNICALL JNI_OnUnload (JavaVM *vm, void *reserved) {
 	if (ioexception_class) {
 		(*env)->DeleteGlobalRef(env, ioexception_class);
 	}
+	if (string_class) {
+		(*env)->DeleteGlobalRef(env, string_class);
+	}
+	if (bytebuffer_class) {
+		(*env)->DeleteGlobalRef(env, bytebuffer_class);
+	}
+	if (system_class) {
+		(*env)->DeleteGlobalRef(env, system_class);
+	}
+	if (object_class) {
+		(*env)->DeleteGlobalRef(env, object_class);
+	}
+	if (arrays_class) {
+		(*env)->DeleteGlobalRef(env, arrays_class);
+	}
 }
 
 /* ---- JNI helpers ---- */
@@ -1934,23 +3467,97 @@ static jbyteArray newbytearray (jsize length) {
 	return array;
 }
 
-/* Returns the  UTF chars of a string. */
+/* Returns the UTF-8 chars of a string. */
 static const char *getstringchars (jstring string) {
-	const char *utf;
-
 	if (!checknotnull(string)) {
 		return NULL;
 	}
-	utf = (*thread_env)->GetStringUTFChars(thread_env, string, NULL);
-	if (!check(utf != NULL, luamemoryallocationexception_class, "JNI error: GetStringUTFChars() failed")) {
+	return getutf8chars(string, NULL, 0, NULL);
+}
+
+/* Releases the UTF-8 chars of a string. */
+static void releasestringchars (jstring string, const char *chars) {
+	free((void *) chars);
+}
+
+/*
+ * Returns the zero-terminated UTF-8 encoding of a string. The buffer is used
+ * if it has sufficient capacity; otherwise, memory is allocated.
+ */
+static char *getutf8chars (jstring string, char *buffer, size_t capacity, size_t *size) {
+	const jchar *chars;
+	jsize length;
+	char *utf8;
+	size_t n;
+	
+	length = (*thread_env)->GetStringLength(thread_env, string);
+	chars = (*thread_env)->GetStringCritical(thread_env, string, NULL);
+	if (!chars) {
+		check(0, luamemoryallocationexception_class, "JNI error: GetStringCritical() failed");
+		return NULL;
+	}
+	if ((size_t) length * 3 < capacity) {
+		utf8 = buffer;
+	} else {
+		utf8 = malloc(utf8size(chars, length) + 1);
+	}
+	if (utf8) {
+		n = encodeutf8(chars, length, utf8);
+		utf8[n] = '\0';
+		if (size) {
+			*size = n;
+		}
+	}
+	(*thread_env)->ReleaseStringCritical(thread_env, string, chars);
+	if (!check(utf8 != NULL, luamemoryallocationexception_class, "JNI error: malloc() failed")) {
 		return NULL;
 	}
-	return utf;
+	return utf8;
 }
 
-/* Releaes the UTF chars of a string. */
-static void releasestringchars (jstring string, const char *chars) {
-	(*thread_env)->ReleaseStringUTFChars(thread_env, string, chars);
+/* Releases the UTF-8 encoding of a string. */
+static void releaseutf8chars (char *utf8, char *buffer) {
+	if (utf8 != buffer) {
+		free(utf8);
+	}
+}
+
+/* Returns a new string from UTF-8 chars. */
+static jstring newstring (const char *utf8, size_t size) {
+	jchar buffer[JNLUA_STRINGBUFFER / sizeof(jchar)];
+	jchar *chars;
+	jstring string;
+	size_t length;
+	
+	if (size <= sizeof(buffer) / sizeof(jchar)) {
+		chars = buffer;
+	} else {
+		chars = malloc(size * sizeof(jchar));
+		if (!check(chars != NULL, luamemoryallocationexception_class, "JNI error: malloc() failed")) {
+			return NULL;
+		}
+	}
+	chars[0] = 0; /* decoding writes at least one char unless size is 0 */
+	length = decodeutf8(utf8, size, chars);
+	string = (*thread_env)->NewString(thread_env, chars, (jsize) length);
+	if (chars != buffer) {
+		free(chars);
+	}
+	return string;
+}
+
+/* Dumps the function on top of the stack into memory. */
+static int dumpchunk (lua_State *L, int strip, Dump *dump) {
+	if (!checkarg(lua_isfunction(L, -1) && !lua_iscfunction(L, -1), "illegal function")) {
+		return 0;
+	}
+	if (!check(lua_dump(L, dumphandler, dump) == 0, luamemoryallocationexception_class, "JNI error: realloc() failed")) {
+		return 0;
+	}
+	if (strip && !check(stripchunk(dump), illegalstateexception_class, "cannot strip chunk")) {
+		return 0;
+	}
+	return 1;
 }
 
 /* ---- Java state operations ---- */
@@ -1974,16 +3581,6 @@ static void setluathread (jobject javastate, lua_State *L) {
 	(*thread_env)->SetLongField(thread_env, javastate, luathread_id, (jlong) (uintptr_t) L);
 }
 
-/* Returns the yield flag from the Java state */
-static int getyield (jobject javastate) {
-	return (int) (*thread_env)->GetBooleanField(thread_env, javastate, yield_id);
-}
-
-/* Sets the yield flag in the Java state */
-static void setyield (jobject javastate, int yield) {
-	(*thread_env)->SetBooleanField(thread_env, javastate, yield_id, (jboolean) yield);
-}
-
 /* Returns the Lua debug structure in a Java debug object. */
 static lua_Debug *getluadebug (jobject javadebug) {
 	return (lua_Debug *) (uintptr_t) (*thread_env)->GetLongField(thread_env, javadebug, luadebug_field_id);
@@ -1994,31 +3591,1021 @@ static void setluadebug (jobject javadebug, lua_Debug *ar) {
 	(*thread_env)->SetLongField(thread_env, javadebug, luadebug_field_id, (jlong) (uintptr_t) ar);
 }
 
-/* ---- Checks ---- */
-/* Returns whether an index is valid. */
-static int validindex (lua_State *L, int index) {
-	int top;
+/* ---- Native state ---- */
+/*
+ * Creates a native state. If pool is true, the native state allocates from a
+ * pool allocator.
+ */
+static NativeState *newnativestate (lua_Alloc allocf, void *allocud, int pool) {
+	NativeState *ns;
+	int i;
 	
-	top = lua_gettop(L);
-	if (index <= 0) {
-		if (index > LUA_REGISTRYINDEX) {
-			index = top + index + 1;
-		} else {
-			switch (index) {
-			case LUA_REGISTRYINDEX:
-				return 1;
-			default:
-				return 0; /* C upvalue access not needed, don't even validate */
-			}
-		}
+	ns = malloc(sizeof(NativeState));
+	if (!ns) {
+		return NULL;
 	}
-	return index >= 1 && index <= top;
+	ns->allocf = allocf;
+	ns->allocud = allocud;
+	ns->pool = NULL;
+	if (pool && !(ns->pool = newpool())) {
+		free(ns);
+		return NULL;
+	}
+	ns->used = 0;
+	ns->peak = 0;
+	ns->limit = 0;
+	ns->allocations = 0;
+	ns->running = NULL;
+	ns->interrupted = 0;
+	ns->budget = 0;
+	ns->deadline = 0;
+	ns->poll = 0;
+	ns->stopped = NULL;
+	ns->profiler = NULL;
+	ns->metrics = NULL;
+	ns->globalrefs = 0;
+	ns->cacheprobes = 0;
+	ns->stacktrace = 1;
+	ns->tracestatus = JNLUA_TRACENONE;
+	ns->trace = NULL;
+	ns->tracelength = 0;
+	ns->tracecapacity = 0;
+	ns->lightweighterrors = 0;
+	ns->javaerror = NULL;
+	ns->javaobject = NULL;
+	ns->pendingerror = NULL;
+	ns->errorsequence = 0;
+	ns->errorcount = 0;
+	ns->handles = NULL;
+	ns->javastate = NULL;
+	ns->luathread = NULL;
+	ns->yield = 0;
+	ns->continuation = NULL;
+	ns->refs = 1;
+	for (i = 0; i < JNLUA_KEYCACHE; i++) {
+		ns->keys[i].ref = LUA_NOREF;
+	}
+	return ns;
 }
 
-/* Checks stack space. */
-static int checkstack (lua_State *L, int space) {
-	return check(lua_checkstack(L, space), illegalstateexception_class, "stack overflow");
-}
+/*
+ * Releases a native state. When the native state is no longer referenced, a
+ * chained allocator is restored in the Lua state, if any, and the native
+ * state is freed.
+ */
+static void releasenativestate (lua_State *L, NativeState *ns) {
+	if (!ns || --ns->refs > 0) {
+		return;
+	}
+	if (L && ns->allocf) {
+		lua_setallocf(L, ns->allocf, ns->allocud);
+	}
+	if (ns->pool) {
+		freepool(ns->pool);
+	}
+	if (ns->profiler) {
+		freeprofiler(ns->profiler);
+	}
+	if (ns->handles) {
+		freehandles(ns->handles);
+	}
+	if (ns->continuation && thread_env) {
+		(*thread_env)->DeleteGlobalRef(thread_env, ns->continuation);
+	}
+	free(ns->metrics);
+	free(ns->trace);
+	free(ns);
+}
+
+/* Returns the native state of a Lua state, or NULL if there is none. */
+static NativeState *getnativestate (lua_State *L) {
+	void *ud;
+	
+	return lua_getallocf(L, &ud) == allocate ? (NativeState *) ud : NULL;
+}
+
+/*
+ * Allocates memory for a Lua state and accounts for it. An allocation that
+ * would exceed the memory limit fails.
+ */
+static void *allocate (void *ud, void *ptr, size_t osize, size_t nsize) {
+	NativeState *ns = (NativeState *) ud;
+	void *block;
+	size_t size;
+	
+	/* For new blocks, the old size encodes the type of the object */
+	size = ptr ? osize : 0;
+	if (ns->limit && nsize > size && ns->used + (nsize - size) > ns->limit) {
+		return NULL;
+	}
+	if (ns->allocf) {
+		block = ns->allocf(ns->allocud, ptr, osize, nsize);
+	} else if (ns->pool) {
+		block = poolrealloc(ns->pool, ptr, osize, nsize);
+	} else if (nsize == 0) {
+		free(ptr);
+		block = NULL;
+	} else {
+		block = realloc(ptr, nsize);
+	}
+	if (block || nsize == 0) {
+		/* Blocks of an attached state may predate the native state */
+		ns->used = (ns->used > size ? ns->used - size : 0) + (block ? nsize : 0);
+		if (ns->used > ns->peak) {
+			ns->peak = ns->used;
+		}
+		if (block) {
+			ns->allocations++;
+		}
+	}
+	return block;
+}
+
+/* Handles an unprotected error in a Lua state. */
+static int panic (lua_State *L) {
+	fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+	return 0;
+}
+
+/* ---- Pool allocator ---- */
+/*
+ * Creates a pool allocator. Blocks up to JNLUA_POOLMAX bytes are carved from
+ * slabs and kept in free lists per size class; larger blocks are allocated
+ * with malloc. Slabs are released when the pool is freed.
+ */
+static Pool *newpool (void) {
+	return calloc(1, sizeof(Pool));
+}
+
+/* Frees a pool allocator and its slabs. */
+static void freepool (Pool *pool) {
+	void *slab;
+	
+	while ((slab = pool->slabs)) {
+		pool->slabs = *(void **) slab;
+		free(slab);
+	}
+	free(pool);
+}
+
+/* Allocates, reallocates or frees a block with the semantics of lua_Alloc. */
+static void *poolrealloc (Pool *pool, void *ptr, size_t osize, size_t nsize) {
+	void *block;
+	
+	/* For new blocks, the old size encodes the type of object. */
+	if (!ptr) {
+		osize = 0;
+	}
+	if (nsize == 0) {
+		poolfree(pool, ptr, osize);
+		return NULL;
+	}
+	if (osize > JNLUA_POOLMAX && nsize > JNLUA_POOLMAX) {
+		return realloc(ptr, nsize);
+	}
+	if (osize > 0 && osize <= JNLUA_POOLMAX && nsize <= JNLUA_POOLMAX
+			&& JNLUA_POOLCLASS(osize) == JNLUA_POOLCLASS(nsize)) {
+		return ptr;
+	}
+	block = nsize <= JNLUA_POOLMAX ? poolalloc(pool, nsize) : malloc(nsize);
+	if (!block) {
+		/*
+		 * Lua requires that shrinking a block does not fail. The larger block
+		 * is kept; it is returned to the smaller size class when freed.
+		 */
+		return nsize < osize ? ptr : NULL;
+	}
+	if (ptr) {
+		memcpy(block, ptr, osize < nsize ? osize : nsize);
+		poolfree(pool, ptr, osize);
+	}
+	return block;
+}
+
+/* Allocates a block from the free list of its size class. */
+static void *poolalloc (Pool *pool, size_t size) {
+	size_t class, blocksize;
+	char *slab, *block;
+	void *result;
+	
+	class = JNLUA_POOLCLASS(size);
+	if (!pool->free[class]) {
+		/* Carve a new slab into blocks of the size class. */
+		if (!(slab = malloc(JNLUA_SLABSIZE))) {
+			return NULL;
+		}
+		*(void **) slab = pool->slabs;
+		pool->slabs = slab;
+		blocksize = (class + 1) * JNLUA_POOLGRANULE;
+		for (block = slab + JNLUA_SLABHEADER; block + blocksize <= slab + JNLUA_SLABSIZE; block += blocksize) {
+			*(void **) block = pool->free[class];
+			pool->free[class] = block;
+		}
+	}
+	result = pool->free[class];
+	pool->free[class] = *(void **) result;
+	return result;
+}
+
+/* Frees a block to the free list of its size class. */
+static void poolfree (Pool *pool, void *block, size_t size) {
+	size_t class;
+	
+	if (!block) {
+		return;
+	}
+	if (size > JNLUA_POOLMAX) {
+		free(block);
+		return;
+	}
+	class = JNLUA_POOLCLASS(size);
+	*(void **) block = pool->free[class];
+	pool->free[class] = block;
+}
+
+/* ---- Handles ---- */
+/*
+ * Creates a handle table. Java object userdata reference their object by a
+ * slot in the Java array of the handle table instead of a global reference
+ * per object. Returns NULL on failure.
+ */
+static Handles *newhandles (void) {
+	Handles *handles;
+	jobjectArray objects;
+	
+	handles = malloc(sizeof(Handles));
+	if (!handles) {
+		return NULL;
+	}
+	handles->free = malloc(JNLUA_HANDLES * sizeof(jint));
+	objects = (*thread_env)->NewObjectArray(thread_env, JNLUA_HANDLES, object_class, NULL);
+	handles->objects = objects ? (*thread_env)->NewGlobalRef(thread_env, objects) : NULL;
+	if (!handles->free || !handles->objects) {
+		(*thread_env)->ExceptionClear(thread_env);
+		free(handles->free);
+		free(handles);
+		return NULL;
+	}
+	(*thread_env)->DeleteLocalRef(thread_env, objects);
+	handles->capacity = JNLUA_HANDLES;
+	handles->next = 0;
+	handles->freecount = 0;
+	handles->pendingcount = 0;
+	handles->count = 0;
+	return handles;
+}
+
+/* Frees a handle table, releasing all Java objects it references. */
+static void freehandles (Handles *handles) {
+	if (thread_env) {
+		(*thread_env)->DeleteGlobalRef(thread_env, handles->objects);
+	}
+	free(handles->free);
+	free(handles);
+}
+
+/*
+ * Stores a Java object in a handle table and returns its slot, or -1 if the
+ * handle table cannot grow. Slots pending release are reused before the
+ * handle table grows.
+ */
+static jint newhandle (Handles *handles, jobject object) {
+	jint slot;
+	
+	if (handles->freecount == 0 && handles->next == handles->capacity) {
+		flushhandles(handles);
+		if (handles->freecount == 0 && !growhandles(handles)) {
+			return -1;
+		}
+	}
+	if (handles->freecount > 0) {
+		slot = handles->free[--handles->freecount];
+		handles->free[handles->freecount] = handles->free[handles->freecount + handles->pendingcount];
+	} else {
+		slot = handles->next++;
+	}
+	(*thread_env)->SetObjectArrayElement(thread_env, handles->objects, slot, object);
+	handles->count++;
+	return slot;
+}
+
+/*
+ * Releases a slot of a handle table. The Java objects of released slots are
+ * cleared in batches.
+ */
+static void releasehandle (Handles *handles, jint slot) {
+	handles->free[handles->freecount + handles->pendingcount++] = slot;
+	handles->count--;
+	if (handles->pendingcount >= JNLUA_HANDLEBATCH) {
+		flushhandles(handles);
+	}
+}
+
+/*
+ * Clears the Java objects of the slots pending release and makes the slots
+ * free. The slots remain pending while a Java exception is pending.
+ */
+static void flushhandles (Handles *handles) {
+	jint i;
+	
+	if (!thread_env || (*thread_env)->ExceptionCheck(thread_env)) {
+		return;
+	}
+	for (i = 0; i < handles->pendingcount; i++) {
+		(*thread_env)->SetObjectArrayElement(thread_env, handles->objects, handles->free[handles->freecount + i], NULL);
+	}
+	handles->freecount += handles->pendingcount;
+	handles->pendingcount = 0;
+}
+
+/* Doubles the capacity of a handle table. Returns 0 on failure. */
+static int growhandles (Handles *handles) {
+	jobjectArray objects, ref;
+	jint *slots;
+	jint capacity;
+	
+	if (handles->capacity > 0x3fffffff || (size_t) handles->capacity > ((size_t) -1) / 2 / sizeof(jint)) {
+		return 0;
+	}
+	capacity = handles->capacity * 2;
+	slots = realloc(handles->free, capacity * sizeof(jint));
+	if (!slots) {
+		return 0;
+	}
+	handles->free = slots;
+	objects = (*thread_env)->CallStaticObjectMethod(thread_env, arrays_class, copyof_id, handles->objects, capacity);
+	ref = objects ? (*thread_env)->NewGlobalRef(thread_env, objects) : NULL;
+	if (!ref) {
+		(*thread_env)->ExceptionClear(thread_env);
+		return 0;
+	}
+	(*thread_env)->DeleteLocalRef(thread_env, objects);
+	(*thread_env)->DeleteGlobalRef(thread_env, handles->objects);
+	handles->objects = ref;
+	handles->capacity = capacity;
+	return 1;
+}
+
+/* ---- Hooks ---- */
+/*
+ * Starts the execution budget of a call. Only the outermost call of a Lua
+ * state has a budget, which applies to any nested calls. If poll is set, the
+ * call checks the interrupt flag periodically even without a budget, as an
+ * interrupt only hooks the main thread. Returns whether the budget has been
+ * started.
+ */
+static int startbudget (lua_State *L, jlong instructions, jlong timeout, int poll) {
+	NativeState *ns;
+	
+	ns = getnativestate(L);
+	if (!ns || ns->running) {
+		return 0;
+	}
+	ns->running = L;
+	ns->interrupted = 0;
+	ns->budget = instructions;
+	ns->deadline = timeout > 0 ? currenttime() + timeout * 1000000 : 0;
+	ns->poll = poll;
+	ns->stopped = NULL;
+	sethook(L, ns);
+	return 1;
+}
+
+/* Ends the execution budget of a call. */
+static void endbudget (lua_State *L) {
+	NativeState *ns;
+	
+	ns = getnativestate(L);
+	ns->running = NULL;
+	ns->poll = 0;
+	ns->stopped = NULL;
+	sethook(L, ns);
+}
+
+/*
+ * Sets or clears the count hook of a Lua thread, depending on whether a
+ * budget, interrupt polling or the profiler needs it.
+ */
+static void sethook (lua_State *L, NativeState *ns) {
+	if ((ns->running && (ns->budget > 0 || ns->deadline || ns->poll)) || (ns->profiler && ns->profiler->active)) {
+		if (lua_gethook(L) != counthook || lua_gethookcount(L) != JNLUA_HOOKCOUNT) {
+			lua_sethook(L, counthook, LUA_MASKCOUNT, JNLUA_HOOKCOUNT);
+		}
+	} else if (lua_gethook(L) == counthook) {
+		lua_sethook(L, NULL, 0, 0);
+	}
+}
+
+/*
+ * Takes profiler samples and checks the execution budget of the running
+ * call. Once the budget is exhausted or the call is interrupted, the hook
+ * raises an error on every instruction, so the error cannot be absorbed by a
+ * protected call in Lua.
+ */
+static void counthook (lua_State *L, lua_Debug *ar) {
+	NativeState *ns;
+	
+	ns = getnativestate(L);
+	if (!ns) {
+		lua_sethook(L, NULL, 0, 0);
+		return;
+	}
+	if (ns->profiler && ns->profiler->active) {
+		sample(L, ns->profiler);
+	}
+	if (ns->running && !ns->stopped) {
+		if (ns->interrupted) {
+			ns->stopped = "interrupted";
+		} else if (ns->budget > 0 && (ns->budget -= lua_gethookcount(L)) <= 0) {
+			ns->stopped = "instruction limit exceeded";
+		} else if (ns->deadline && currenttime() >= ns->deadline) {
+			ns->stopped = "timeout";
+		}
+	}
+	if (ns->running && ns->stopped) {
+		lua_sethook(L, counthook, LUA_MASKCOUNT, 1);
+		luaL_error(L, "%s", ns->stopped);
+	}
+	
+	/* Restores the count after an interrupt, or clears a stale hook */
+	sethook(L, ns);
+}
+
+/* Returns the value of a monotonic clock in nanoseconds. */
+static jlong currenttime (void) {
+#ifdef LUA_WIN
+	LARGE_INTEGER counter, frequency;
+	
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (jlong) (counter.QuadPart / frequency.QuadPart * 1000000000
+			+ counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart);
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (jlong) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* ---- Sampling profiler ---- */
+/* Creates a profiler. */
+static Profiler *newprofiler (void) {
+	Profiler *profiler;
+	
+	profiler = malloc(sizeof(Profiler));
+	if (!profiler) {
+		return NULL;
+	}
+	memset(profiler, 0, sizeof(Profiler));
+	profiler->samples = malloc(JNLUA_PROFILEBUFFER * sizeof(jint));
+	if (!profiler->samples) {
+		free(profiler);
+		return NULL;
+	}
+	profiler->capacity = JNLUA_PROFILEBUFFER;
+	return profiler;
+}
+
+/* Frees a profiler. */
+static void freeprofiler (Profiler *profiler) {
+	jint i;
+	
+	for (i = 0; i < profiler->framecount; i++) {
+		free(profiler->frames[i]);
+	}
+	free(profiler->frames);
+	free(profiler->slots);
+	free(profiler->samples);
+	free(profiler);
+}
+
+/*
+ * Records a sample of the stack of a Lua thread if the sampling interval has
+ * elapsed. A sample is stored as its depth, followed by the frame
+ * identifiers from the outermost frame to the innermost frame. If the sample
+ * buffer is full, the sample is dropped.
+ */
+static void sample (lua_State *L, Profiler *profiler) {
+	lua_Debug ar;
+	jint frames[JNLUA_PROFILEDEPTH];
+	jint depth, i;
+	jlong now;
+	
+	now = currenttime();
+	if (now < profiler->next) {
+		return;
+	}
+	profiler->next = now + profiler->interval;
+	depth = 0;
+	while (depth < JNLUA_PROFILEDEPTH && lua_getstack(L, depth, &ar)) {
+		lua_getinfo(L, "Sln", &ar);
+		if ((frames[depth] = profileframe(profiler, &ar)) < 0) {
+			profiler->dropped++;
+			return;
+		}
+		depth++;
+	}
+	if (depth == 0) {
+		return;
+	}
+	if (profiler->size + depth + 1 > profiler->capacity) {
+		profiler->dropped++;
+		return;
+	}
+	profiler->samples[profiler->size++] = depth;
+	for (i = depth - 1; i >= 0; i--) {
+		profiler->samples[profiler->size++] = frames[i];
+	}
+}
+
+/*
+ * Returns the identifier of a stack frame, interning its label as required,
+ * or -1 if memory is exhausted. Labels have the form "name (source:line)".
+ */
+static jint profileframe (Profiler *profiler, lua_Debug *ar) {
+	char label[256], **frames;
+	const char *name;
+	unsigned int hash;
+	size_t length;
+	jint i, id, *slots, slotcount;
+	char *p;
+	
+	/* Format label; semicolons separate frames in folded stacks */
+	name = ar->name ? ar->name : (*ar->what == 'm' ? "main chunk" : "?");
+	if (ar->currentline > 0) {
+		sprintf(label, "%.120s (%.80s:%d)", name, ar->short_src, ar->currentline);
+	} else {
+		sprintf(label, "%.120s (%.80s)", name, ar->short_src);
+	}
+	for (p = label; *p; p++) {
+		if (*p == ';') {
+			*p = ':';
+		}
+	}
+	length = p - label;
+	hash = hashlabel(label);
+	
+	/* Look up */
+	if (profiler->slotcount > 0) {
+		i = (jint) (hash & (profiler->slotcount - 1));
+		while ((id = profiler->slots[i]) != 0) {
+			if (strcmp(profiler->frames[id - 1], label) == 0) {
+				return id - 1;
+			}
+			i = (i + 1) & (profiler->slotcount - 1);
+		}
+	}
+	
+	/* Grow the frames and rehash the slots at half load */
+	if (profiler->framecount == profiler->framecapacity) {
+		frames = realloc(profiler->frames, (profiler->framecapacity * 2 + 64) * sizeof(char *));
+		if (!frames) {
+			return -1;
+		}
+		profiler->frames = frames;
+		profiler->framecapacity = profiler->framecapacity * 2 + 64;
+	}
+	if (2 * (profiler->framecount + 1) > profiler->slotcount) {
+		slotcount = profiler->slotcount > 0 ? profiler->slotcount * 2 : 256;
+		slots = calloc(slotcount, sizeof(jint));
+		if (!slots) {
+			return -1;
+		}
+		for (id = 0; id < profiler->framecount; id++) {
+			i = (jint) (hashlabel(profiler->frames[id]) & (slotcount - 1));
+			while (slots[i] != 0) {
+				i = (i + 1) & (slotcount - 1);
+			}
+			slots[i] = id + 1;
+		}
+		free(profiler->slots);
+		profiler->slots = slots;
+		profiler->slotcount = slotcount;
+	}
+	
+	/* Add */
+	p = malloc(length + 1);
+	if (!p) {
+		return -1;
+	}
+	memcpy(p, label, length + 1);
+	id = profiler->framecount++;
+	profiler->frames[id] = p;
+	i = (jint) (hash & (profiler->slotcount - 1));
+	while (profiler->slots[i] != 0) {
+		i = (i + 1) & (profiler->slotcount - 1);
+	}
+	profiler->slots[i] = id + 1;
+	return id;
+}
+
+/* Returns the FNV-1a hash of a frame label. */
+static unsigned int hashlabel (const char *label) {
+	unsigned int hash;
+	
+	hash = 2166136261u;
+	while (*label) {
+		hash = (hash ^ (unsigned char) *label++) * 16777619u;
+	}
+	return hash;
+}
+
+/* ---- Instrumentation ---- */
+/*
+ * Native methods with a Lua thread argument are instrumented. The list is
+ * expanded into the instrumented wrappers and into the table mapping the
+ * native methods to their wrappers.
+ */
+#define JNLUA_INSTRUMENTED(X, XVOID) \
+	X(gc, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint what, jint data), (env, clazz, luathread, what, data)) \
+	XVOID(setmemorylimit, (JNIEnv *env, jclass clazz, jlong luathread, jlong limit), (env, clazz, luathread, limit)) \
+	XVOID(openlib, (JNIEnv *env, jclass clazz, jlong luathread, jint lib), (env, clazz, luathread, lib)) \
+	XVOID(load, (JNIEnv *env, jclass clazz, jlong luathread, jobject inputStream, jstring chunkname, jstring mode), (env, clazz, luathread, inputStream, chunkname, mode)) \
+	XVOID(loadbuffer, (JNIEnv *env, jclass clazz, jlong luathread, jobject buffer, jint position, jint length, jstring chunkname, jstring mode), (env, clazz, luathread, buffer, position, length, chunkname, mode)) \
+	XVOID(loadbytearray, (JNIEnv *env, jclass clazz, jlong luathread, jbyteArray ba, jint offset, jint length, jstring chunkname, jstring mode), (env, clazz, luathread, ba, offset, length, chunkname, mode)) \
+	XVOID(dump, (JNIEnv *env, jclass clazz, jlong luathread, jobject outputStream), (env, clazz, luathread, outputStream)) \
+	X(dumpbytearray, jbyteArray, (JNIEnv *env, jclass clazz, jlong luathread, jboolean strip), (env, clazz, luathread, strip)) \
+	X(dumpbytebuffer, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jboolean strip), (env, clazz, luathread, strip)) \
+	XVOID(pcall, (JNIEnv *env, jclass clazz, jlong luathread, jint nargs, jint nresults, jlong instructions, jlong timeout), (env, clazz, luathread, nargs, nresults, instructions, timeout)) \
+	XVOID(getglobal, (JNIEnv *env, jclass clazz, jlong luathread, jstring name), (env, clazz, luathread, name)) \
+	XVOID(setglobal, (JNIEnv *env, jclass clazz, jlong luathread, jstring name), (env, clazz, luathread, name)) \
+	XVOID(pushboolean, (JNIEnv *env, jclass clazz, jlong luathread, jint b), (env, clazz, luathread, b)) \
+	XVOID(pushbytearray, (JNIEnv *env, jclass clazz, jlong luathread, jbyteArray ba), (env, clazz, luathread, ba)) \
+	XVOID(pushbytebuffer, (JNIEnv *env, jclass clazz, jlong luathread, jobject buffer, jint position, jint length), (env, clazz, luathread, buffer, position, length)) \
+	XVOID(pushinteger, (JNIEnv *env, jclass clazz, jlong luathread, jint n), (env, clazz, luathread, n)) \
+	XVOID(pushjavafunction, (JNIEnv *env, jclass clazz, jlong luathread, jobject f), (env, clazz, luathread, f)) \
+	XVOID(pushjavaobject, (JNIEnv *env, jclass clazz, jlong luathread, jobject object, jint hash), (env, clazz, luathread, object, hash)) \
+	XVOID(pushnil, (JNIEnv *env, jclass clazz, jlong luathread), (env, clazz, luathread)) \
+	XVOID(pushnumber, (JNIEnv *env, jclass clazz, jlong luathread, jdouble n), (env, clazz, luathread, n)) \
+	XVOID(pushstring, (JNIEnv *env, jclass clazz, jlong luathread, jstring s), (env, clazz, luathread, s)) \
+	X(isboolean, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(iscfunction, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isfunction, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isjavafunction, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isjavaobject, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isnil, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isnone, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isnoneornil, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isnumber, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isstring, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(istable, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(isthread, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(compare, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index1, jint index2, jint operator), (env, clazz, luathread, index1, index2, operator)) \
+	X(rawequal, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index1, jint index2), (env, clazz, luathread, index1, index2)) \
+	X(rawlen, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(toboolean, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tobytearray, jbyteArray, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tobytebuffer, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tointeger, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tointegerx, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tojavafunction, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tojavaobject, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tonumber, jdouble, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tonumberx, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(topointer, jlong, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(tostring, jstring, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(type, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(describestack, (JNIEnv *env, jclass clazz, jlong luathread, jint from, jint to, jintArray types, jobjectArray objects), (env, clazz, luathread, from, to, types, objects)) \
+	X(absindex, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(arith, (JNIEnv *env, jclass clazz, jlong luathread, jint operator), (env, clazz, luathread, operator)) \
+	XVOID(concat, (JNIEnv *env, jclass clazz, jlong luathread, jint n), (env, clazz, luathread, n)) \
+	XVOID(copy, (JNIEnv *env, jclass clazz, jlong luathread, jint from_index, jint to_index), (env, clazz, luathread, from_index, to_index)) \
+	X(gettop, jint, (JNIEnv *env, jclass clazz, jlong luathread), (env, clazz, luathread)) \
+	XVOID(len, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(insert, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(pop, (JNIEnv *env, jclass clazz, jlong luathread, jint n), (env, clazz, luathread, n)) \
+	XVOID(pushvalue, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(remove, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(replace, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(settop, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(createtable, (JNIEnv *env, jclass clazz, jlong luathread, jint narr, jint nrec), (env, clazz, luathread, narr, nrec)) \
+	X(getsubtable, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring fname), (env, clazz, luathread, index, fname)) \
+	XVOID(gettable, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(getfield, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring k), (env, clazz, luathread, index, k)) \
+	XVOID(newtable, (JNIEnv *env, jclass clazz, jlong luathread), (env, clazz, luathread)) \
+	X(next, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(rawget, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(rawgeti, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint n), (env, clazz, luathread, index, n)) \
+	XVOID(rawset, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(rawseti, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint n), (env, clazz, luathread, index, n)) \
+	XVOID(settable, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(setfield, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring k), (env, clazz, luathread, index, k)) \
+	X(getmetatable, int, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(setmetatable, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	X(getmetafield, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jstring k), (env, clazz, luathread, index, k)) \
+	XVOID(newthread, (JNIEnv *env, jclass clazz, jlong luathread), (env, clazz, luathread)) \
+	X(resume, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint nargs), (env, clazz, luathread, index, nargs)) \
+	X(status, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(yield, (JNIEnv *env, jclass clazz, jlong luathread, jobject continuation), (env, clazz, luathread, continuation)) \
+	XVOID(setstacktrace, (JNIEnv *env, jclass clazz, jlong luathread, jint enabled), (env, clazz, luathread, enabled)) \
+	XVOID(setlightweighterrors, (JNIEnv *env, jclass clazz, jlong luathread, jint enabled), (env, clazz, luathread, enabled)) \
+	X(ref, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(unref, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint ref), (env, clazz, luathread, index, ref)) \
+	X(getstack, jobject, (JNIEnv *env, jclass clazz, jlong luathread, jint level), (env, clazz, luathread, level)) \
+	X(getinfo, jint, (JNIEnv *env, jclass clazz, jlong luathread, jstring what, jobject ar), (env, clazz, luathread, what, ar)) \
+	XVOID(startprofiler, (JNIEnv *env, jclass clazz, jlong luathread, jint interval), (env, clazz, luathread, interval)) \
+	XVOID(stopprofiler, (JNIEnv *env, jclass clazz, jlong luathread), (env, clazz, luathread)) \
+	X(drainprofiler, jintArray, (JNIEnv *env, jclass clazz, jlong luathread), (env, clazz, luathread)) \
+	X(profilerframes, jobjectArray, (JNIEnv *env, jclass clazz, jlong luathread, jint first), (env, clazz, luathread, first)) \
+	X(tablesize, jint, (JNIEnv *env, jclass clazz, jlong luathread, jint index), (env, clazz, luathread, index)) \
+	XVOID(tablemove, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint from, jint to, jint count), (env, clazz, luathread, index, from, to, count)) \
+	XVOID(pusharray, (JNIEnv *env, jclass clazz, jlong luathread, jarray array, jint type), (env, clazz, luathread, array, type)) \
+	X(toarray, jarray, (JNIEnv *env, jclass clazz, jlong luathread, jint index, jint type), (env, clazz, luathread, index, type)) \
+	XVOID(batch, (JNIEnv *env, jclass clazz, jlong luathread, jobject commands, jint size, jobject pool, jobject results, jobjectArray strings), (env, clazz, luathread, commands, size, pool, results, strings))
+#define JNLUA_WRAPPER(name, type, params, args) \
+	static int name##_id; \
+	static type JNICALL instrumented_##name params { \
+		type result; \
+		jlong start; \
+		\
+		start = currenttime(); \
+		result = jnlua_##name args; \
+		recordcrossing(luathread, name##_id, start); \
+		return result; \
+	}
+#define JNLUA_WRAPPERVOID(name, params, args) \
+	static int name##_id; \
+	static void JNICALL instrumented_##name params { \
+		jlong start; \
+		\
+		start = currenttime(); \
+		jnlua_##name args; \
+		recordcrossing(luathread, name##_id, start); \
+	}
+#define JNLUA_INSTRUMENTATION(name, type, params, args) { (void *) jnlua_##name, (void *) instrumented_##name, &name##_id },
+#define JNLUA_INSTRUMENTATIONVOID(name, params, args) { (void *) jnlua_##name, (void *) instrumented_##name, &name##_id },
+
+JNLUA_INSTRUMENTED(JNLUA_WRAPPER, JNLUA_WRAPPERVOID)
+
+static Instrumentation instrumentations[] = {
+	JNLUA_INSTRUMENTED(JNLUA_INSTRUMENTATION, JNLUA_INSTRUMENTATIONVOID)
+};
+
+/* lua_instrument() */
+static void JNICALL jnlua_instrument (JNIEnv *env, jclass clazz) {
+	JNINativeMethod *natives;
+	size_t count, i, j;
+	
+	JNLUA_ENV(env);
+	count = sizeof(luastate_natives) / sizeof(JNINativeMethod);
+	natives = malloc(sizeof(luastate_natives));
+	if (!check(natives != NULL, luamemoryallocationexception_class, "JNI error: malloc() failed")) {
+		return;
+	}
+	memcpy(natives, luastate_natives, sizeof(luastate_natives));
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < sizeof(instrumentations) / sizeof(Instrumentation); j++) {
+			if (natives[i].fnPtr == instrumentations[j].function) {
+				*instrumentations[j].id = (int) i;
+				natives[i].fnPtr = instrumentations[j].instrumented;
+				break;
+			}
+		}
+	}
+	(*env)->RegisterNatives(env, clazz, natives, (jint) count);
+	free(natives);
+}
+
+/* lua_metrics() */
+static jlongArray JNICALL jnlua_metrics (JNIEnv *env, jclass clazz, jlong luastate) {
+	lua_State *L;
+	NativeState *ns;
+	jlongArray array;
+	jsize length;
+	
+	JNLUA_ENV(env);
+	L = (lua_State *) (uintptr_t) luastate;
+	ns = getnativestate(L);
+	length = ns && ns->metrics ? (jsize) (sizeof(luastate_natives) / sizeof(JNINativeMethod) * (2 + JNLUA_LATENCYBUCKETS)) : 0;
+	array = (*env)->NewLongArray(env, length);
+	if (!check(array != NULL, luamemoryallocationexception_class, "JNI error: NewLongArray() failed")) {
+		return NULL;
+	}
+	if (length > 0) {
+		(*env)->SetLongArrayRegion(env, array, 0, length, ns->metrics);
+	}
+	return array;
+}
+
+/* lua_nativenames() */
+static jobjectArray JNICALL jnlua_nativenames (JNIEnv *env, jclass clazz) {
+	jobjectArray array;
+	jstring name;
+	jsize count, i;
+	
+	JNLUA_ENV(env);
+	count = (jsize) (sizeof(luastate_natives) / sizeof(JNINativeMethod));
+	array = (*env)->NewObjectArray(env, count, string_class, NULL);
+	if (!check(array != NULL, luamemoryallocationexception_class, "JNI error: NewObjectArray() failed")) {
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		name = (*env)->NewStringUTF(env, luastate_natives[i].name);
+		if (!name) {
+			return NULL;
+		}
+		(*env)->SetObjectArrayElement(env, array, i, name);
+		(*env)->DeleteLocalRef(env, name);
+	}
+	return array;
+}
+
+/*
+ * Records a crossing of an instrumented native method with its latency. The
+ * metrics hold the crossing counts, the total latencies and the latency
+ * histograms of all native methods. Histogram bucket i counts latencies of
+ * i significant bits, so its upper bound is 2^i nanoseconds; the last bucket
+ * also counts all longer latencies. The metrics are allocated on the first
+ * crossing.
+ */
+static void recordcrossing (jlong luathread, int id, jlong start) {
+	lua_State *L;
+	NativeState *ns;
+	jlong nanos, *metrics;
+	size_t count;
+	int bucket;
+	
+	nanos = currenttime() - start;
+	L = (lua_State *) (uintptr_t) luathread;
+	ns = getnativestate(L);
+	if (!ns) {
+		return;
+	}
+	count = sizeof(luastate_natives) / sizeof(JNINativeMethod);
+	if (!ns->metrics) {
+		ns->metrics = calloc(count * (2 + JNLUA_LATENCYBUCKETS), sizeof(jlong));
+		if (!ns->metrics) {
+			return;
+		}
+	}
+	metrics = ns->metrics;
+	metrics[id]++;
+	metrics[count + id] += nanos;
+	bucket = 0;
+	while (bucket < JNLUA_LATENCYBUCKETS - 1 && (nanos >> bucket) != 0) {
+		bucket++;
+	}
+	metrics[count * 2 + id * JNLUA_LATENCYBUCKETS + bucket]++;
+}
+
+/* ---- Fast paths ---- */
+/*
+ * Pushes a key string from the key cache and returns whether it has done so.
+ * Pushing a string anchored in the registry does not allocate, unlike
+ * interning it, which may run a collection step.
+ */
+static int pushcachedkey (lua_State *L, const char *k) {
+	NativeState *ns;
+	Key *key;
+	size_t length;
+	unsigned int hash;
+	
+	ns = getnativestate(L);
+	length = strlen(k);
+	if (!ns || length > JNLUA_KEYLENGTH) {
+		return 0;
+	}
+	hash = hashlabel(k);
+	key = &ns->keys[hash & (JNLUA_KEYCACHE - 1)];
+	if (key->ref == LUA_NOREF || key->hash != hash || key->length != length) {
+		return 0;
+	}
+	lua_rawgeti(L, LUA_REGISTRYINDEX, key->ref);
+	if (memcmp(lua_tostring(L, -1), k, length) != 0) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Adds a key string to the key cache, replacing the key in its slot. This
+ * allocates and must run protected.
+ */
+static void cachekey (lua_State *L, const char *k) {
+	NativeState *ns;
+	Key *key;
+	size_t length;
+	unsigned int hash;
+	int ref;
+	
+	ns = getnativestate(L);
+	length = strlen(k);
+	if (!ns || length > JNLUA_KEYLENGTH) {
+		return;
+	}
+	if (pushcachedkey(L, k)) {
+		lua_pop(L, 1);
+		return;
+	}
+	hash = hashlabel(k);
+	key = &ns->keys[hash & (JNLUA_KEYCACHE - 1)];
+	lua_pushlstring(L, k, length);
+	ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	luaL_unref(L, LUA_REGISTRYINDEX, key->ref);
+	key->ref = ref;
+	key->length = length;
+	key->hash = hash;
+}
+
+/*
+ * Pushes a field of the table at the specified index without a protected call
+ * and returns whether it has done so. This requires a table without a
+ * metatable and a cached key.
+ */
+static int rawgetfield (lua_State *L, int index, const char *k) {
+	index = lua_absindex(L, index);
+	if (!rawtable(L, index) || !pushcachedkey(L, k)) {
+		return 0;
+	}
+	lua_rawget(L, index);
+	return 1;
+}
+
+/*
+ * Sets a field of the table at the specified index to the value on top of the
+ * stack without a protected call and returns whether it has done so. This
+ * requires a table without a metatable, a cached key and an existing field, as
+ * a new key may rehash the table. Otherwise, the stack is left unchanged.
+ */
+static int rawsetfield (lua_State *L, int index, const char *k) {
+	index = lua_absindex(L, index);
+	if (!rawtable(L, index) || !pushcachedkey(L, k)) {
+		return 0;
+	}
+	if (!haskey(L, index, -1)) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	lua_insert(L, -2);
+	lua_rawset(L, index);
+	return 1;
+}
+
+/*
+ * Returns whether the table at the specified index has a value under the key
+ * at the specified stack index. Storing under an existing key neither
+ * allocates nor fails, so it can run without a protected call.
+ */
+static int haskey (lua_State *L, int index, int key) {
+	int exists;
+	
+	index = lua_absindex(L, index);
+	lua_pushvalue(L, key);
+	lua_rawget(L, index);
+	exists = !lua_isnil(L, -1);
+	lua_pop(L, 1);
+	return exists;
+}
+
+/* Like haskey(), for an integer key. */
+static int haskeyi (lua_State *L, int index, int n) {
+	int exists;
+	
+	lua_rawgeti(L, index, n);
+	exists = !lua_isnil(L, -1);
+	lua_pop(L, 1);
+	return exists;
+}
+
+/* Returns whether the value at the specified index is a table without a metatable. */
+static int rawtable (lua_State *L, int index) {
+	if (!lua_istable(L, index)) {
+		return 0;
+	}
+	if (lua_getmetatable(L, index)) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	return 1;
+}
+
+/* ---- Checks ---- */
+/* Returns whether an index is valid. */
+static int validindex (lua_State *L, int index) {
+	int top;
+	
+	top = lua_gettop(L);
+	if (index <= 0) {
+		if (index > LUA_REGISTRYINDEX) {
+			index = top + index + 1;
+		} else {
+			switch (index) {
+			case LUA_REGISTRYINDEX:
+				return 1;
+			default:
+				return 0; /* C upvalue access not needed, don't even validate */
+			}
+		}
+	}
+	return index >= 1 && index <= top;
+}
+
+/* Checks stack space. */
+static int checkstack (lua_State *L, int space) {
+	return check(lua_checkstack(L, space), illegalstateexception_class, "stack overflow");
+}
 
 /* Checks if an index is valid. */
 static int checkindex (lua_State *L, int index) {
@@ -2072,22 +4659,166 @@ static int check (int cond, jthrowable throwable_class, const char *msg) {
 }
 
 /* ---- Java objects and functions ---- */
-/* Pushes a Java object on the stack. */
+/*
+ * Pushes a Java object on the stack. While the userdata of a Java object is
+ * alive, pushing the object again pushes the same userdata.
+ */
 static void pushjavaobject (lua_State *L, jobject object) {
-	jobject *user_data;
+	jint hash;
+	
+	hash = (*thread_env)->CallStaticIntMethod(thread_env, system_class, identityhashcode_id, object);
+	if (!pushcachedjavaobject(L, object, hash)) {
+		newjavaobject(L, object, hash);
+	}
+}
+
+/*
+ * Pushes a new userdata for a Java object with the specified identity hash
+ * code on the stack, and caches it.
+ */
+static void newjavaobject (lua_State *L, jobject object, jint hash) {
+	void *user_data;
 	
-	user_data = (jobject *) lua_newuserdata(L, sizeof(jobject));
+	user_data = lua_newuserdata(L, sizeof(jobject));
 	luaL_getmetatable(L, JNLUA_OBJECT);
-	*user_data = (*thread_env)->NewGlobalRef(thread_env, object);
-	if (!*user_data) {
-		lua_pushliteral(L, "JNI error: NewGlobalRef() failed pushing Java object");
+	if (!refjavaobject(L, user_data, object)) {
+		lua_pushliteral(L, "JNI error: failed referencing Java object");
 		lua_error(L);
 	}
 	lua_setmetatable(L, -2);
+	cachejavaobject(L, hash);
+}
+
+/*
+ * Pushes the cached userdata of a Java object with the specified identity
+ * hash code on the stack and returns 1, or returns 0 if there is none. The
+ * cache is keyed by the hash code plus a multiple of 2^32 for colliding
+ * objects, probing as many keys as the longest collision chain seen. The
+ * method does not allocate.
+ */
+static int pushcachedjavaobject (lua_State *L, jobject object, jint hash) {
+	NativeState *ns;
+	jobject cached;
+	int probes, i, same;
+	
+	ns = getnativestate(L);
+	probes = ns ? ns->cacheprobes : 0;
+	lua_getfield(L, LUA_REGISTRYINDEX, JNLUA_OBJECTCACHE);
+	for (i = 0; i <= probes; i++) {
+		lua_pushnumber(L, (lua_Number) hash + (lua_Number) i * 4294967296.0);
+		lua_rawget(L, -2);
+		if (lua_isuserdata(L, -1)) {
+			cached = getjavaobject(L, -1);
+			same = (*thread_env)->IsSameObject(thread_env, cached, object);
+			releasejavaobject(L, cached);
+			if (same) {
+				lua_remove(L, -2);
+				return 1;
+			}
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return 0;
+}
+
+/* Caches the Java object userdata on top of the stack. */
+static void cachejavaobject (lua_State *L, jint hash) {
+	NativeState *ns;
+	lua_Number key;
+	int i;
+	
+	ns = getnativestate(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, JNLUA_OBJECTCACHE);
+	for (i = 0; ; i++) {
+		key = (lua_Number) hash + (lua_Number) i * 4294967296.0;
+		lua_pushnumber(L, key);
+		lua_rawget(L, -2);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushnumber(L, key);
+	lua_pushvalue(L, -3);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+	if (ns && i > ns->cacheprobes) {
+		ns->cacheprobes = i;
+	}
+}
+
+/*
+ * Stores a reference to a Java object in a Java object userdata, either as a
+ * slot in the handle table of the Lua state or as a global reference. Returns
+ * 0 on failure.
+ */
+static int refjavaobject (lua_State *L, void *user_data, jobject object) {
+	NativeState *ns;
+	jobject ref;
+	jint slot;
+	
+	ns = getnativestate(L);
+	if (ns && ns->handles) {
+		if ((slot = newhandle(ns->handles, object)) < 0) {
+			return 0;
+		}
+		*(jint *) user_data = slot;
+		return 1;
+	}
+	if (!(ref = (*thread_env)->NewGlobalRef(thread_env, object))) {
+		return 0;
+	}
+	*(jobject *) user_data = ref;
+	countglobalref(L, 1);
+	return 1;
+}
+
+/*
+ * Counts global references held by Java object userdata. The native state is
+ * gone if the Java state has detached from a Lua state it does not own.
+ */
+static void countglobalref (lua_State *L, int delta) {
+	NativeState *ns;
+	
+	ns = getnativestate(L);
+	if (ns) {
+		ns->globalrefs += delta;
+	}
 }
+
+/*
+ * Returns the Java object of a Java object userdata. With a handle table, the
+ * object is a new local reference to be released with releasejavaobject().
+ */
+static jobject getjavaobject (lua_State *L, int index) {
+	NativeState *ns;
+	
+	ns = getnativestate(L);
+	if (ns && ns->handles) {
+		return (*thread_env)->GetObjectArrayElement(thread_env, ns->handles->objects, *(jint *) lua_touserdata(L, index));
+	}
+	return *(jobject *) lua_touserdata(L, index);
+}
+
+/* Releases a Java object returned by getjavaobject() or tojavaobject(). */
+static void releasejavaobject (lua_State *L, jobject object) {
+	NativeState *ns;
 	
-/* Returns the Java object at the specified index, or NULL if such an object is unobtainable. */
+	ns = getnativestate(L);
+	if (object && ns && ns->handles) {
+		(*thread_env)->DeleteLocalRef(thread_env, object);
+	}
+}
+	
+/*
+ * Returns the Java object at the specified index, or NULL if such an object is
+ * unobtainable. With a native state, the metatable is identified by its
+ * pointer and the function does not raise errors.
+ */
 static jobject tojavaobject (lua_State *L, int index, jclass class) {
+	NativeState *ns;
 	int result;
 	jobject object;
 
@@ -2097,15 +4828,22 @@ static jobject tojavaobject (lua_State *L, int index, jclass class) {
 	if (!lua_getmetatable(L, index)) {
 		return NULL;
 	}
-	luaL_getmetatable(L, JNLUA_OBJECT);
-	result = lua_rawequal(L, -1, -2);
-	lua_pop(L, 2);
+	ns = getnativestate(L);
+	if (ns && ns->javaobject) {
+		result = lua_topointer(L, -1) == ns->javaobject;
+		lua_pop(L, 1);
+	} else {
+		luaL_getmetatable(L, JNLUA_OBJECT);
+		result = lua_rawequal(L, -1, -2);
+		lua_pop(L, 2);
+	}
 	if (!result) {
 		return NULL;
 	}
-	object = *(jobject *) lua_touserdata(L, index);
+	object = getjavaobject(L, index);
 	if (class) {
 		if (!(*thread_env)->IsInstanceOf(thread_env, object, class)) {
+			releasejavaobject(L, object);
 			return NULL;
 		}
 	}
@@ -2115,72 +4853,153 @@ static jobject tojavaobject (lua_State *L, int index, jclass class) {
 /* Returns a Java string for a value on the stack. */
 static jstring tostring (lua_State *L, int index) {
 	jstring string;
+	const char *s;
+	size_t length;
 
-	string = (*thread_env)->NewStringUTF(thread_env, luaL_tolstring(L, index, NULL));
+	s = luaL_tolstring(L, index, &length);
+	string = newstring(s, length);
 	lua_pop(L, 1);
 	return string;
 }
 
 /* Finalizes Java objects. */
 static int gcjavaobject (lua_State *L) {
-	jobject obj;
+	NativeState *ns;
 
 	if (!thread_env) {
 		/* Environment has been cleared as the Java VM was destroyed. Nothing to do. */
 		return 0;
 	}
-	obj = *(jobject *) lua_touserdata(L, 1);
 	if (lua_toboolean(L, lua_upvalueindex(1))) {
-		(*thread_env)->DeleteWeakGlobalRef(thread_env, obj);
+		(*thread_env)->DeleteWeakGlobalRef(thread_env, *(jobject *) lua_touserdata(L, 1));
+		return 0;
+	}
+	ns = getnativestate(L);
+	if (ns && ns->handles) {
+		releasehandle(ns->handles, *(jint *) lua_touserdata(L, 1));
 	} else {
-		(*thread_env)->DeleteGlobalRef(thread_env, obj);
+		(*thread_env)->DeleteGlobalRef(thread_env, *(jobject *) lua_touserdata(L, 1));
+		countglobalref(L, -1);
 	}
 	return 0;
 }
 
-/* Calls a Java function. If an exception is reported, store it as the cause for later use. */
+/*
+ * Calls a Java function. The Java state is taken from the native state. The
+ * second upvalue holds the address of the Java function userdata in the first
+ * upvalue, which has been validated when the Java function was pushed. A
+ * mismatch means that the upvalues have been changed from outside JNLua code.
+ */
 static int calljavafunction (lua_State *L) {
-	jobject javastate, javafunction;
-	lua_State *T;
-	int nresults;
-	jthrowable throwable;
-	jstring where;
-	jobject luaerror;
+	NativeState *ns;
+	void *user_data;
 	
 	/* Get Java state. */
-	lua_getfield(L, LUA_REGISTRYINDEX, JNLUA_JAVASTATE);
-	if (!lua_isuserdata(L, -1)) {
+	ns = getnativestate(L);
+	if (!ns || !ns->javastate) {
 		/* Java state has been cleared as the Java VM was destroyed. Cannot call. */
 		lua_pushliteral(L, "no Java state");
 		return lua_error(L);
 	}
-	javastate = *(jobject *) lua_touserdata(L, -1);
-	lua_pop(L, 1);
 	
 	/* Get Java function object. */
-	lua_pushvalue(L, lua_upvalueindex(1));
-	javafunction = tojavaobject(L, -1, javafunction_interface);
-	lua_pop(L, 1);
-	if (!javafunction) {
+	user_data = lua_touserdata(L, lua_upvalueindex(1));
+	if (!user_data || user_data != lua_touserdata(L, lua_upvalueindex(2))) {
 		/* Function was cleared from outside JNLua code. */
 		lua_pushliteral(L, "no Java function");
 		return lua_error(L);
 	}
+	if (ns->handles) {
+		return invokejavafunction(L, getjavaobject(L, lua_upvalueindex(1)), 1);
+	}
+	return invokejavafunction(L, *(jobject *) user_data, 0);
+}
+
+/*
+ * Continues a Java function that has yielded with a continuation. The
+ * continuation has been stored in the stack below the yielded values, and its
+ * index is the continuation context.
+ */
+static int continuejavafunction (lua_State *L) {
+	int ctx;
+	jobject object, continuation;
+	
+	lua_getctx(L, &ctx);
+	object = tojavaobject(L, ctx, javafunction_interface);
+	continuation = object ? (*thread_env)->NewLocalRef(thread_env, object) : NULL;
+	releasejavaobject(L, object);
+	lua_remove(L, ctx);
+	if (!continuation) {
+		lua_pushliteral(L, "no Java continuation");
+		return lua_error(L);
+	}
+	return invokejavafunction(L, continuation, 1);
+}
+
+/*
+ * Invokes a Java function or continuation. If the function is a local
+ * reference, it is deleted after the invocation. If an exception is reported,
+ * store it as the cause for later use. The running thread of the Java state is
+ * taken from the native state. If the function yields with a continuation,
+ * the continuation is invoked when the thread is resumed.
+ */
+static int invokejavafunction (lua_State *L, jobject javafunction, int local) {
+	NativeState *ns;
+	jobject javastate, continuation;
+	lua_State *T;
+	int nresults, yield;
+	jthrowable throwable;
+	jstring where;
+	jobject luaerror;
+	
+	/* Get Java state. */
+	ns = getnativestate(L);
+	if (!ns || !ns->javastate) {
+		lua_pushliteral(L, "no Java state");
+		return lua_error(L);
+	}
+	javastate = ns->javastate;
 	
 	/* Perform the call, handling coroutine situations. */
-	setyield(javastate, JNI_FALSE);
-	T = getluathread(javastate);
+	ns->yield = 0;
+	T = ns->luathread;
 	if (T == L) {
 		nresults = (*thread_env)->CallIntMethod(thread_env, javafunction, invoke_id, javastate);
 	} else {
 		setluathread(javastate, L);
+		ns->luathread = L;
 		nresults = (*thread_env)->CallIntMethod(thread_env, javafunction, invoke_id, javastate);
-		setluathread(javastate, T);
+		if (getnativestate(L) == ns && ns->javastate) {
+			setluathread(javastate, T);
+			ns->luathread = T;
+		}
+	}
+	if (local) {
+		(*thread_env)->DeleteLocalRef(thread_env, javafunction);
+	}
+	
+	/* The Java function may have closed the Java state. */
+	ns = getnativestate(L);
+	yield = ns && ns->javastate && ns->yield;
+	continuation = ns ? ns->continuation : NULL;
+	if (continuation) {
+		ns->continuation = NULL;
 	}
 	
 	/* Handle exception */
 	throwable = (*thread_env)->ExceptionOccurred(thread_env);
 	if (throwable) {
+		if (continuation) {
+			(*thread_env)->DeleteGlobalRef(thread_env, continuation);
+		}
+		
+		/* Park exception, if lightweight errors are enabled */
+		if (ns && ns->lightweighterrors && ns->javastate) {
+			(*thread_env)->ExceptionClear(thread_env);
+			parkjavaerror(L, ns, throwable);
+			return lua_error(L);
+		}
+		
 		/* Push exception & clear */
 		luaL_where(L, 1);
 		where = tostring(L, -1);
@@ -2195,9 +5014,14 @@ static int calljavafunction (lua_State *L) {
 		/* Error out */
 		return lua_error(L);
 	}
+	if (continuation) {
+		javafunction = continuation;
+		continuation = (*thread_env)->NewLocalRef(thread_env, javafunction);
+		(*thread_env)->DeleteGlobalRef(thread_env, javafunction);
+	}
 	
 	/* Handle yield */
-	if (getyield(javastate)) {
+	if (yield) {
 		if (nresults < 0 || nresults > lua_gettop(L)) {
 			lua_pushliteral(L, "illegal return count");
 			return lua_error(L);
@@ -2206,70 +5030,232 @@ static int calljavafunction (lua_State *L) {
 			lua_pushliteral(L, "not in a thread");
 			return lua_error(L);
 		}
+		if (continuation) {
+			if (!lua_checkstack(L, JNLUA_MINSTACK)) {
+				lua_pushliteral(L, "stack overflow");
+				return lua_error(L);
+			}
+			pushjavaobject(L, continuation);
+			lua_insert(L, -(nresults + 1));
+			return lua_yieldk(L, nresults, lua_gettop(L) - nresults, continuejavafunction);
+		}
 		return lua_yield(L, nresults);
 	}
 	
 	return nresults;
 }
 
-/* Handles Lua errors. */
-static int messagehandler (lua_State *L) {
-	int level, count;
+/*
+ * Parks a Java exception thrown by a Java function in the Java state and
+ * pushes a new error value representing it. The error value records the
+ * location and the sequence number of the parked exception. The Lua error for
+ * the Java exception is created only if the error value reaches Java or is
+ * converted to a string. A Java exception still parked for an earlier error
+ * value is first detached into that error value. The local reference to the
+ * exception is deleted.
+ */
+static void parkjavaerror (lua_State *L, NativeState *ns, jthrowable throwable) {
+	JavaError *error;
 	lua_Debug ar;
-	jobjectArray luastacktrace;
-	jstring name, source;
-	jobject luastacktraceelement;
-	jobject luaerror;
-	jstring message;
+	
+	error = (JavaError *) lua_newuserdata(L, sizeof(JavaError));
+	error->sequence = 0;
+	error->throwable = NULL;
+	error->where[0] = '\0';
+	if (lua_getstack(L, 1, &ar)) {
+		lua_getinfo(L, "Sl", &ar);
+		if (ar.currentline > 0) {
+			sprintf(error->where, "%s:%d: ", ar.short_src, ar.currentline);
+		}
+	}
+	lua_getfield(L, LUA_REGISTRYINDEX, JNLUA_JAVAERROR);
+	lua_setmetatable(L, -2);
+	if (ns->errorsequence) {
+		detachjavaerror(L, ns);
+	}
+	if (++ns->errorcount == 0) {
+		ns->errorcount = 1;
+	}
+	error->sequence = ns->errorcount;
+	(*thread_env)->SetObjectField(thread_env, ns->javastate, pendingthrowable_id, throwable);
+	(*thread_env)->DeleteLocalRef(thread_env, throwable);
+	ns->pendingerror = error;
+	ns->errorsequence = error->sequence;
+}
 
-	/* Count relevant stack frames */
-	level = 1;
-	count = 0;
-	while (lua_getstack(L, level, &ar)) {
-		lua_getinfo(L, "nSl", &ar);
-		if (isrelevant(&ar)) {
-			count++;
+/*
+ * Moves the parked Java exception into a global reference held by its error
+ * value and clears the parking slot.
+ */
+static void detachjavaerror (lua_State *L, NativeState *ns) {
+	jobject throwable;
+	
+	throwable = (*thread_env)->GetObjectField(thread_env, ns->javastate, pendingthrowable_id);
+	if (throwable) {
+		if ((ns->pendingerror->throwable = (*thread_env)->NewGlobalRef(thread_env, throwable))) {
+			countglobalref(L, 1);
 		}
-		level++;
+		(*thread_env)->DeleteLocalRef(thread_env, throwable);
+	}
+	clearjavaerror(ns);
+}
+
+/* Clears the parking slot, releasing the parked Java exception. */
+static void clearjavaerror (NativeState *ns) {
+	if (ns->javastate) {
+		(*thread_env)->SetObjectField(thread_env, ns->javastate, pendingthrowable_id, NULL);
+	}
+	ns->pendingerror = NULL;
+	ns->errorsequence = 0;
+}
+
+/* Returns whether the value at the specified index represents a parked Java exception. */
+static int isjavaerror (lua_State *L, int index) {
+	NativeState *ns;
+	int result;
+	
+	ns = getnativestate(L);
+	if (!ns || !ns->javaerror || lua_type(L, index) != LUA_TUSERDATA || !lua_getmetatable(L, index)) {
+		return 0;
+	}
+	result = lua_topointer(L, -1) == ns->javaerror;
+	lua_pop(L, 1);
+	return result;
+}
+
+/*
+ * Returns a new Lua error for the Java exception represented by the error
+ * value at the specified index, or NULL on failure. If the sequence number of
+ * the error value matches the parking slot, the exception is detached into
+ * the error value, as the error value may outlive the Lua error. Otherwise,
+ * the exception has been detached already.
+ */
+static jobject newjavaerror (lua_State *L, int index) {
+	NativeState *ns;
+	JavaError *error;
+	jstring where;
+	
+	ns = getnativestate(L);
+	error = (JavaError *) lua_touserdata(L, index);
+	if (ns && ns->javastate && ns->errorsequence && error->sequence == ns->errorsequence) {
+		detachjavaerror(L, ns);
+	}
+	if (!error->throwable) {
+		return NULL;
 	}
+	where = newstring(error->where, strlen(error->where));
+	if (!where) {
+		return NULL;
+	}
+	return (*thread_env)->NewObject(thread_env, luaerror_class, luaerror_id, where, error->throwable);
+}
+
+/* Converts the error value representing a parked Java exception to a string. */
+static int tostringjavaerror (lua_State *L) {
+	jobject luaerror;
+	
+	luaerror = newjavaerror(L, 1);
+	if (!luaerror) {
+		lua_pushliteral(L, "no Java exception");
+		return 1;
+	}
+	pushjavaobject(L, luaerror);
+	luaL_tolstring(L, -1, NULL);
+	return 1;
+}
+
+/*
+ * Finalizes the error value representing a parked Java exception. A discarded
+ * error value releases its exception, and clears the parking slot if the
+ * exception is still parked.
+ */
+static int gcjavaerror (lua_State *L) {
+	NativeState *ns;
+	JavaError *error;
 	
-	/* Create Lua stack trace as a Java LuaStackTraceElement[] */
-	luastacktrace = (*thread_env)->NewObjectArray(thread_env, count, luastacktraceelement_class, NULL);
-	if (!luastacktrace) {
+	if (!thread_env) {
+		/* Environment has been cleared as the Java VM was destroyed. Nothing to do. */
+		return 0;
+	}
+	error = (JavaError *) lua_touserdata(L, 1);
+	ns = getnativestate(L);
+	if (ns && ns->errorsequence && error->sequence == ns->errorsequence) {
+		clearjavaerror(ns);
+	}
+	if (error->throwable) {
+		(*thread_env)->DeleteGlobalRef(thread_env, error->throwable);
+		error->throwable = NULL;
+		countglobalref(L, -1);
+	}
+	return 0;
+}
+
+/*
+ * Handles Lua errors. The error value is left unchanged, and the Lua error is
+ * created only when the error reaches Java. Unless disabled, the Lua stack
+ * trace is captured into a native record of the native state, which is
+ * converted into a Java string when the Lua error is created, and into Java
+ * stack trace elements only when requested. The record holds a flag
+ * character, the function name, the source name and the line number of each
+ * relevant frame, separated by NUL characters. Bit 0 of the flag is set if
+ * there is a name, and bit 1 is set if there is a source.
+ */
+static int messagehandler (lua_State *L) {
+	NativeState *ns;
+	int level;
+	lua_Debug ar;
+	char flag;
+	char line[16];
+
+	ns = getnativestate(L);
+	if (!ns) {
+		return 1;
+	}
+	ns->tracestatus = JNLUA_TRACEDISABLED;
+	if (!ns->stacktrace) {
 		return 1;
 	}
+	ns->tracelength = 0;
 	level = 1;
-	count = 0;
 	while (lua_getstack(L, level, &ar)) {
 		lua_getinfo(L, "nSl", &ar);
 		if (isrelevant(&ar)) {
-			name = ar.name ? (*thread_env)->NewStringUTF(thread_env, ar.name) : NULL;
-			source = ar.source ? (*thread_env)->NewStringUTF(thread_env, ar.source) : NULL;
-			luastacktraceelement = (*thread_env)->NewObject(thread_env, luastacktraceelement_class,	luastacktraceelement_id, name, source, ar.currentline);
-			if (!luastacktraceelement) {
-				return 1;
-			}
-			(*thread_env)->SetObjectArrayElement(thread_env, luastacktrace, count, luastacktraceelement);
-			if ((*thread_env)->ExceptionCheck(thread_env)) {
+			flag = (char) ('0' + (ar.name ? 1 : 0) + (ar.source ? 2 : 0));
+			sprintf(line, "%d", ar.currentline);
+			if (!addtrace(ns, &flag, 1)
+					|| !addtrace(ns, ar.name ? ar.name : "", ar.name ? strlen(ar.name) + 1 : 1)
+					|| !addtrace(ns, ar.source ? ar.source : "", ar.source ? strlen(ar.source) + 1 : 1)
+					|| !addtrace(ns, line, strlen(line) + 1)) {
 				return 1;
 			}
-			count++;
 		}
 		level++;
 	}
+	ns->tracestatus = JNLUA_TRACERECORDED;
+	return 1;
+}
+
+/*
+ * Appends to the Lua stack trace record of a native state. The record buffer
+ * is retained for subsequent errors. Returns 0 on failure.
+ */
+static int addtrace (NativeState *ns, const char *s, size_t length) {
+	size_t capacity;
+	char *trace;
 	
-	/* Get or create the error object  */
-	luaerror = tojavaobject(L, -1, luaerror_class);
-	if (!luaerror) {
-		message = tostring(L, -1);
-		if (!(luaerror = (*thread_env)->NewObject(thread_env, luaerror_class, luaerror_id, message, NULL))) {
-			return 1;
+	if (ns->tracelength + length > ns->tracecapacity) {
+		capacity = ns->tracecapacity ? ns->tracecapacity : 256;
+		while (capacity < ns->tracelength + length) {
+			capacity *= 2;
 		}
+		if (!(trace = realloc(ns->trace, capacity))) {
+			return 0;
+		}
+		ns->trace = trace;
+		ns->tracecapacity = capacity;
 	}
-	(*thread_env)->CallVoidMethod(thread_env, luaerror, setluastacktrace_id, luastacktrace);
-	
-	/* Replace error */
-	pushjavaobject(L, luaerror);
+	memcpy(ns->trace + ns->tracelength, s, length);
+	ns->tracelength += length;
 	return 1;
 }
 
@@ -2292,16 +5278,38 @@ static int isrelevant (lua_Debug *ar) {
 /* Handles Lua errors by throwing a Java exception. */
 JNLUA_THREADLOCAL int throw_status;
 static int throw_protected (lua_State *L) {
+	NativeState *ns;
 	jclass class;
 	jmethodID id;
+	int tracestatus;
+	jstring luastacktrace;
+	jstring message;
 	jthrowable throwable;
 	jobject luaerror;
 	
+	/* Take the Lua stack trace captured by the message handler, if any. */
+	ns = getnativestate(L);
+	tracestatus = JNLUA_TRACENONE;
+	luastacktrace = NULL;
+	if (ns && ns->tracestatus != JNLUA_TRACENONE) {
+		tracestatus = ns->tracestatus;
+		ns->tracestatus = JNLUA_TRACENONE;
+		if (tracestatus == JNLUA_TRACERECORDED
+				&& !(luastacktrace = newstring(ns->trace, ns->tracelength))) {
+			return 0;
+		}
+	}
+	
 	/* Determine the type of exception to throw. */
 	switch (throw_status) {
 	case LUA_ERRRUN:
-		class = luaruntimeexception_class;
-		id = luaruntimeexception_id;
+		if (ns && ns->stopped) {
+			class = luainterruptedexception_class;
+			id = luainterruptedexception_id;
+		} else {
+			class = luaruntimeexception_class;
+			id = luaruntimeexception_id;
+		}
 		break;
 	case LUA_ERRSYNTAX:
 		class = luasyntaxexception_class;
@@ -2324,16 +5332,31 @@ static int throw_protected (lua_State *L) {
 		return lua_error(L);
 	}
 	
+	/* Replace an error value representing a parked Java exception. */
+	if (isjavaerror(L, 1) && (luaerror = newjavaerror(L, 1))) {
+		pushjavaobject(L, luaerror);
+		lua_replace(L, 1);
+	}
+	
 	/* Create exception */
-	throwable = (*thread_env)->NewObject(thread_env, class, id, tostring(L, 1));
+	message = tostring(L, 1);
+	throwable = (*thread_env)->NewObject(thread_env, class, id, message);
 	if (!throwable) {
 		lua_pushliteral(L, "JNI error: NewObject() failed creating throwable");
 		return lua_error(L);
 	}
 		
-	/* Set the Lua error, if any. */
+	/* Set the Lua error, if any, with the Lua stack trace. */
 	luaerror = tojavaobject(L, 1, luaerror_class);
-	if (luaerror && class == luaruntimeexception_class) {
+	if (!luaerror && tracestatus != JNLUA_TRACENONE
+			&& !(luaerror = (*thread_env)->NewObject(thread_env, luaerror_class, luaerror_id, message, NULL))) {
+		lua_pushliteral(L, "JNI error: NewObject() failed creating Lua error");
+		return lua_error(L);
+	}
+	if (luaerror && tracestatus != JNLUA_TRACENONE) {
+		(*thread_env)->CallVoidMethod(thread_env, luaerror, setluastacktrace_id, luastacktrace);
+	}
+	if (luaerror && (class == luaruntimeexception_class || class == luainterruptedexception_class)) {
 		(*thread_env)->CallVoidMethod(thread_env, throwable, setluaerror_id, luaerror);
 	}
 	
@@ -2346,6 +5369,7 @@ static int throw_protected (lua_State *L) {
 	return 0;
 }
 static void throw (lua_State *L, int status) {
+	NativeState *ns;
 	const char *message;
 	
 	if (checkstack(L, JNLUA_MINSTACK)) {
@@ -2357,6 +5381,10 @@ static void throw (lua_State *L, int status) {
 			(*thread_env)->ThrowNew(thread_env, error_class, message ? message : "error throwing Lua exception");
 		}
 	}
+	ns = getnativestate(L);
+	if (ns) {
+		ns->tracestatus = JNLUA_TRACENONE;
+	}
 }
 
 /* ---- Stream adapters ---- */
@@ -2388,9 +5416,23 @@ static const char *readhandler (lua_State *L, void *ud, size_t *size) {
 	return (const char *) stream->bytes;
 }
 
+/* Lua reader for memory chunks. The chunk is returned in a single piece. */
+static const char *chunkhandler (lua_State *L, void *ud, size_t *size) {
+	Chunk *chunk;
+	const char *bytes;
+
+	chunk = (Chunk *) ud;
+	bytes = chunk->bytes;
+	*size = chunk->size;
+	chunk->bytes = NULL;
+	chunk->size = 0;
+	return bytes;
+}
+
 /* Lua writer for Java output streams. */
 static int writehandler (lua_State *L, const void *data, size_t size, void *ud) {
 	Stream *stream;
+	size_t capacity, length;
 
 	stream = (Stream *) ud;
 	if (!stream->bytes) {
@@ -2400,13 +5442,437 @@ static int writehandler (lua_State *L, const void *data, size_t size, void *ud)
 			return 1;
 		}
 	}
-	memcpy(stream->bytes, data, size);
-	if (stream->is_copy) {
-		(*thread_env)->ReleaseByteArrayElements(thread_env, stream->byte_array, stream->bytes, JNI_COMMIT);
+	capacity = (size_t) (*thread_env)->GetArrayLength(thread_env, stream->byte_array);
+	while (size > 0) {
+		length = size < capacity ? size : capacity;
+		memcpy(stream->bytes, data, length);
+		if (stream->is_copy) {
+			(*thread_env)->ReleaseByteArrayElements(thread_env, stream->byte_array, stream->bytes, JNI_COMMIT);
+		}
+		(*thread_env)->CallVoidMethod(thread_env, stream->stream, write_id, stream->byte_array, 0, (jint) length);
+		if ((*thread_env)->ExceptionCheck(thread_env)) {
+			return 1;
+		}
+		data = (const char *) data + length;
+		size -= length;
 	}
-	(*thread_env)->CallVoidMethod(thread_env, stream->stream, write_id, stream->byte_array, 0, size);
-	if ((*thread_env)->ExceptionCheck(thread_env)) {
-		return 1;
+	return 0;
+}
+
+/* Lua writer for memory. The memory is grown as needed. */
+static int dumphandler (lua_State *L, const void *data, size_t size, void *ud) {
+	Dump *dump;
+	char *bytes;
+	size_t capacity;
+
+	dump = (Dump *) ud;
+	if (size > dump->capacity - dump->size) {
+		capacity = dump->capacity > 0 ? dump->capacity : 1024;
+		while (size > capacity - dump->size) {
+			capacity *= 2;
+		}
+		if (!(bytes = realloc(dump->bytes, capacity))) {
+			return 1;
+		}
+		dump->bytes = bytes;
+		dump->capacity = capacity;
 	}
+	memcpy(dump->bytes + dump->size, data, size);
+	dump->size += size;
 	return 0;
 }
+
+/* ---- Chunk stripping ---- */
+/*
+ * Strips the debug information from a dumped chunk, as luac -s does. The
+ * debug information is replaced with empty entries. Returns 1 on success.
+ */
+static int stripchunk (Dump *dump) {
+	Strip strip;
+	char *bytes;
+
+	if (dump->size < JNLUA_HEADERSIZE || !(bytes = malloc(dump->size))) {
+		return 0;
+	}
+	memcpy(bytes, dump->bytes, JNLUA_HEADERSIZE);
+	strip.src = dump->bytes + JNLUA_HEADERSIZE;
+	strip.end = dump->bytes + dump->size;
+	strip.dst = bytes + JNLUA_HEADERSIZE;
+	strip.instructionsize = (unsigned char) dump->bytes[9];
+	if (!stripfunction(&strip) || strip.src != strip.end) {
+		free(bytes);
+		return 0;
+	}
+	free(dump->bytes);
+	dump->bytes = bytes;
+	dump->size = (size_t) (strip.dst - bytes);
+	dump->capacity = dump->size;
+	return 1;
+}
+
+/* Strips the debug information from a dumped function and its children. */
+static int stripfunction (Strip *strip) {
+	int n, i;
+	size_t size;
+	
+	/* Line defined, last line defined, parameters, vararg, stack size */
+	if (!stripcopy(strip, 2 * sizeof(int) + 3)) {
+		return 0;
+	}
+	
+	/* Code */
+	if (!stripint(strip, &n) || !stripcopy(strip, sizeof(int) + (size_t) n * strip->instructionsize)) {
+		return 0;
+	}
+	
+	/* Constants */
+	if (!stripint(strip, &n) || !stripcopy(strip, sizeof(int))) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (strip->src >= strip->end) {
+			return 0;
+		}
+		switch (*strip->src) {
+		case LUA_TNIL:
+			if (!stripcopy(strip, 1)) {
+				return 0;
+			}
+			break;
+		case LUA_TBOOLEAN:
+			if (!stripcopy(strip, 2)) {
+				return 0;
+			}
+			break;
+		case LUA_TNUMBER:
+			if (!stripcopy(strip, 1 + sizeof(lua_Number))) {
+				return 0;
+			}
+			break;
+		case LUA_TSTRING:
+			if (!stripcopy(strip, 1) || !stripsize(strip, &size) || !stripcopy(strip, sizeof(size_t) + size)) {
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+		}
+	}
+	
+	/* Functions */
+	if (!stripint(strip, &n) || !stripcopy(strip, sizeof(int))) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (!stripfunction(strip)) {
+			return 0;
+		}
+	}
+	
+	/* Upvalues */
+	if (!stripint(strip, &n) || !stripcopy(strip, sizeof(int) + (size_t) n * 2)) {
+		return 0;
+	}
+	
+	/* Debug information: source, line info, local variables, upvalue names */
+	if (!stripsize(strip, &size) || !stripskip(strip, sizeof(size_t) + size)) {
+		return 0;
+	}
+	if (!stripint(strip, &n) || !stripskip(strip, sizeof(int) + (size_t) n * sizeof(int))) {
+		return 0;
+	}
+	if (!stripint(strip, &n) || !stripskip(strip, sizeof(int))) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (!stripsize(strip, &size) || !stripskip(strip, sizeof(size_t) + size + 2 * sizeof(int))) {
+			return 0;
+		}
+	}
+	if (!stripint(strip, &n) || !stripskip(strip, sizeof(int))) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (!stripsize(strip, &size) || !stripskip(strip, sizeof(size_t) + size)) {
+			return 0;
+		}
+	}
+	
+	/* Write empty debug information. */
+	memset(strip->dst, 0, sizeof(size_t) + 3 * sizeof(int));
+	strip->dst += sizeof(size_t) + 3 * sizeof(int);
+	return 1;
+}
+
+/* Copies bytes of a dumped chunk. */
+static int stripcopy (Strip *strip, size_t size) {
+	if (size > (size_t) (strip->end - strip->src)) {
+		return 0;
+	}
+	memcpy(strip->dst, strip->src, size);
+	strip->src += size;
+	strip->dst += size;
+	return 1;
+}
+
+/* Skips bytes of a dumped chunk. */
+static int stripskip (Strip *strip, size_t size) {
+	if (size > (size_t) (strip->end - strip->src)) {
+		return 0;
+	}
+	strip->src += size;
+	return 1;
+}
+
+/* Peeks at an int of a dumped chunk. */
+static int stripint (Strip *strip, int *value) {
+	if (sizeof(int) > (size_t) (strip->end - strip->src)) {
+		return 0;
+	}
+	memcpy(value, strip->src, sizeof(int));
+	return *value >= 0;
+}
+
+/* Peeks at a size of a dumped chunk. */
+static int stripsize (Strip *strip, size_t *value) {
+	if (sizeof(size_t) > (size_t) (strip->end - strip->src)) {
+		return 0;
+	}
+	memcpy(value, strip->src, sizeof(size_t));
+	return *value <= (size_t) (strip->end - strip->src);
+}
+
+/* ---- String transcoding ---- */
+/* Returns the size of the UTF-8 encoding of UTF-16 chars. */
+static size_t utf8size (const jchar *chars, size_t length) {
+	size_t i = 0, size = 0;
+	jchar c;
+#ifdef JNLUA_SSE2
+	__m128i mask, zero, v;
+	
+	mask = _mm_set1_epi16((short) 0xff80);
+	zero = _mm_setzero_si128();
+#endif
+	while (i < length) {
+#ifdef JNLUA_SSE2
+		while (i + 8 <= length) {
+			v = _mm_loadu_si128((const __m128i *) (chars + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask), zero)) != 0xffff) {
+				break;
+			}
+			i += 8;
+			size += 8;
+		}
+		if (i == length) {
+			break;
+		}
+#endif
+		c = chars[i++];
+		if (c < 0x80) {
+			size += 1;
+		} else if (c < 0x800) {
+			size += 2;
+		} else if (c >= 0xd800 && c < 0xdc00 && i < length && chars[i] >= 0xdc00 && chars[i] < 0xe000) {
+			i++;
+			size += 4;
+		} else {
+			size += 3;
+		}
+	}
+	return size;
+}
+
+/*
+ * Encodes UTF-16 chars as UTF-8 and returns the size of the encoding. Unpaired
+ * surrogates are encoded as U+FFFD. The UTF-8 buffer must hold the encoding.
+ */
+static size_t encodeutf8 (const jchar *chars, size_t length, char *utf8) {
+	size_t i = 0;
+	unsigned char *p = (unsigned char *) utf8;
+	unsigned long c;
+#ifdef JNLUA_AVX2
+	__m256i mask256, a256, b256;
+#endif
+#ifdef JNLUA_SSE2
+	__m128i mask, zero, a, b;
+	
+	mask = _mm_set1_epi16((short) 0xff80);
+	zero = _mm_setzero_si128();
+#endif
+#ifdef JNLUA_AVX2
+	mask256 = _mm256_set1_epi16((short) 0xff80);
+#endif
+	while (i < length) {
+		/* Encode runs of ASCII chars in bulk. */
+#ifdef JNLUA_AVX2
+		while (i + 32 <= length && chars[i] < 0x80) {
+			a256 = _mm256_loadu_si256((const __m256i *) (chars + i));
+			b256 = _mm256_loadu_si256((const __m256i *) (chars + i + 16));
+			if (!_mm256_testz_si256(_mm256_or_si256(a256, b256), mask256)) {
+				break;
+			}
+			_mm256_storeu_si256((__m256i *) p, _mm256_permute4x64_epi64(_mm256_packus_epi16(a256, b256), 0xd8));
+			i += 32;
+			p += 32;
+		}
+#endif
+#ifdef JNLUA_SSE2
+		while (i + 16 <= length && chars[i] < 0x80) {
+			a = _mm_loadu_si128((const __m128i *) (chars + i));
+			b = _mm_loadu_si128((const __m128i *) (chars + i + 8));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), mask), zero)) != 0xffff) {
+				break;
+			}
+			_mm_storeu_si128((__m128i *) p, _mm_packus_epi16(a, b));
+			i += 16;
+			p += 16;
+		}
+		if (i == length) {
+			break;
+		}
+#endif
+		
+		/* Encode a single char. */
+		c = chars[i++];
+		if (c < 0x80) {
+			*p++ = (unsigned char) c;
+		} else if (c < 0x800) {
+			*p++ = (unsigned char) (0xc0 | (c >> 6));
+			*p++ = (unsigned char) (0x80 | (c & 0x3f));
+		} else {
+			if (c >= 0xd800 && c < 0xe000) {
+				if (c < 0xdc00 && i < length && chars[i] >= 0xdc00 && chars[i] < 0xe000) {
+					c = 0x10000 + ((c - 0xd800) << 10) + (chars[i++] - 0xdc00);
+					*p++ = (unsigned char) (0xf0 | (c >> 18));
+					*p++ = (unsigned char) (0x80 | ((c >> 12) & 0x3f));
+					*p++ = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+					*p++ = (unsigned char) (0x80 | (c & 0x3f));
+					continue;
+				}
+				c = 0xfffd;
+			}
+			*p++ = (unsigned char) (0xe0 | (c >> 12));
+			*p++ = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+			*p++ = (unsigned char) (0x80 | (c & 0x3f));
+		}
+	}
+	return (size_t) (p - (unsigned char *) utf8);
+}
+
+/*
+ * Decodes UTF-8 as UTF-16 chars and returns the number of chars. Malformed
+ * sequences are decoded as U+FFFD. The char buffer must hold one char per
+ * UTF-8 byte.
+ */
+static size_t decodeutf8 (const char *utf8, size_t size, jchar *chars) {
+	const unsigned char *p = (const unsigned char *) utf8, *end = p + size;
+	jchar *q = chars;
+	unsigned long c;
+#ifdef JNLUA_AVX2
+	__m256i v256;
+#endif
+#ifdef JNLUA_SSE2
+	__m128i v, zero;
+	
+	zero = _mm_setzero_si128();
+#endif
+	while (p < end) {
+		/* Decode runs of ASCII bytes in bulk. */
+#ifdef JNLUA_AVX2
+		while (end - p >= 32 && *p < 0x80) {
+			v256 = _mm256_loadu_si256((const __m256i *) p);
+			if (_mm256_movemask_epi8(v256)) {
+				break;
+			}
+			_mm256_storeu_si256((__m256i *) q, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v256)));
+			_mm256_storeu_si256((__m256i *) (q + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v256, 1)));
+			p += 32;
+			q += 32;
+		}
+#endif
+#ifdef JNLUA_SSE2
+		while (end - p >= 16 && *p < 0x80) {
+			v = _mm_loadu_si128((const __m128i *) p);
+			if (_mm_movemask_epi8(v)) {
+				break;
+			}
+			_mm_storeu_si128((__m128i *) q, _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128((__m128i *) (q + 8), _mm_unpackhi_epi8(v, zero));
+			p += 16;
+			q += 16;
+		}
+		if (p == end) {
+			break;
+		}
+#endif
+		
+		/* Decode a single sequence. */
+		c = *p;
+		if (c < 0x80) {
+			*q++ = (jchar) c;
+			p++;
+		} else if (c >= 0xc2 && c <= 0xdf && end - p >= 2 && (p[1] & 0xc0) == 0x80) {
+			*q++ = (jchar) (((c & 0x1f) << 6) | (p[1] & 0x3f));
+			p += 2;
+		} else if (c >= 0xe0 && c <= 0xef && end - p >= 3 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+			c = ((c & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+			*q++ = (jchar) (c < 0x800 || (c >= 0xd800 && c < 0xe000) ? 0xfffd : c);
+			p += 3;
+		} else if (c >= 0xf0 && c <= 0xf4 && end - p >= 4 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80 && (p[3] & 0xc0) == 0x80) {
+			c = ((c & 0x07) << 18) | ((p[1] & 0x3fUL) << 12) | ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+			if (c < 0x10000 || c > 0x10ffff) {
+				*q++ = 0xfffd;
+			} else {
+				c -= 0x10000;
+				*q++ = (jchar) (0xd800 + (c >> 10));
+				*q++ = (jchar) (0xdc00 + (c & 0x3ff));
+			}
+			p += 4;
+		} else {
+			*q++ = 0xfffd;
+			p++;
+		}
+	}
+	return (size_t) (q - chars);
+}
+
+/* ---- Batch operands ---- */
+/* Reads an integer operand. */
+static jint batchint (Batch *batch) {
+	jint value;
+	
+	memcpy(&value, batch->pc, sizeof(jint));
+	batch->pc += sizeof(jint);
+	return value;
+}
+
+/* Reads a number operand. */
+static jdouble batchdouble (Batch *batch) {
+	jdouble value;
+	
+	memcpy(&value, batch->pc, sizeof(jdouble));
+	batch->pc += sizeof(jdouble);
+	return value;
+}
+
+/* Reads a string operand, returning a zero-terminated string from the string pool. */
+static const char *batchstring (Batch *batch, size_t *length) {
+	const char *entry;
+	jint entry_length;
+	
+	entry = batch->pool + batchint(batch);
+	if (length) {
+		memcpy(&entry_length, entry, sizeof(jint));
+		*length = (size_t) entry_length;
+	}
+	return entry + sizeof(jint);
+}
+
+/* Stores a result and returns its index. */
+static int batchresult (Batch *batch, jdouble value) {
+	if (!checkstate(batch->nresults < batch->maxresults, "batch result overflow")) {
+		return -1;
+	}
+	memcpy(&batch->results[batch->nresults], &value, sizeof(jdouble));
+	return batch->nresults++;
+}
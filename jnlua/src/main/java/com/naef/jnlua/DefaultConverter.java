@@ -32,6 +32,11 @@ public class DefaultConverter implements Converter {
 	 */
 	private static final DefaultConverter INSTANCE = new DefaultConverter();
 
+	/**
+	 * Lua types indexed by type code.
+	 */
+	private static final LuaType[] LUA_TYPES = LuaType.values();
+
 	/**
 	 * Boolean distance map.
 	 */
@@ -286,14 +291,26 @@ public class DefaultConverter implements Converter {
 	private DefaultConverter() {
 	}
 
-	// -- Java converter methods
-	@Override
-	public int getTypeDistance(LuaState luaState, int index, Class<?> formalType) {
-		// Handle none
-		LuaType luaType = luaState.type(index);
-		if (luaType == null) {
-			return Integer.MAX_VALUE;
-		}
+	// -- Operations
+	/**
+	 * Returns the type distance of a Lua value described by
+	 * {@link LuaState#describeStack(int, int, int[], Object[])}. The result is
+	 * the same as that of {@link #getTypeDistance(LuaState, int, Class)} for
+	 * the described value.
+	 * 
+	 * @param type
+	 *            the type code of the value
+	 * @param javaObject
+	 *            the Java object of the value, or <code>null</code>
+	 * @param formalType
+	 *            the formal type
+	 * @return the type distance
+	 * @since JNLua 1.0.5
+	 */
+	public int getTypeDistance(int type, Object javaObject,
+			Class<?> formalType) {
+		LuaType luaType = LUA_TYPES[type & ~LuaState.DESCRIBE_JAVA];
+		boolean java = (type & LuaState.DESCRIBE_JAVA) != 0;
 
 		// Handle void
 		if (formalType == Void.TYPE) {
@@ -337,7 +354,7 @@ public class DefaultConverter implements Converter {
 			}
 			break;
 		case FUNCTION:
-			if (luaState.isJavaFunction(index)) {
+			if (java) {
 				distance = FUNCTION_DISTANCE_MAP.get(formalType);
 				if (distance != null) {
 					return distance.intValue();
@@ -345,22 +362,21 @@ public class DefaultConverter implements Converter {
 			}
 			break;
 		case USERDATA:
-			Object object = luaState.toJavaObjectRaw(index);
-			if (object != null) {
-				Class<?> type;
-				if (object instanceof TypedJavaObject) {
-					TypedJavaObject typedJavaObject = (TypedJavaObject) object;
+			if (java) {
+				Class<?> javaType;
+				if (javaObject instanceof TypedJavaObject) {
+					TypedJavaObject typedJavaObject = (TypedJavaObject) javaObject;
 					if (typedJavaObject.isStrong()) {
 						if (formalType.isAssignableFrom(typedJavaObject
 								.getClass())) {
 							return 1;
 						}
 					}
-					type = typedJavaObject.getType();
+					javaType = typedJavaObject.getType();
 				} else {
-					type = object.getClass();
+					javaType = javaObject.getClass();
 				}
-				if (formalType.isAssignableFrom(type)) {
+				if (formalType.isAssignableFrom(javaType)) {
 					return 1;
 				}
 			}
@@ -376,6 +392,36 @@ public class DefaultConverter implements Converter {
 		return Integer.MAX_VALUE;
 	}
 
+	// -- Java converter methods
+	@Override
+	public int getTypeDistance(LuaState luaState, int index, Class<?> formalType) {
+		// Handle none
+		LuaType luaType = luaState.type(index);
+		if (luaType == null) {
+			return Integer.MAX_VALUE;
+		}
+
+		// Describe
+		int type = luaType.ordinal();
+		Object javaObject = null;
+		switch (luaType) {
+		case FUNCTION:
+			if (luaState.isJavaFunction(index)) {
+				type |= LuaState.DESCRIBE_JAVA;
+			}
+			break;
+		case USERDATA:
+			javaObject = luaState.toJavaObjectRaw(index);
+			if (javaObject != null) {
+				type |= LuaState.DESCRIBE_JAVA;
+			}
+			break;
+		default:
+			break;
+		}
+		return getTypeDistance(type, javaObject, formalType);
+	}
+
 	@SuppressWarnings("unchecked")
 	@Override
 	public <T> T convertLuaValue(LuaState luaState, int index,
@@ -465,10 +511,13 @@ public class DefaultConverter implements Converter {
 				};
 			}
 			if (formalType.isArray()) {
-				int length = luaState.rawLen(index);
 				Class<?> componentType = formalType.getComponentType();
-				Object array = Array.newInstance(formalType.getComponentType(),
-						length);
+				Object array = convertArray(luaState, index, componentType);
+				if (array != null) {
+					return (T) array;
+				}
+				int length = luaState.rawLen(index);
+				array = Array.newInstance(componentType, length);
 				for (int i = 0; i < length; i++) {
 					luaState.rawGet(index, i + 1);
 					try {
@@ -552,6 +601,32 @@ public class DefaultConverter implements Converter {
 		luaState.pushJavaObjectRaw(object);
 	}
 
+	// -- Private methods
+	/**
+	 * Converts a table to an array of a supported component type in a single
+	 * native call. Returns <code>null</code> if the component type is not
+	 * supported or the table elements do not match the component type.
+	 */
+	private Object convertArray(LuaState luaState, int index,
+			Class<?> componentType) {
+		if (componentType == Double.TYPE) {
+			return luaState.toDoubleArray(index);
+		}
+		if (componentType == Integer.TYPE) {
+			return luaState.toIntArray(index);
+		}
+		if (componentType == Long.TYPE) {
+			return luaState.toLongArray(index);
+		}
+		if (componentType == Boolean.TYPE) {
+			return luaState.toBooleanArray(index);
+		}
+		if (componentType == String.class) {
+			return luaState.toStringArray(index);
+		}
+		return null;
+	}
+
 	// -- Nested types
 	/**
 	 * Converts Lua values.
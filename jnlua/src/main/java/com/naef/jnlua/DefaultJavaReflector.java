@@ -9,6 +9,9 @@ import java.beans.BeanInfo;
 import java.beans.IntrospectionException;
 import java.beans.Introspector;
 import java.beans.PropertyDescriptor;
+import java.lang.invoke.MethodHandle;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.MethodType;
 import java.lang.reflect.Array;
 import java.lang.reflect.Constructor;
 import java.lang.reflect.Field;
@@ -19,13 +22,14 @@ import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.Collection;
 import java.util.HashMap;
-import java.util.HashSet;
 import java.util.Iterator;
 import java.util.List;
 import java.util.Map;
 import java.util.NavigableMap;
-import java.util.Set;
 import java.util.Map.Entry;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ConcurrentMap;
+import java.util.concurrent.atomic.LongAdder;
 import java.util.concurrent.locks.ReadWriteLock;
 import java.util.concurrent.locks.ReentrantReadWriteLock;
 
@@ -34,15 +38,61 @@ import java.util.concurrent.locks.ReentrantReadWriteLock;
  */
 public class DefaultJavaReflector implements JavaReflector {
 	// -- Static
-	private static final DefaultJavaReflector INSTANCE = new DefaultJavaReflector();
+	private static final DefaultJavaReflector INSTANCE = new DefaultJavaReflector(
+			false);
+	private static final DefaultJavaReflector METHOD_HANDLE_INSTANCE = new DefaultJavaReflector(
+			true);
 	private static final Object JAVA_FUNCTION_TYPE = new Object();
 	private static final Object[] EMPTY_ARGUMENTS = new Object[0];
+	private static final LuaType[] LUA_TYPES = LuaType.values();
+	private static final InlineCacheEntry[] EMPTY_INLINE_CACHE = new InlineCacheEntry[0];
+	private static final int INLINE_CACHE_SIZE = 4;
+	private static final MethodHandle TO_BOOLEAN = findLuaStateMethod(
+			"toBoolean", Boolean.TYPE, Integer.TYPE);
+	private static final MethodHandle TO_INTEGER = findLuaStateMethod(
+			"toInteger", Integer.TYPE, Integer.TYPE);
+	private static final MethodHandle TO_NUMBER = findLuaStateMethod(
+			"toNumber", Double.TYPE, Integer.TYPE);
+	private static final MethodHandle TO_STRING = findLuaStateMethod(
+			"toString", String.class, Integer.TYPE);
+	private static final MethodHandle TO_JAVA_OBJECT = findLuaStateMethod(
+			"toJavaObject", Object.class, Integer.TYPE, Class.class);
+	private static final MethodHandle PUSH_BOOLEAN = findLuaStateMethod(
+			"pushBoolean", Void.TYPE, Boolean.TYPE);
+	private static final MethodHandle PUSH_INTEGER = findLuaStateMethod(
+			"pushInteger", Void.TYPE, Integer.TYPE);
+	private static final MethodHandle PUSH_NUMBER = findLuaStateMethod(
+			"pushNumber", Void.TYPE, Double.TYPE);
+	private static final MethodHandle PUSH_JAVA_OBJECT = findLuaStateMethod(
+			"pushJavaObject", Void.TYPE, Object.class);
+	private static final MethodHandle PUSH_JAVA_OBJECT_RAW = findLuaStateMethod(
+			"pushJavaObjectRaw", Void.TYPE, Object.class);
+	private static final MethodHandle NEW_TARGET_EXCEPTION;
+	private static final ThreadLocal<ArgumentScratch> ARGUMENT_SCRATCH = new ThreadLocal<ArgumentScratch>() {
+		@Override
+		protected ArgumentScratch initialValue() {
+			return new ArgumentScratch();
+		}
+	};
+	static {
+		try {
+			NEW_TARGET_EXCEPTION = MethodHandles.lookup().findStatic(
+					DefaultJavaReflector.class,
+					"newTargetException",
+					MethodType.methodType(RuntimeException.class,
+							Throwable.class));
+		} catch (ReflectiveOperationException e) {
+			throw new ExceptionInInitializerError(e);
+		}
+	}
 
 	// -- State
+	private boolean methodHandles;
 	private Map<Class<?>, Map<String, Accessor>> accessors = new HashMap<Class<?>, Map<String, Accessor>>();
 	private ReadWriteLock accessorLock = new ReentrantReadWriteLock();
-	private Map<LuaCallSignature, Invocable> invocableDispatches = new HashMap<LuaCallSignature, Invocable>();
-	private ReadWriteLock invocableDispatchLock = new ReentrantReadWriteLock();
+	private ConcurrentMap<LuaCallSignature, InvocableDispatch> invocableDispatches = new ConcurrentHashMap<LuaCallSignature, InvocableDispatch>();
+	private LongAdder inlineCacheHits = new LongAdder();
+	private LongAdder inlineCacheMisses = new LongAdder();
 	private JavaFunction index = new Index();
 	private JavaFunction newIndex = new NewIndex();
 	private JavaFunction equal = new Equal();
@@ -68,11 +118,58 @@ public class DefaultJavaReflector implements JavaReflector {
 		return INSTANCE;
 	}
 
+	/**
+	 * Returns the instance of this class that invokes methods and constructors
+	 * and reads fields through method handles rather than core reflection.
+	 * 
+	 * <p>
+	 * For each dispatched Lua call signature, the instance adapts the method
+	 * handle of the invoked method or constructor to an invoker that reads the
+	 * arguments from the Lua stack and pushes the return value. With the
+	 * default converter, numbers and booleans are read and pushed as
+	 * primitive values, so the invocation neither allocates an argument array
+	 * nor boxes primitive arguments and return values. Invocations with
+	 * variable arguments, invocations of members that are not accessible
+	 * through the public lookup, and invocations with other converters use
+	 * core reflection. Field writes use core reflection.
+	 * </p>
+	 * 
+	 * @return the method handle instance
+	 * @since JNLua 1.0.5
+	 */
+	public static DefaultJavaReflector getMethodHandleInstance() {
+		return METHOD_HANDLE_INSTANCE;
+	}
+
 	// -- Construction
 	/**
 	 * Creates a new instances;
 	 */
-	private DefaultJavaReflector() {
+	private DefaultJavaReflector(boolean methodHandles) {
+		this.methodHandles = methodHandles;
+	}
+
+	// -- Properties
+	/**
+	 * Returns the number of method and constructor invocations dispatched by
+	 * the inline cache of the invoked member.
+	 * 
+	 * @return the number of inline cache hits
+	 * @since JNLua 1.0.5
+	 */
+	public long getInlineCacheHitCount() {
+		return inlineCacheHits.sum();
+	}
+
+	/**
+	 * Returns the number of method and constructor invocations not dispatched
+	 * by the inline cache of the invoked member.
+	 * 
+	 * @return the number of inline cache misses
+	 * @since JNLua 1.0.5
+	 */
+	public long getInlineCacheMissCount() {
+		return inlineCacheMisses.sum();
 	}
 
 	// -- JavaReflector methods
@@ -359,6 +456,160 @@ public class DefaultJavaReflector implements JavaReflector {
 				.getClass();
 	}
 
+	/**
+	 * Returns a method handle for a public method of the Lua state.
+	 */
+	private static MethodHandle findLuaStateMethod(String name,
+			Class<?> returnType, Class<?>... parameterTypes) {
+		try {
+			return MethodHandles.publicLookup().findVirtual(LuaState.class,
+					name, MethodType.methodType(returnType, parameterTypes));
+		} catch (ReflectiveOperationException e) {
+			throw new ExceptionInInitializerError(e);
+		}
+	}
+
+	/**
+	 * Returns the exception reporting an exception thrown by an invoked method
+	 * or constructor, like in core reflection.
+	 */
+	@SuppressWarnings("unused")
+	private static RuntimeException newTargetException(Throwable e) {
+		return new RuntimeException(e);
+	}
+
+	/**
+	 * Adapts a method handle of type <code>(Object, P...)R</code> to an
+	 * invoker of type <code>(LuaState, Object, P...)int</code> that pushes the
+	 * return value, if any, and returns the number of pushed values.
+	 */
+	private static MethodHandle getPushingInvoker(MethodHandle methodHandle,
+			boolean rawReturn) {
+		MethodType type = methodHandle.type();
+		Class<?> returnType = type.returnType();
+		methodHandle = MethodHandles.dropArguments(methodHandle, 0,
+				LuaState.class);
+		if (returnType == Void.TYPE) {
+			return MethodHandles.foldArguments(MethodHandles.dropArguments(
+					MethodHandles.constant(Integer.TYPE, 0), 0,
+					methodHandle.type().parameterList()), methodHandle);
+		}
+		MethodHandle pusher;
+		if (returnType == Boolean.TYPE) {
+			pusher = PUSH_BOOLEAN;
+		} else if (returnType == Character.TYPE) {
+			pusher = PUSH_INTEGER;
+		} else if (returnType.isPrimitive()) {
+			pusher = PUSH_NUMBER;
+		} else {
+			pusher = rawReturn ? PUSH_JAVA_OBJECT_RAW : PUSH_JAVA_OBJECT;
+		}
+		pusher = MethodHandles.explicitCastArguments(pusher,
+				MethodType.methodType(Void.TYPE, LuaState.class, returnType));
+		pusher = MethodHandles.foldArguments(MethodHandles.dropArguments(
+				MethodHandles.constant(Integer.TYPE, 1), 0, LuaState.class,
+				returnType), pusher);
+		pusher = MethodHandles.permuteArguments(pusher, MethodType
+				.methodType(Integer.TYPE, returnType, LuaState.class), 1, 0);
+		pusher = MethodHandles.dropArguments(pusher, 2,
+				methodHandle.type().dropParameterTypes(0, 1).parameterList());
+		return MethodHandles.foldArguments(pusher, methodHandle);
+	}
+
+	/**
+	 * Returns a method handle of type <code>(LuaState)T</code> reading an
+	 * argument of a described Lua type from the stack, or <code>null</code>
+	 * if the argument requires core reflection. The primitive conversions are
+	 * those of the default converter.
+	 */
+	private static MethodHandle getArgumentReader(Class<?> formalType,
+			Object type, int index) {
+		MethodHandle reader;
+		if (type == LuaType.NUMBER && formalType.isPrimitive()
+				&& formalType != Boolean.TYPE) {
+			if (formalType == Long.TYPE || formalType == Float.TYPE
+					|| formalType == Double.TYPE) {
+				reader = TO_NUMBER;
+			} else {
+				reader = TO_INTEGER;
+			}
+		} else if (type == LuaType.BOOLEAN && formalType == Boolean.TYPE) {
+			reader = TO_BOOLEAN;
+		} else if (type == LuaType.STRING && formalType == String.class) {
+			reader = TO_STRING;
+		} else if (!formalType.isPrimitive()) {
+			reader = MethodHandles.insertArguments(TO_JAVA_OBJECT, 2,
+					formalType);
+		} else {
+			return null;
+		}
+		reader = MethodHandles.insertArguments(reader, 1, index);
+		return MethodHandles.explicitCastArguments(reader,
+				MethodType.methodType(formalType, LuaState.class));
+	}
+
+	/**
+	 * Returns an invoker of type <code>(LuaState, Object)int</code> for an
+	 * invocable called with arguments of the described Lua types, or
+	 * <code>null</code> if the invocation requires core reflection. Exceptions
+	 * thrown by the invocable are reported like in core reflection.
+	 */
+	private static MethodHandle getInvoker(Invocable invocable, Object[] types) {
+		// Adapt the method handle
+		if (invocable.isVarArgs()) {
+			return null;
+		}
+		MethodHandle methodHandle;
+		try {
+			methodHandle = invocable.getMethodHandle();
+		} catch (IllegalAccessException e) {
+			return null;
+		}
+		if (methodHandle == null) {
+			return null;
+		}
+		MethodType type = methodHandle.type();
+		MethodHandle handler = MethodHandles.filterArguments(
+				MethodHandles.throwException(type.returnType(),
+						RuntimeException.class), 0, NEW_TARGET_EXCEPTION);
+		methodHandle = MethodHandles.catchException(methodHandle,
+				Throwable.class,
+				MethodHandles.dropArguments(handler, 1, type.parameterList()));
+		MethodHandle invoker = getPushingInvoker(methodHandle,
+				invocable.isRawReturn());
+
+		// Read the arguments from the stack
+		MethodHandle[] readers = new MethodHandle[types.length];
+		int[] reorder = new int[types.length + 2];
+		reorder[1] = 1;
+		for (int i = 0; i < types.length; i++) {
+			readers[i] = getArgumentReader(invocable.getParameterType(i),
+					types[i], i + 2);
+			if (readers[i] == null) {
+				return null;
+			}
+		}
+		invoker = MethodHandles.filterArguments(invoker, 2, readers);
+		return MethodHandles.permuteArguments(invoker, MethodType.methodType(
+				Integer.TYPE, LuaState.class, Object.class), reorder);
+	}
+
+	/**
+	 * Calls an invoker.
+	 */
+	private static int invoke(MethodHandle invoker, LuaState luaState,
+			Object object) {
+		try {
+			return (int) invoker.invokeExact(luaState, object);
+		} catch (RuntimeException e) {
+			throw e;
+		} catch (Error e) {
+			throw e;
+		} catch (Throwable e) {
+			throw new RuntimeException(e);
+		}
+	}
+
 	// -- Nested types
 	/**
 	 * <code>__index</code> metamethod implementation.
@@ -829,6 +1080,8 @@ public class DefaultJavaReflector implements JavaReflector {
 	private class FieldAccessor implements Accessor {
 		// -- State
 		private Field field;
+		private boolean fieldHandles;
+		private MethodHandle reader;
 
 		// -- Construction
 		/**
@@ -836,6 +1089,7 @@ public class DefaultJavaReflector implements JavaReflector {
 		 */
 		public FieldAccessor(Field field) {
 			this.field = field;
+			fieldHandles = methodHandles;
 		}
 
 		// -- Accessor methods
@@ -846,6 +1100,28 @@ public class DefaultJavaReflector implements JavaReflector {
 				if (objectClass == object) {
 					object = null;
 				}
+				if (fieldHandles && reader == null) {
+					try {
+						MethodHandle getter = MethodHandles.publicLookup()
+								.unreflectGetter(field);
+						if (Modifier.isStatic(field.getModifiers())) {
+							getter = MethodHandles.dropArguments(getter, 0,
+									Object.class);
+						} else {
+							getter = getter.asType(getter.type()
+									.changeParameterType(0, Object.class));
+						}
+						reader = getPushingInvoker(getter, false);
+					} catch (IllegalAccessException e) {
+						fieldHandles = false;
+					}
+				}
+				if (fieldHandles
+						&& luaState.getConverter() == DefaultConverter
+								.getInstance()) {
+					invoke(reader, luaState, object);
+					return;
+				}
 				luaState.pushJavaObject(field.get(object));
 			} catch (IllegalArgumentException e) {
 				throw new RuntimeException(e);
@@ -888,6 +1164,7 @@ public class DefaultJavaReflector implements JavaReflector {
 		// -- State
 		private Class<?> clazz;
 		private List<Invocable> invocables;
+		private volatile InlineCacheEntry[] inlineCache = EMPTY_INLINE_CACHE;
 
 		// -- Construction
 		/**
@@ -966,31 +1243,59 @@ public class DefaultJavaReflector implements JavaReflector {
 				object = null;
 			}
 
-			// Invocable dispatch
-			LuaCallSignature luaCallSignature = getLuaCallSignature(luaState);
-			Invocable invocable;
-			invocableDispatchLock.readLock().lock();
+			// Describe arguments
+			int argCount = luaState.getTop() - 1;
+			ArgumentScratch scratch = ArgumentScratch.acquire(argCount);
+			InvocableDispatch dispatch;
 			try {
-				invocable = invocableDispatches.get(luaCallSignature);
-			} finally {
-				invocableDispatchLock.readLock().unlock();
-			}
-			if (invocable == null) {
-				invocable = dispatchInvocable(luaState, object == null);
-				invocableDispatchLock.writeLock().lock();
-				try {
-					if (!invocableDispatches.containsKey(luaCallSignature)) {
-						invocableDispatches.put(luaCallSignature, invocable);
-					} else {
-						invocable = invocableDispatches.get(luaCallSignature);
+				int[] argTypes = scratch.types;
+				Object[] argObjects = scratch.objects;
+				if (argCount > 0) {
+					luaState.describeStack(2, argCount + 1, argTypes,
+							argObjects);
+				}
+
+				// Invocable dispatch
+				boolean staticDispatch = object == null;
+				dispatch = lookupInlineCache(argTypes, argObjects, argCount,
+						staticDispatch);
+				if (dispatch != null) {
+					inlineCacheHits.increment();
+				} else {
+					inlineCacheMisses.increment();
+					LuaCallSignature luaCallSignature = getLuaCallSignature(
+							argTypes, argObjects, argCount);
+					dispatch = invocableDispatches.get(luaCallSignature);
+					if (dispatch == null) {
+						Invocable invocable = dispatchInvocable(luaState,
+								staticDispatch, argTypes, argObjects,
+								argCount);
+						dispatch = new InvocableDispatch(invocable,
+								methodHandles ? getInvoker(invocable,
+										luaCallSignature.types) : null);
+						InvocableDispatch other = invocableDispatches
+								.putIfAbsent(luaCallSignature, dispatch);
+						if (other != null) {
+							dispatch = other;
+						}
 					}
-				} finally {
-					invocableDispatchLock.writeLock().unlock();
+					updateInlineCache(staticDispatch,
+							luaCallSignature.types, dispatch);
 				}
+			} finally {
+				scratch.release(argCount);
+			}
+
+			// Invoke through a method handle
+			if (dispatch.invoker != null
+					&& luaState.getConverter() == DefaultConverter
+							.getInstance()) {
+				return DefaultJavaReflector.invoke(dispatch.invoker,
+						luaState, object);
 			}
 
 			// Prepare arguments
-			int argCount = luaState.getTop() - 1;
+			Invocable invocable = dispatch.invocable;
 			int parameterCount = invocable.getParameterCount();
 			Object[] arguments = new Object[parameterCount];
 			if (invocable.isVarArgs()) {
@@ -1046,42 +1351,108 @@ public class DefaultJavaReflector implements JavaReflector {
 		/**
 		 * Creates a Lua call signature.
 		 */
-		private LuaCallSignature getLuaCallSignature(LuaState luaState) {
-			int argCount = luaState.getTop() - 1;
+		private LuaCallSignature getLuaCallSignature(int[] argTypes,
+				Object[] argObjects, int argCount) {
 			Object[] types = new Object[argCount];
 			for (int i = 0; i < argCount; i++) {
-				LuaType type = luaState.type(i + 2);
-				switch (type) {
-				case FUNCTION:
-					types[i] = luaState.isJavaFunction(i + 2) ? JAVA_FUNCTION_TYPE
-							: LuaType.FUNCTION;
-					break;
-				case USERDATA:
-					if (luaState.isJavaObjectRaw(i + 2)) {
-						Object object = luaState.toJavaObjectRaw(i + 2);
-						if (object instanceof TypedJavaObject) {
-							types[i] = ((TypedJavaObject) object).getType();
-						} else {
-							types[i] = object.getClass();
-						}
+				types[i] = getArgType(argTypes[i], argObjects[i]);
+			}
+			return new LuaCallSignature(clazz, getName(), types);
+		}
+
+		/**
+		 * Returns the type of an argument in a Lua call signature.
+		 */
+		private Object getArgType(int argType, Object argObject) {
+			LuaType type = LUA_TYPES[argType & ~LuaState.DESCRIBE_JAVA];
+			boolean java = (argType & LuaState.DESCRIBE_JAVA) != 0;
+			switch (type) {
+			case FUNCTION:
+				return java ? JAVA_FUNCTION_TYPE : LuaType.FUNCTION;
+			case USERDATA:
+				if (java) {
+					if (argObject instanceof TypedJavaObject) {
+						return ((TypedJavaObject) argObject).getType();
 					} else {
-						types[i] = LuaType.USERDATA;
+						return argObject.getClass();
 					}
-					break;
-				default:
-					types[i] = type;
+				} else {
+					return LuaType.USERDATA;
 				}
+			default:
+				return type;
 			}
-			return new LuaCallSignature(clazz, getName(), types);
+		}
+
+		/**
+		 * Returns the type distance of an argument. The default converter
+		 * computes the distance from the argument description.
+		 */
+		private int getTypeDistance(LuaState luaState, Converter converter,
+				int[] argTypes, Object[] argObjects, int index,
+				Class<?> formalType) {
+			if (converter instanceof DefaultConverter) {
+				return ((DefaultConverter) converter).getTypeDistance(
+						argTypes[index], argObjects[index], formalType);
+			}
+			return converter.getTypeDistance(luaState, index + 2, formalType);
+		}
+
+		/**
+		 * Returns the dispatch cached for the described arguments, or
+		 * <code>null</code> if there is none. The argument types are compared
+		 * with the cached types without allocating.
+		 */
+		private InvocableDispatch lookupInlineCache(int[] argTypes,
+				Object[] argObjects, int argCount, boolean staticDispatch) {
+			InlineCacheEntry[] entries = inlineCache;
+			int matches = 0;
+			for (int i = 0; i < entries.length; i++) {
+				if (entries[i].staticDispatch == staticDispatch
+						&& entries[i].types.length == argCount) {
+					matches |= 1 << i;
+				}
+			}
+			for (int j = 0; j < argCount && matches != 0; j++) {
+				Object type = getArgType(argTypes[j], argObjects[j]);
+				for (int i = 0; i < entries.length; i++) {
+					if (entries[i].types.length > j
+							&& entries[i].types[j] != type) {
+						matches &= ~(1 << i);
+					}
+				}
+			}
+			if (matches == 0) {
+				return null;
+			}
+			return entries[Integer.numberOfTrailingZeros(matches)].dispatch;
+		}
+
+		/**
+		 * Adds a dispatch to the inline cache unless the cache is full.
+		 * Concurrent updates may lose an entry, which is benign.
+		 */
+		private void updateInlineCache(boolean staticDispatch, Object[] types,
+				InvocableDispatch dispatch) {
+			InlineCacheEntry[] entries = inlineCache;
+			if (entries.length >= INLINE_CACHE_SIZE) {
+				return;
+			}
+			InlineCacheEntry[] newEntries = Arrays.copyOf(entries,
+					entries.length + 1);
+			newEntries[entries.length] = new InlineCacheEntry(staticDispatch,
+					types, dispatch);
+			inlineCache = newEntries;
 		}
 
 		/**
 		 * Dispatches an invocable.
 		 */
 		private Invocable dispatchInvocable(LuaState luaState,
-				boolean staticDispatch) {
+				boolean staticDispatch, int[] argTypes, Object[] argObjects,
+				int argCount) {
 			// Begin with all candidates
-			Set<Invocable> candidates = new HashSet<Invocable>(invocables);
+			List<Invocable> candidates = new ArrayList<Invocable>(invocables);
 
 			// Eliminate methods with an invalid static modifier
 			for (Iterator<Invocable> i = candidates.iterator(); i.hasNext();) {
@@ -1092,7 +1463,6 @@ public class DefaultJavaReflector implements JavaReflector {
 			}
 
 			// Eliminate methods with an invalid parameter count
-			int argCount = luaState.getTop() - 1;
 			for (Iterator<Invocable> i = candidates.iterator(); i.hasNext();) {
 				Invocable invocable = i.next();
 				if (invocable.isVarArgs()) {
@@ -1112,7 +1482,8 @@ public class DefaultJavaReflector implements JavaReflector {
 					.hasNext();) {
 				Invocable invocable = i.next();
 				for (int j = 0; j < argCount; j++) {
-					int distance = converter.getTypeDistance(luaState, j + 2,
+					int distance = getTypeDistance(luaState, converter,
+							argTypes, argObjects, j,
 							invocable.getParameterType(j));
 					if (distance == Integer.MAX_VALUE) {
 						i.remove();
@@ -1152,10 +1523,12 @@ public class DefaultJavaReflector implements JavaReflector {
 									other.getParameterCount()));
 					boolean delta = false;
 					for (int j = 0; j < parameterCount; j++) {
-						int distance = converter.getTypeDistance(luaState,
-								j + 2, invocable.getParameterType(j));
-						int otherDistance = converter.getTypeDistance(luaState,
-								j + 2, other.getParameterType(j));
+						int distance = getTypeDistance(luaState, converter,
+								argTypes, argObjects, j,
+								invocable.getParameterType(j));
+						int otherDistance = getTypeDistance(luaState,
+								converter, argTypes, argObjects, j,
+								other.getParameterType(j));
 						if (otherDistance > distance) {
 							// Other is not closer
 							continue inner;
@@ -1237,7 +1610,7 @@ public class DefaultJavaReflector implements JavaReflector {
 		 * ambivalent.
 		 */
 		private LuaRuntimeException getSignatureAmbivalenceException(
-				LuaState luaState, Set<Invocable> candidates) {
+				LuaState luaState, List<Invocable> candidates) {
 			StringBuffer sb = new StringBuffer();
 			sb.append(String.format(
 					"%s '%s(%s)' on class %s is ambivalent among ", getWhat(),
@@ -1421,6 +1794,14 @@ public class DefaultJavaReflector implements JavaReflector {
 		public Object invoke(Object obj, Object... args)
 				throws InstantiationException, IllegalAccessException,
 				IllegalArgumentException, InvocationTargetException;
+
+		/**
+		 * Returns a method handle of type <code>(Object, P...)R</code> for
+		 * this invocable, or <code>null</code> if there is none. The first
+		 * argument is the receiver, which is ignored for static methods and
+		 * constructors.
+		 */
+		public MethodHandle getMethodHandle() throws IllegalAccessException;
 	}
 
 	/**
@@ -1500,6 +1881,18 @@ public class DefaultJavaReflector implements JavaReflector {
 			return method.invoke(obj, args);
 		}
 
+		@Override
+		public MethodHandle getMethodHandle() throws IllegalAccessException {
+			MethodHandle methodHandle = MethodHandles.publicLookup()
+					.unreflect(method);
+			if (Modifier.isStatic(method.getModifiers())) {
+				return MethodHandles.dropArguments(methodHandle, 0,
+						Object.class);
+			}
+			return methodHandle.asType(methodHandle.type()
+					.changeParameterType(0, Object.class));
+		}
+
 		@Override
 		public String toString() {
 			return method.toString();
@@ -1584,6 +1977,12 @@ public class DefaultJavaReflector implements JavaReflector {
 			return constructor.newInstance(args);
 		}
 
+		@Override
+		public MethodHandle getMethodHandle() throws IllegalAccessException {
+			return MethodHandles.dropArguments(MethodHandles.publicLookup()
+					.unreflectConstructor(constructor), 0, Object.class);
+		}
+
 		@Override
 		public String toString() {
 			return constructor.toString();
@@ -1668,12 +2067,96 @@ public class DefaultJavaReflector implements JavaReflector {
 			return proxy;
 		}
 
+		@Override
+		public MethodHandle getMethodHandle() {
+			return null;
+		}
+
 		@Override
 		public String toString() {
 			return interfaze.toString();
 		}
 	}
 
+	/**
+	 * Scratch arrays receiving the description of the arguments of an
+	 * invocation. Each thread reuses its scratch arrays, except for nested
+	 * invocations during a dispatch, which use their own.
+	 */
+	private static class ArgumentScratch {
+		// -- State
+		private int[] types = new int[8];
+		private Object[] objects = new Object[8];
+		private boolean busy;
+
+		// -- Static methods
+		/**
+		 * Acquires the scratch arrays of the current thread for a number of
+		 * arguments.
+		 */
+		public static ArgumentScratch acquire(int argCount) {
+			ArgumentScratch scratch = ARGUMENT_SCRATCH.get();
+			if (scratch.busy) {
+				scratch = new ArgumentScratch();
+			}
+			if (argCount > scratch.types.length) {
+				int length = Math.max(argCount, scratch.types.length * 2);
+				scratch.types = new int[length];
+				scratch.objects = new Object[length];
+			}
+			scratch.busy = true;
+			return scratch;
+		}
+
+		// -- Operations
+		/**
+		 * Releases the scratch arrays, clearing the Java objects.
+		 */
+		public void release(int argCount) {
+			Arrays.fill(objects, 0, argCount, null);
+			busy = false;
+		}
+	}
+
+	/**
+	 * Invocable dispatched for a Lua call signature.
+	 */
+	private static class InvocableDispatch {
+		// -- State
+		private Invocable invocable;
+		private MethodHandle invoker;
+
+		// -- Construction
+		/**
+		 * Creates a new instance.
+		 */
+		public InvocableDispatch(Invocable invocable, MethodHandle invoker) {
+			this.invocable = invocable;
+			this.invoker = invoker;
+		}
+	}
+
+	/**
+	 * Inline cache entry of an invocable accessor.
+	 */
+	private static class InlineCacheEntry {
+		// -- State
+		private boolean staticDispatch;
+		private Object[] types;
+		private InvocableDispatch dispatch;
+
+		// -- Construction
+		/**
+		 * Creates a new instance.
+		 */
+		public InlineCacheEntry(boolean staticDispatch, Object[] types,
+				InvocableDispatch dispatch) {
+			this.staticDispatch = staticDispatch;
+			this.types = types;
+			this.dispatch = dispatch;
+		}
+	}
+
 	/**
 	 * Lua call signature.
 	 */
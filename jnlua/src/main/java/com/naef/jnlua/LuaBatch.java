@@ -0,0 +1,719 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+import java.io.UnsupportedEncodingException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Arrays;
+import java.util.HashMap;
+import java.util.Map;
+
+/**
+ * A batch of Lua stack operations. A batch records a sequence of stack
+ * operations and executes them in a Lua state with a single JNI transition.
+ * 
+ * <p>
+ * Operations are recorded by invoking the methods of this class in the order
+ * they are to be executed. The methods have the same semantics as the
+ * methods of the same name in {@link LuaState}. Methods returning a value
+ * record a result slot and return the index of that slot. After the batch
+ * has been executed by invoking {@link LuaState#execute(LuaBatch)}, the
+ * results can be read by their slot index.
+ * </p>
+ * 
+ * <p>
+ * If an operation fails, the execution of the batch stops at that operation
+ * and the corresponding exception is thrown. The operations preceding the
+ * failed operation remain in effect.
+ * </p>
+ * 
+ * <p>
+ * A batch can be executed multiple times, and it can be reused for a new
+ * sequence of operations by invoking {@link #clear()}. Batches are not
+ * thread-safe.
+ * </p>
+ * 
+ * @since JNLua 1.0.5
+ */
+public class LuaBatch {
+	// -- Static
+	private static final int PUSHNIL = 0;
+	private static final int PUSHBOOLEAN = 1;
+	private static final int PUSHINTEGER = 2;
+	private static final int PUSHNUMBER = 3;
+	private static final int PUSHSTRING = 4;
+	private static final int PUSHVALUE = 5;
+	private static final int POP = 6;
+	private static final int SETTOP = 7;
+	private static final int INSERT = 8;
+	private static final int REMOVE = 9;
+	private static final int NEWTABLE = 10;
+	private static final int GETTABLE = 11;
+	private static final int SETTABLE = 12;
+	private static final int GETFIELD = 13;
+	private static final int SETFIELD = 14;
+	private static final int RAWGET = 15;
+	private static final int RAWSET = 16;
+	private static final int RAWGETI = 17;
+	private static final int RAWSETI = 18;
+	private static final int GETGLOBAL = 19;
+	private static final int SETGLOBAL = 20;
+	private static final int GETTOP = 21;
+	private static final int TYPE = 22;
+	private static final int TOBOOLEAN = 23;
+	private static final int TOINTEGER = 24;
+	private static final int TONUMBER = 25;
+	private static final int TOSTRING = 26;
+	private static final int RAWLEN = 27;
+
+	/**
+	 * The size of a result slot.
+	 */
+	private static final int RESULT_SIZE = 8;
+
+	// -- State
+	/**
+	 * Encoded operations.
+	 */
+	private ByteBuffer commands;
+
+	/**
+	 * String pool. Each entry consists of the length, the UTF-8 bytes and a
+	 * terminating zero byte.
+	 */
+	private ByteBuffer pool;
+
+	/**
+	 * Pool offsets of the strings in the string pool.
+	 */
+	private Map<String, Integer> poolOffsets = new HashMap<String, Integer>();
+
+	/**
+	 * Result slots.
+	 */
+	private ByteBuffer results;
+
+	/**
+	 * String results.
+	 */
+	private Object[] strings;
+
+	/**
+	 * The number of result slots.
+	 */
+	private int resultCount;
+
+	// -- Construction
+	/**
+	 * Creates a new instance with a default capacity.
+	 */
+	public LuaBatch() {
+		this(256);
+	}
+
+	/**
+	 * Creates a new instance with the specified initial capacity in bytes. The
+	 * batch grows as needed.
+	 * 
+	 * @param capacity
+	 *            the initial capacity
+	 */
+	public LuaBatch(int capacity) {
+		if (capacity <= 0) {
+			throw new IllegalArgumentException("illegal capacity");
+		}
+		commands = allocate(capacity);
+		pool = allocate(capacity);
+		results = allocate(RESULT_SIZE * 16);
+		strings = new Object[16];
+	}
+
+	// -- Properties
+	/**
+	 * Returns the number of result slots of this batch.
+	 * 
+	 * @return the number of result slots
+	 */
+	public int getResultCount() {
+		return resultCount;
+	}
+
+	// -- Operations
+	/**
+	 * Records pushing a nil value on the stack.
+	 */
+	public void pushNil() {
+		putOperation(PUSHNIL);
+	}
+
+	/**
+	 * Records pushing a boolean value on the stack.
+	 * 
+	 * @param b
+	 *            the boolean value to push
+	 */
+	public void pushBoolean(boolean b) {
+		putOperation(PUSHBOOLEAN);
+		putInt(b ? 1 : 0);
+	}
+
+	/**
+	 * Records pushing an integer value as a number value on the stack.
+	 * 
+	 * @param n
+	 *            the integer value to push
+	 */
+	public void pushInteger(int n) {
+		putOperation(PUSHINTEGER);
+		putInt(n);
+	}
+
+	/**
+	 * Records pushing a number value on the stack.
+	 * 
+	 * @param n
+	 *            the number to push
+	 */
+	public void pushNumber(double n) {
+		putOperation(PUSHNUMBER);
+		ensureCommands(8);
+		commands.putDouble(n);
+	}
+
+	/**
+	 * Records pushing a string value on the stack.
+	 * 
+	 * @param s
+	 *            the string value to push
+	 */
+	public void pushString(String s) {
+		int offset = putString(s);
+		putOperation(PUSHSTRING);
+		putInt(offset);
+	}
+
+	/**
+	 * Records pushing the value at the specified index on top of the stack.
+	 * 
+	 * @param index
+	 *            the stack index
+	 */
+	public void pushValue(int index) {
+		putOperation(PUSHVALUE);
+		putInt(index);
+	}
+
+	/**
+	 * Records popping values from the stack.
+	 * 
+	 * @param count
+	 *            the number of values to pop
+	 */
+	public void pop(int count) {
+		putOperation(POP);
+		putInt(count);
+	}
+
+	/**
+	 * Records setting the specified index as the new top of the stack.
+	 * 
+	 * @param index
+	 *            the index of the new top of the stack
+	 */
+	public void setTop(int index) {
+		putOperation(SETTOP);
+		putInt(index);
+	}
+
+	/**
+	 * Records popping a value from the top of the stack and inserting it at
+	 * the specified index.
+	 * 
+	 * @param index
+	 *            the stack index
+	 */
+	public void insert(int index) {
+		putOperation(INSERT);
+		putInt(index);
+	}
+
+	/**
+	 * Records removing a value from the specified stack index.
+	 * 
+	 * @param index
+	 *            the stack index
+	 */
+	public void remove(int index) {
+		putOperation(REMOVE);
+		putInt(index);
+	}
+
+	/**
+	 * Records creating a new table and pushing it on the stack.
+	 */
+	public void newTable() {
+		newTable(0, 0);
+	}
+
+	/**
+	 * Records creating a new table with pre-allocated space for a number of
+	 * array elements and record elements, and pushing it on the stack.
+	 * 
+	 * @param arrayCount
+	 *            the number of array elements
+	 * @param recordCount
+	 *            the number of record elements
+	 */
+	public void newTable(int arrayCount, int recordCount) {
+		putOperation(NEWTABLE);
+		putInt(arrayCount);
+		putInt(recordCount);
+	}
+
+	/**
+	 * Records pushing a value on the stack from a table at the specified
+	 * index. The table key is popped from the stack.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 */
+	public void getTable(int index) {
+		putOperation(GETTABLE);
+		putInt(index);
+	}
+
+	/**
+	 * Records setting a value in a table at the specified index. The key and
+	 * the value are popped from the stack.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 */
+	public void setTable(int index) {
+		putOperation(SETTABLE);
+		putInt(index);
+	}
+
+	/**
+	 * Records pushing a value on the stack from a table at the specified
+	 * index, using the specified string key.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @param key
+	 *            the string key
+	 */
+	public void getField(int index, String key) {
+		int offset = putString(key);
+		putOperation(GETFIELD);
+		putInt(index);
+		putInt(offset);
+	}
+
+	/**
+	 * Records setting a value in a table at the specified index, using the
+	 * specified string key. The value is popped from the stack.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @param key
+	 *            the string key
+	 */
+	public void setField(int index, String key) {
+		int offset = putString(key);
+		putOperation(SETFIELD);
+		putInt(index);
+		putInt(offset);
+	}
+
+	/**
+	 * Records pushing a value on the stack from a table at the specified index
+	 * without invoking metamethods. The table key is popped from the stack.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 */
+	public void rawGet(int index) {
+		putOperation(RAWGET);
+		putInt(index);
+	}
+
+	/**
+	 * Records pushing a value on the stack from a table at the specified
+	 * index, using the specified integer key, without invoking metamethods.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @param key
+	 *            the integer key
+	 */
+	public void rawGet(int index, int key) {
+		putOperation(RAWGETI);
+		putInt(index);
+		putInt(key);
+	}
+
+	/**
+	 * Records setting a value in a table at the specified index without
+	 * invoking metamethods. The key and the value are popped from the stack.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 */
+	public void rawSet(int index) {
+		putOperation(RAWSET);
+		putInt(index);
+	}
+
+	/**
+	 * Records setting a value in a table at the specified index, using the
+	 * specified integer key, without invoking metamethods. The value is popped
+	 * from the stack.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @param key
+	 *            the integer key
+	 */
+	public void rawSet(int index, int key) {
+		putOperation(RAWSETI);
+		putInt(index);
+		putInt(key);
+	}
+
+	/**
+	 * Records pushing the value of a global variable on the stack.
+	 * 
+	 * @param name
+	 *            the global variable name
+	 */
+	public void getGlobal(String name) {
+		int offset = putString(name);
+		putOperation(GETGLOBAL);
+		putInt(offset);
+	}
+
+	/**
+	 * Records setting the value on top of the stack as a global variable and
+	 * popping the value from the stack.
+	 * 
+	 * @param name
+	 *            the global variable name
+	 */
+	public void setGlobal(String name) {
+		int offset = putString(name);
+		putOperation(SETGLOBAL);
+		putInt(offset);
+	}
+
+	// -- Operations with results
+	/**
+	 * Records querying the index of the top element of the stack.
+	 * 
+	 * @return the result slot, to be read with {@link #getInteger(int)}
+	 */
+	public int getTop() {
+		putOperation(GETTOP);
+		return resultCount++;
+	}
+
+	/**
+	 * Records querying the type of the value at the specified stack index.
+	 * The stack index may be non-valid.
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the result slot, to be read with {@link #getType(int)}
+	 */
+	public int type(int index) {
+		putOperation(TYPE);
+		putInt(index);
+		return resultCount++;
+	}
+
+	/**
+	 * Records querying the boolean representation of the value at the
+	 * specified stack index. The stack index may be non-valid.
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the result slot, to be read with {@link #getBoolean(int)}
+	 */
+	public int toBoolean(int index) {
+		putOperation(TOBOOLEAN);
+		putInt(index);
+		return resultCount++;
+	}
+
+	/**
+	 * Records querying the integer representation of the value at the
+	 * specified stack index.
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the result slot, to be read with {@link #getInteger(int)}
+	 */
+	public int toInteger(int index) {
+		putOperation(TOINTEGER);
+		putInt(index);
+		return resultCount++;
+	}
+
+	/**
+	 * Records querying the number representation of the value at the
+	 * specified stack index.
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the result slot, to be read with {@link #getNumber(int)}
+	 */
+	public int toNumber(int index) {
+		putOperation(TONUMBER);
+		putInt(index);
+		return resultCount++;
+	}
+
+	/**
+	 * Records querying the string representation of the value at the
+	 * specified stack index. If the value is a number, it is in place
+	 * converted to a string.
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the result slot, to be read with {@link #getString(int)}
+	 */
+	public int toString(int index) {
+		putOperation(TOSTRING);
+		putInt(index);
+		return resultCount++;
+	}
+
+	/**
+	 * Records querying the raw length of the value at the specified stack
+	 * index.
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the result slot, to be read with {@link #getInteger(int)}
+	 */
+	public int rawLen(int index) {
+		putOperation(RAWLEN);
+		putInt(index);
+		return resultCount++;
+	}
+
+	// -- Results
+	/**
+	 * Returns a boolean result.
+	 * 
+	 * @param slot
+	 *            the result slot
+	 * @return the boolean result
+	 */
+	public boolean getBoolean(int slot) {
+		return getResult(slot) != 0.0;
+	}
+
+	/**
+	 * Returns an integer result.
+	 * 
+	 * @param slot
+	 *            the result slot
+	 * @return the integer result
+	 */
+	public int getInteger(int slot) {
+		return (int) getResult(slot);
+	}
+
+	/**
+	 * Returns a number result.
+	 * 
+	 * @param slot
+	 *            the result slot
+	 * @return the number result
+	 */
+	public double getNumber(int slot) {
+		return getResult(slot);
+	}
+
+	/**
+	 * Returns a string result.
+	 * 
+	 * @param slot
+	 *            the result slot
+	 * @return the string result, or <code>null</code> if the value was not
+	 *         convertible to a string
+	 */
+	public String getString(int slot) {
+		checkSlot(slot);
+		return (String) strings[slot];
+	}
+
+	/**
+	 * Returns a type result.
+	 * 
+	 * @param slot
+	 *            the result slot
+	 * @return the type, or <code>null</code> if the stack index was non-valid
+	 */
+	public LuaType getType(int slot) {
+		int type = (int) getResult(slot);
+		return type >= 0 ? LuaType.values()[type] : null;
+	}
+
+	// -- Operations
+	/**
+	 * Clears this batch, removing all recorded operations and results.
+	 */
+	public void clear() {
+		commands.clear();
+		pool.clear();
+		poolOffsets.clear();
+		Arrays.fill(strings, null);
+		resultCount = 0;
+	}
+
+	// -- Package private methods
+	/**
+	 * Prepares this batch for execution, ensuring the capacity for the
+	 * results.
+	 */
+	void prepare() {
+		if (results.capacity() < resultCount * RESULT_SIZE) {
+			results = allocate(Math.max(resultCount, results.capacity()
+					/ RESULT_SIZE * 2)
+					* RESULT_SIZE);
+		}
+		if (strings.length < resultCount) {
+			strings = new Object[Math.max(resultCount, strings.length * 2)];
+		} else {
+			Arrays.fill(strings, null);
+		}
+	}
+
+	/**
+	 * Returns the encoded operations.
+	 */
+	ByteBuffer getCommands() {
+		return commands;
+	}
+
+	/**
+	 * Returns the size of the encoded operations.
+	 */
+	int getCommandSize() {
+		return commands.position();
+	}
+
+	/**
+	 * Returns the string pool.
+	 */
+	ByteBuffer getPool() {
+		return pool;
+	}
+
+	/**
+	 * Returns the result slots.
+	 */
+	ByteBuffer getResults() {
+		return results;
+	}
+
+	/**
+	 * Returns the string results.
+	 */
+	Object[] getStrings() {
+		return strings;
+	}
+
+	// -- Private methods
+	/**
+	 * Allocates a direct buffer in native byte order.
+	 */
+	private static ByteBuffer allocate(int capacity) {
+		return ByteBuffer.allocateDirect(capacity).order(
+				ByteOrder.nativeOrder());
+	}
+
+	/**
+	 * Ensures space in the command buffer.
+	 */
+	private void ensureCommands(int size) {
+		commands = ensure(commands, size);
+	}
+
+	/**
+	 * Ensures space in a buffer, growing the buffer as needed.
+	 */
+	private static ByteBuffer ensure(ByteBuffer buffer, int size) {
+		if (buffer.remaining() >= size) {
+			return buffer;
+		}
+		ByteBuffer newBuffer = allocate(Math.max(buffer.capacity() * 2,
+				buffer.position() + size));
+		buffer.flip();
+		newBuffer.put(buffer);
+		return newBuffer;
+	}
+
+	/**
+	 * Puts an operation code.
+	 */
+	private void putOperation(int operation) {
+		putInt(operation);
+	}
+
+	/**
+	 * Puts an integer operand.
+	 */
+	private void putInt(int value) {
+		ensureCommands(4);
+		commands.putInt(value);
+	}
+
+	/**
+	 * Puts a string into the string pool and returns its offset.
+	 */
+	private int putString(String s) {
+		if (s == null) {
+			throw new NullPointerException();
+		}
+		Integer offset = poolOffsets.get(s);
+		if (offset == null) {
+			byte[] bytes;
+			try {
+				bytes = s.getBytes("UTF-8");
+			} catch (UnsupportedEncodingException e) {
+				throw new RuntimeException(e);
+			}
+			pool = ensure(pool, 4 + bytes.length + 1);
+			offset = Integer.valueOf(pool.position());
+			pool.putInt(bytes.length);
+			pool.put(bytes);
+			pool.put((byte) 0);
+			poolOffsets.put(s, offset);
+		}
+		return offset.intValue();
+	}
+
+	/**
+	 * Returns a result.
+	 */
+	private double getResult(int slot) {
+		checkSlot(slot);
+		return results.getDouble(slot * RESULT_SIZE);
+	}
+
+	/**
+	 * Checks a result slot.
+	 */
+	private void checkSlot(int slot) {
+		if (slot < 0 || slot >= resultCount) {
+			throw new IllegalArgumentException("illegal result slot");
+		}
+	}
+}
@@ -5,14 +5,20 @@
 
 package com.naef.jnlua;
 
+import java.util.ArrayList;
+import java.util.List;
+
 /**
  * Contains information about a Lua error condition. This object is created in
  * the native library.
  */
 class LuaError {
+	// -- Static
+	private static final LuaStackTraceElement[] EMPTY_LUA_STACK_TRACE = new LuaStackTraceElement[0];
+
 	// -- State
 	private String message;
-	private LuaStackTraceElement[] luaStackTrace;
+	private String luaStackTraceRecord;
 	private Throwable cause;
 
 	// -- Construction
@@ -36,7 +42,15 @@ class LuaError {
 	 * Returns the Lua stack trace.
 	 */
 	public LuaStackTraceElement[] getLuaStackTrace() {
-		return luaStackTrace;
+		return toLuaStackTrace(luaStackTraceRecord);
+	}
+
+	/**
+	 * Returns the Lua stack trace in the compact form captured by the native
+	 * library, or <code>null</code> if no Lua stack trace has been captured.
+	 */
+	public String getLuaStackTraceRecord() {
+		return luaStackTraceRecord;
 	}
 
 	/**
@@ -61,9 +75,44 @@ class LuaError {
 
 	// -- Package private methods
 	/**
-	 * Sets the Lua stack trace.
+	 * Sets the Lua stack trace in the compact form captured by the native
+	 * library. The method is invoked from the native library.
 	 */
-	void setLuaStackTrace(LuaStackTraceElement[] luaStackTrace) {
-		this.luaStackTrace = luaStackTrace;
+	void setLuaStackTrace(String luaStackTraceRecord) {
+		this.luaStackTraceRecord = luaStackTraceRecord;
+	}
+
+	/**
+	 * Converts a Lua stack trace from the compact form captured by the native
+	 * library into stack trace elements. Each frame consists of a flag
+	 * character, the function name, the source name and the line number,
+	 * separated by NUL characters. Bit 0 of the flag is set if there is a
+	 * function name, and bit 1 is set if there is a source name.
+	 */
+	static LuaStackTraceElement[] toLuaStackTrace(String luaStackTraceRecord) {
+		if (luaStackTraceRecord == null) {
+			return EMPTY_LUA_STACK_TRACE;
+		}
+		List<LuaStackTraceElement> luaStackTrace = new ArrayList<LuaStackTraceElement>();
+		int index = 0;
+		while (index < luaStackTraceRecord.length()) {
+			int flags = luaStackTraceRecord.charAt(index++) - '0';
+			int end = luaStackTraceRecord.indexOf('\0', index);
+			String functionName = (flags & 1) != 0 ? luaStackTraceRecord
+					.substring(index, end) : null;
+			index = end + 1;
+			end = luaStackTraceRecord.indexOf('\0', index);
+			String sourceName = (flags & 2) != 0 ? luaStackTraceRecord
+					.substring(index, end) : null;
+			index = end + 1;
+			end = luaStackTraceRecord.indexOf('\0', index);
+			int lineNumber = Integer.parseInt(luaStackTraceRecord.substring(
+					index, end));
+			index = end + 1;
+			luaStackTrace.add(new LuaStackTraceElement(functionName,
+					sourceName, lineNumber));
+		}
+		return luaStackTrace.toArray(new LuaStackTraceElement[luaStackTrace
+				.size()]);
 	}
 }
@@ -0,0 +1,34 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+/**
+ * Indicates that a Lua call has been stopped.
+ * 
+ * <p>
+ * This exception is thrown if a call exceeds its instruction limit or its
+ * timeout, or if it is interrupted by means of the
+ * {@link LuaState#interrupt()} method.
+ * </p>
+ * 
+ * @since JNLua 1.0.5
+ */
+public class LuaInterruptedException extends LuaRuntimeException {
+	// -- Static
+	private static final long serialVersionUID = 1L;
+
+	// -- Construction
+	/**
+	 * Creates a new instance. The instance is created with an empty Lua stack
+	 * trace.
+	 * 
+	 * @param msg
+	 *            the message
+	 */
+	public LuaInterruptedException(String msg) {
+		super(msg);
+	}
+}
@@ -0,0 +1,204 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+import java.lang.management.ManagementFactory;
+import java.lang.management.ThreadInfo;
+import java.lang.management.ThreadMXBean;
+import java.lang.ref.WeakReference;
+import java.util.Collections;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.TreeMap;
+
+/**
+ * Provides the metrics of a Lua state.
+ * 
+ * <p>
+ * The metrics are read without synchronizing on the Lua state, so they can be
+ * read while a call is running. Values read during a call may be slightly
+ * inconsistent with each other. If instrumentation is enabled, the metrics of
+ * each Lua state are published as a platform MBean named
+ * <code>com.naef.jnlua:type=LuaState,id=<i>n</i></code> while the Lua state
+ * is open.
+ * </p>
+ * 
+ * @see LuaState#getMetrics()
+ * @since JNLua 1.0.5
+ */
+public class LuaMetrics implements LuaMetricsMXBean {
+	// -- Static
+	private static final String[] NATIVE_NAMES = LuaState.getNativeNames();
+	private static final Map<String, Integer> NATIVE_INDEXES = new HashMap<String, Integer>();
+	static {
+		for (int i = 0; i < NATIVE_NAMES.length; i++) {
+			NATIVE_INDEXES.put(NATIVE_NAMES[i], Integer.valueOf(i));
+		}
+	}
+
+	// -- State
+	private WeakReference<LuaState> luaState;
+
+	// -- Construction
+	/**
+	 * Creates a new instance.
+	 */
+	LuaMetrics(LuaState luaState) {
+		this.luaState = new WeakReference<LuaState>(luaState);
+	}
+
+	// -- LuaMetricsMXBean methods
+	@Override
+	public boolean isOpen() {
+		LuaState luaState = this.luaState.get();
+		return luaState != null && luaState.getMemorySnapshot() != null;
+	}
+
+	@Override
+	public long getTotalCrossings() {
+		long[] metrics = getMetricsSnapshot();
+		long total = 0;
+		for (int i = 0; i < NATIVE_NAMES.length && i < metrics.length; i++) {
+			total += metrics[i];
+		}
+		return total;
+	}
+
+	@Override
+	public Map<String, Long> getCrossingCounts() {
+		return toMap(getMetricsSnapshot(), 0);
+	}
+
+	@Override
+	public Map<String, Long> getCrossingNanos() {
+		return toMap(getMetricsSnapshot(), NATIVE_NAMES.length);
+	}
+
+	@Override
+	public long[] getLatencyHistogram(String method) {
+		long[] metrics = getMetricsSnapshot();
+		Integer index = NATIVE_INDEXES.get(method);
+		if (index == null || metrics.length == 0) {
+			return new long[0];
+		}
+		int bucketCount = metrics.length / NATIVE_NAMES.length - 2;
+		long[] histogram = new long[bucketCount];
+		System.arraycopy(metrics, NATIVE_NAMES.length * 2 + index.intValue()
+				* bucketCount, histogram, 0, bucketCount);
+		return histogram;
+	}
+
+	@Override
+	public long getLatencyPercentile(String method, double percentile) {
+		if (percentile < 0.0 || percentile > 100.0) {
+			throw new IllegalArgumentException("illegal percentile");
+		}
+		long[] histogram = getLatencyHistogram(method);
+		long total = 0;
+		for (int i = 0; i < histogram.length; i++) {
+			total += histogram[i];
+		}
+		if (total == 0) {
+			return -1;
+		}
+		long rank = Math.max((long) Math.ceil(total * percentile / 100.0), 1);
+		long count = 0;
+		for (int i = 0; i < histogram.length - 1; i++) {
+			count += histogram[i];
+			if (count >= rank) {
+				return 1L << i;
+			}
+		}
+		return Long.MAX_VALUE;
+	}
+
+	@Override
+	public long getMemoryUsed() {
+		return getMemory(0);
+	}
+
+	@Override
+	public long getMemoryPeak() {
+		return getMemory(1);
+	}
+
+	@Override
+	public long getAllocationCount() {
+		return getMemory(2);
+	}
+
+	@Override
+	public long getMemoryLimit() {
+		return getMemory(3);
+	}
+
+	@Override
+	public long getGlobalRefCount() {
+		return getMemory(4);
+	}
+
+	@Override
+	public long getHandleCount() {
+		return getMemory(5);
+	}
+
+	@Override
+	public int getBlockedThreadCount() {
+		LuaState luaState = this.luaState.get();
+		if (luaState == null) {
+			return 0;
+		}
+		String lockName = luaState.getClass().getName() + '@'
+				+ Integer.toHexString(System.identityHashCode(luaState));
+		ThreadMXBean threadMXBean = ManagementFactory.getThreadMXBean();
+		ThreadInfo[] threadInfos = threadMXBean.getThreadInfo(threadMXBean
+				.getAllThreadIds());
+		int count = 0;
+		for (int i = 0; i < threadInfos.length; i++) {
+			if (threadInfos[i] != null
+					&& threadInfos[i].getThreadState() == Thread.State.BLOCKED
+					&& lockName.equals(threadInfos[i].getLockName())) {
+				count++;
+			}
+		}
+		return count;
+	}
+
+	// -- Private methods
+	/**
+	 * Returns a snapshot of the native metrics, or an empty array if there are
+	 * none.
+	 */
+	private long[] getMetricsSnapshot() {
+		LuaState luaState = this.luaState.get();
+		long[] metrics = luaState != null ? luaState.getMetricsSnapshot()
+				: null;
+		return metrics != null ? metrics : new long[0];
+	}
+
+	/**
+	 * Returns a memory metric.
+	 */
+	private long getMemory(int index) {
+		LuaState luaState = this.luaState.get();
+		long[] memory = luaState != null ? luaState.getMemorySnapshot() : null;
+		return memory != null ? memory[index] : 0;
+	}
+
+	/**
+	 * Returns the non-zero per-method values of the native metrics starting at
+	 * the specified offset as a map.
+	 */
+	private Map<String, Long> toMap(long[] metrics, int offset) {
+		Map<String, Long> map = new TreeMap<String, Long>();
+		for (int i = 0; i < NATIVE_NAMES.length && offset + i < metrics.length; i++) {
+			if (metrics[offset + i] != 0) {
+				map.put(NATIVE_NAMES[i], Long.valueOf(metrics[offset + i]));
+			}
+		}
+		return Collections.unmodifiableMap(map);
+	}
+}
@@ -0,0 +1,131 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+import java.util.Map;
+
+/**
+ * Management interface of the metrics of a Lua state.
+ * 
+ * <p>
+ * The crossing and latency metrics are collected for each native method of
+ * the Lua state if instrumentation is enabled by setting the system property
+ * <code>com.naef.jnlua.instrumentation</code> to <code>true</code>. The
+ * memory and contention metrics are always available.
+ * </p>
+ * 
+ * @see LuaMetrics
+ * @since JNLua 1.0.5
+ */
+public interface LuaMetricsMXBean {
+	/**
+	 * Returns whether the Lua state is open.
+	 * 
+	 * @return whether the Lua state is open
+	 */
+	public boolean isOpen();
+
+	/**
+	 * Returns the total number of native method crossings.
+	 * 
+	 * @return the number of crossings
+	 */
+	public long getTotalCrossings();
+
+	/**
+	 * Returns the number of crossings of each native method that has been
+	 * invoked.
+	 * 
+	 * @return the crossing counts, keyed by native method name
+	 */
+	public Map<String, Long> getCrossingCounts();
+
+	/**
+	 * Returns the total latency in nanoseconds of each native method that has
+	 * been invoked.
+	 * 
+	 * @return the total latencies, keyed by native method name
+	 */
+	public Map<String, Long> getCrossingNanos();
+
+	/**
+	 * Returns the latency histogram of a native method. Bucket
+	 * <code>i</code> counts the crossings with a latency below
+	 * <code>2^i</code> nanoseconds and not below <code>2^(i-1)</code>
+	 * nanoseconds; the last bucket also counts all longer crossings.
+	 * 
+	 * @param method
+	 *            the native method name
+	 * @return the latency histogram, or an empty array if the method is
+	 *         unknown or instrumentation is disabled
+	 */
+	public long[] getLatencyHistogram(String method);
+
+	/**
+	 * Returns an upper bound of the specified latency percentile of a native
+	 * method in nanoseconds.
+	 * 
+	 * @param method
+	 *            the native method name
+	 * @param percentile
+	 *            the percentile, between <code>0</code> and <code>100</code>
+	 * @return the latency percentile, or <code>-1</code> if the method has not
+	 *         been invoked
+	 */
+	public long getLatencyPercentile(String method, double percentile);
+
+	/**
+	 * Returns the number of bytes currently allocated by the Lua state.
+	 * 
+	 * @return the number of bytes allocated
+	 */
+	public long getMemoryUsed();
+
+	/**
+	 * Returns the largest number of bytes allocated by the Lua state.
+	 * 
+	 * @return the peak number of bytes allocated
+	 */
+	public long getMemoryPeak();
+
+	/**
+	 * Returns the number of allocations performed by the Lua state.
+	 * 
+	 * @return the number of allocations
+	 */
+	public long getAllocationCount();
+
+	/**
+	 * Returns the memory limit of the Lua state in bytes.
+	 * 
+	 * @return the memory limit, or <code>0</code> if no limit is set
+	 */
+	public long getMemoryLimit();
+
+	/**
+	 * Returns the number of JNI global references held by the Java objects
+	 * pushed into the Lua state.
+	 * 
+	 * @return the number of global references
+	 */
+	public long getGlobalRefCount();
+
+	/**
+	 * Returns the number of Java objects referenced by the handle table of
+	 * the Lua state.
+	 * 
+	 * @return the number of handles
+	 */
+	public long getHandleCount();
+
+	/**
+	 * Returns the number of threads blocked waiting to enter the monitor of
+	 * the Lua state.
+	 * 
+	 * @return the number of blocked threads
+	 */
+	public int getBlockedThreadCount();
+}
@@ -0,0 +1,113 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+import java.io.IOException;
+import java.io.Writer;
+import java.util.Collections;
+import java.util.Map;
+import java.util.TreeMap;
+
+/**
+ * Collects the samples of the Lua sampling profiler as folded stacks.
+ * 
+ * <p>
+ * A folded stack lists the frames of a sample from the outermost frame to the
+ * innermost frame, separated by semicolons. Each frame has the form
+ * <code>name (source:line)</code>. The output of the
+ * {@link #writeFolded(Writer)} method can be processed by flame graph tools.
+ * </p>
+ * 
+ * @see LuaState#startProfiler(int)
+ * @see LuaState#drainProfiler(LuaProfile)
+ * @since JNLua 1.0.5
+ */
+public class LuaProfile {
+	// -- State
+	private Map<String, Long> stacks = new TreeMap<String, Long>();
+	private long sampleCount;
+	private long droppedCount;
+
+	// -- Properties
+	/**
+	 * Returns the folded stacks and their sample counts.
+	 * 
+	 * @return the folded stacks
+	 */
+	public Map<String, Long> getStacks() {
+		return Collections.unmodifiableMap(stacks);
+	}
+
+	/**
+	 * Returns the number of samples collected.
+	 * 
+	 * @return the number of samples
+	 */
+	public long getSampleCount() {
+		return sampleCount;
+	}
+
+	/**
+	 * Returns the number of samples dropped because the sample buffer of the
+	 * Lua state was full.
+	 * 
+	 * @return the number of dropped samples
+	 */
+	public long getDroppedCount() {
+		return droppedCount;
+	}
+
+	// -- Operations
+	/**
+	 * Adds samples of a folded stack.
+	 * 
+	 * @param stack
+	 *            the folded stack
+	 * @param count
+	 *            the number of samples
+	 */
+	public void add(String stack, long count) {
+		Long previous = stacks.get(stack);
+		stacks.put(stack, previous != null ? previous + count : count);
+		sampleCount += count;
+	}
+
+	/**
+	 * Clears this profile.
+	 */
+	public void clear() {
+		stacks.clear();
+		sampleCount = 0;
+		droppedCount = 0;
+	}
+
+	/**
+	 * Writes the folded stacks of this profile, one stack and its sample count
+	 * per line.
+	 * 
+	 * @param writer
+	 *            the writer
+	 * @throws IOException
+	 *             if an IO error occurs
+	 */
+	public void writeFolded(Writer writer) throws IOException {
+		for (Map.Entry<String, Long> entry : stacks.entrySet()) {
+			writer.write(entry.getKey());
+			writer.write(' ');
+			writer.write(entry.getValue().toString());
+			writer.write('\n');
+		}
+		writer.flush();
+	}
+
+	// -- Package private methods
+	/**
+	 * Adds dropped samples.
+	 */
+	void addDropped(long count) {
+		droppedCount += count;
+	}
+}
@@ -24,6 +24,7 @@ public class LuaRuntimeException extends LuaException {
 
 	// -- State
 	private LuaStackTraceElement[] luaStackTrace;
+	private String luaStackTraceRecord;
 
 	// -- Construction
 	/**
@@ -69,7 +70,7 @@ public class LuaRuntimeException extends LuaException {
 	 * Returns the Lua stack trace of this runtime exception.
 	 */
 	public LuaStackTraceElement[] getLuaStackTrace() {
-		return luaStackTrace.clone();
+		return luaStackTrace().clone();
 	}
 
 	// -- Operations
@@ -89,6 +90,7 @@ public class LuaRuntimeException extends LuaException {
 	 *            the print stream
 	 */
 	public void printLuaStackTrace(PrintStream s) {
+		LuaStackTraceElement[] luaStackTrace = luaStackTrace();
 		synchronized (s) {
 			s.println(this);
 			for (int i = 0; i < luaStackTrace.length; i++) {
@@ -105,6 +107,7 @@ public class LuaRuntimeException extends LuaException {
 	 *            the print writer
 	 */
 	public void printLuaStackTrace(PrintWriter s) {
+		LuaStackTraceElement[] luaStackTrace = luaStackTrace();
 		synchronized (s) {
 			s.println(this);
 			for (int i = 0; i < luaStackTrace.length; i++) {
@@ -120,6 +123,21 @@ public class LuaRuntimeException extends LuaException {
 	 */
 	void setLuaError(LuaError luaError) {
 		initCause(luaError.getCause());
-		luaStackTrace = luaError.getLuaStackTrace();
+		luaStackTraceRecord = luaError.getLuaStackTraceRecord();
+		luaStackTrace = luaStackTraceRecord == null ? EMPTY_LUA_STACK_TRACE
+				: null;
+	}
+
+	// -- Private methods
+	/**
+	 * Returns the Lua stack trace of this runtime exception, converting it from
+	 * the compact form captured by the native library on first use.
+	 */
+	private synchronized LuaStackTraceElement[] luaStackTrace() {
+		if (luaStackTrace == null) {
+			luaStackTrace = LuaError.toLuaStackTrace(luaStackTraceRecord);
+			luaStackTraceRecord = null;
+		}
+		return luaStackTrace;
 	}
 }
@@ -0,0 +1,258 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+import java.util.ArrayList;
+import java.util.HashSet;
+import java.util.Set;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.CompletionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.RejectedExecutionException;
+
+/**
+ * Runs Lua functions as coroutines that are suspended while Java functions
+ * wait for asynchronous operations.
+ *
+ * <p>
+ * The scheduler accesses its Lua state exclusively from a single event loop
+ * thread. The Lua state must not be used by other threads while the scheduler
+ * is open. A Java function called by a scheduled coroutine suspends the
+ * coroutine until a <code>CompletableFuture</code> completes by returning
+ * <code>scheduler.await(luaState, future)</code>. When the future completes,
+ * the coroutine is resumed on the event loop thread and the Java function
+ * returns the value of the future, or raises a Lua error with the exception
+ * of the future as its cause. A coroutine yielding by other means, such as
+ * <code>coroutine.yield</code>, is resumed after the other pending work of the
+ * event loop.
+ * </p>
+ *
+ * @since JNLua 1.0.5
+ */
+public class LuaScheduler {
+	// -- Static
+	private static final Object[] NO_ARGS = new Object[0];
+
+	// -- State
+	private final LuaState luaState;
+	private final ExecutorService eventLoop;
+	private final Set<Task> tasks = new HashSet<Task>();
+	private volatile int taskCount;
+	private Task current;
+
+	// -- Construction
+	/**
+	 * Creates a new instance that schedules coroutines on the specified Lua
+	 * state.
+	 *
+	 * @param luaState
+	 *            the Lua state
+	 */
+	public LuaScheduler(LuaState luaState) {
+		this.luaState = luaState;
+		eventLoop = Executors.newSingleThreadExecutor(runnable -> {
+			Thread thread = new Thread(runnable, "JNLua scheduler");
+			thread.setDaemon(true);
+			return thread;
+		});
+	}
+
+	// -- Properties
+	/**
+	 * Returns the Lua state of this scheduler.
+	 *
+	 * @return the Lua state
+	 */
+	public LuaState getLuaState() {
+		return luaState;
+	}
+
+	/**
+	 * Returns the number of coroutines that have been started and have not
+	 * finished.
+	 *
+	 * @return the number of coroutines
+	 */
+	public int getTaskCount() {
+		return taskCount;
+	}
+
+	// -- Operations
+	/**
+	 * Calls the global Lua function with the specified name in a new coroutine.
+	 * The arguments are pushed as Java objects. The returned future completes
+	 * with the return values of the function converted to Java objects, or
+	 * exceptionally with the Lua runtime exception raised by the function.
+	 *
+	 * @param name
+	 *            the name of the global function
+	 * @param args
+	 *            the arguments
+	 * @return the future return values
+	 * @throws RejectedExecutionException
+	 *             if the scheduler is closed
+	 */
+	public CompletableFuture<Object[]> submit(final String name,
+			final Object... args) {
+		final Task task = new Task();
+		eventLoop.execute(() -> start(task, name, args));
+		return task.result;
+	}
+
+	/**
+	 * Suspends the running coroutine until the specified future completes. The
+	 * method must be used exclusively at the exit point of Java functions
+	 * called by scheduled coroutines, i.e.
+	 * <code>return scheduler.await(luaState, future)</code>.
+	 *
+	 * @param luaState
+	 *            the Lua state passed to the Java function
+	 * @param future
+	 *            the future
+	 * @return the return value of the Java function
+	 * @throws IllegalStateException
+	 *             if no scheduled coroutine is running
+	 */
+	public int await(LuaState luaState, CompletableFuture<?> future) {
+		final Task task = current;
+		if (task == null || luaState != this.luaState) {
+			throw new IllegalStateException("no scheduled coroutine");
+		}
+		task.awaiting = true;
+		future.whenComplete((value, exception) -> {
+			try {
+				eventLoop.execute(() -> {
+					task.value = value;
+					task.exception = exception;
+					resume(task, NO_ARGS);
+				});
+			} catch (RejectedExecutionException e) {
+				task.result.completeExceptionally(e);
+			}
+		});
+		return luaState.yield(0, task.continuation);
+	}
+
+	/**
+	 * Closes this scheduler. The futures of coroutines that have not finished
+	 * complete exceptionally, and the coroutines are released. The Lua state
+	 * is not closed.
+	 */
+	public void close() {
+		try {
+			eventLoop.execute(() -> {
+				for (Task task : new ArrayList<Task>(tasks)) {
+					finish(task);
+					task.result.completeExceptionally(new IllegalStateException(
+							"scheduler closed"));
+				}
+			});
+		} catch (RejectedExecutionException e) {
+			return;
+		}
+		eventLoop.shutdown();
+	}
+
+	// -- Private methods
+	/**
+	 * Starts a task.
+	 */
+	private void start(Task task, String name, Object[] args) {
+		try {
+			luaState.getGlobal(name);
+			luaState.newThread();
+			task.thread = luaState.ref(LuaState.REGISTRYINDEX);
+		} catch (RuntimeException e) {
+			task.result.completeExceptionally(e);
+			return;
+		}
+		tasks.add(task);
+		taskCount = tasks.size();
+		resume(task, args);
+	}
+
+	/**
+	 * Resumes the coroutine of a task.
+	 */
+	private void resume(final Task task, Object[] args) {
+		if (!tasks.contains(task)) {
+			return;
+		}
+		int top = luaState.getTop();
+		current = task;
+		task.awaiting = false;
+		try {
+			luaState.rawGet(LuaState.REGISTRYINDEX, task.thread);
+			for (int i = 0; i < args.length; i++) {
+				luaState.pushJavaObject(args[i]);
+			}
+			int count = luaState.resume(top + 1, args.length);
+			if (luaState.status(top + 1) == LuaState.YIELD) {
+				if (!task.awaiting) {
+					eventLoop.execute(() -> resume(task, NO_ARGS));
+				}
+				return;
+			}
+			Object[] results = new Object[count];
+			for (int i = 0; i < count; i++) {
+				results[i] = luaState.toJavaObject(top + 2 + i, Object.class);
+			}
+			finish(task);
+			task.result.complete(results);
+		} catch (RuntimeException e) {
+			finish(task);
+			task.result.completeExceptionally(e);
+		} finally {
+			current = null;
+			luaState.setTop(top);
+		}
+	}
+
+	/**
+	 * Finishes a task.
+	 */
+	private void finish(Task task) {
+		luaState.unref(LuaState.REGISTRYINDEX, task.thread);
+		tasks.remove(task);
+		taskCount = tasks.size();
+	}
+
+	// -- Nested types
+	/**
+	 * A scheduled coroutine.
+	 */
+	private static class Task {
+		// -- State
+		private final CompletableFuture<Object[]> result = new CompletableFuture<Object[]>();
+		private int thread;
+		private boolean awaiting;
+		private Object value;
+		private Throwable exception;
+
+		/**
+		 * Continues the awaiting Java function with the outcome of the future.
+		 */
+		private final JavaFunction continuation = new JavaFunction() {
+			@Override
+			public int invoke(LuaState luaState) {
+				Object value = Task.this.value;
+				Throwable exception = Task.this.exception;
+				Task.this.value = null;
+				Task.this.exception = null;
+				if (exception != null) {
+					if (exception instanceof CompletionException
+							&& exception.getCause() != null) {
+						exception = exception.getCause();
+					}
+					throw new LuaRuntimeException(exception);
+				}
+				luaState.pushJavaObject(value);
+				return 1;
+			}
+		};
+	}
+}
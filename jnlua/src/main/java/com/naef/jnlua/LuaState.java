@@ -5,17 +5,29 @@
 
 package com.naef.jnlua;
 
-import java.io.ByteArrayInputStream;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.lang.management.ManagementFactory;
 import java.lang.ref.PhantomReference;
 import java.lang.ref.ReferenceQueue;
 import java.lang.reflect.InvocationHandler;
 import java.lang.reflect.Method;
 import java.lang.reflect.Proxy;
+import java.nio.ByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.file.Path;
+import java.nio.file.StandardOpenOption;
+import java.util.ArrayList;
 import java.util.HashSet;
+import java.util.IdentityHashMap;
+import java.util.List;
+import java.util.Map;
 import java.util.Set;
+import java.util.concurrent.atomic.AtomicLong;
+
+import javax.management.JMException;
+import javax.management.ObjectName;
 
 import com.naef.jnlua.JavaReflector.Metamethod;
 
@@ -68,8 +80,8 @@ import com.naef.jnlua.JavaReflector.Metamethod;
  * </tr>
  * <tr>
  * <td>{@link com.naef.jnlua.LuaMemoryAllocationException}</td>
- * <td>if the Lua memory allocator runs out of memory or if a JNI allocation
- * fails</td>
+ * <td>if the Lua memory allocator runs out of memory, if an allocation would
+ * exceed the memory limit of the Lua state, or if a JNI allocation fails</td>
  * </tr>
  * <tr>
  * <td>{@link com.naef.jnlua.LuaGcMetamethodException}</td>
@@ -80,6 +92,10 @@ import com.naef.jnlua.JavaReflector.Metamethod;
  * <td>{@link com.naef.jnlua.LuaMessageHandlerException}</td>
  * <td>if an error occurs running the message handler of a protected call</td>
  * </tr>
+ * <tr>
+ * <td>{@link com.naef.jnlua.LuaInterruptedException}</td>
+ * <td>if a call exceeds its execution budget or is interrupted</td>
+ * </tr>
  * </table>
  */
 public class LuaState {
@@ -120,6 +136,15 @@ public class LuaState {
 	 */
 	public static final int RIDX_GLOBALS = 2;
 
+	/**
+	 * Flag of the type codes filled in by
+	 * {@link #describeStack(int, int, int[], Object[])} indicating a Java
+	 * function or a Java object.
+	 * 
+	 * @since JNLua 1.0.5
+	 */
+	public static final int DESCRIBE_JAVA = 0x100;
+
 	/**
 	 * The JNLua version. The format is &lt;major&gt;.&lt;minor&gt;.
 	 */
@@ -130,16 +155,59 @@ public class LuaState {
 	 */
 	public static final String LUA_VERSION;
 
+	/**
+	 * Whether native method instrumentation is enabled. Instrumentation is
+	 * enabled by setting the system property
+	 * <code>com.naef.jnlua.instrumentation</code> to <code>true</code>.
+	 * 
+	 * @since JNLua 1.0.5
+	 */
+	public static final boolean INSTRUMENTED = Boolean
+			.getBoolean("com.naef.jnlua.instrumentation");
+
 	static {
 		NativeSupport.getInstance().getLoader().load();
 		REGISTRYINDEX = lua_registryindex();
 		LUA_VERSION = lua_version();
+		if (INSTRUMENTED) {
+			lua_instrument();
+		}
 	}
 
 	/**
 	 * The API version.
 	 */
-	private static final int APIVERSION = 3;
+	private static final int APIVERSION = 4;
+
+	/**
+	 * Array types for the array transfer methods.
+	 */
+	private static final int DOUBLE_ARRAY = 0;
+	private static final int INT_ARRAY = 1;
+	private static final int LONG_ARRAY = 2;
+	private static final int BOOLEAN_ARRAY = 3;
+	private static final int STRING_ARRAY = 4;
+
+	/**
+	 * Memory statistics.
+	 */
+	private static final int MEMORY_USED = 0;
+	private static final int MEMORY_PEAK = 1;
+	private static final int MEMORY_ALLOCATIONS = 2;
+	private static final int MEMORY_LIMIT = 3;
+	private static final int MEMORY_GLOBALREFS = 4;
+	private static final int MEMORY_HANDLES = 5;
+
+	/**
+	 * Mask selecting the invocations of a thread-confined Lua state that poll
+	 * the proxy queue.
+	 */
+	private static final int PROXY_POLL_MASK = 0xff;
+
+	/**
+	 * Sequence for the MBean names of instrumented Lua states.
+	 */
+	private static final AtomicLong METRICS_SEQUENCE = new AtomicLong();
 
 	// -- State
 	/**
@@ -158,16 +226,11 @@ public class LuaState {
 	/**
 	 * The <code>lua_State</code> pointer on the JNI side for the running
 	 * coroutine. This field is modified exclusively on the JNI side and must
-	 * not be touched on the Java side.
+	 * not be modified on the Java side. It is passed to the static native
+	 * methods, sparing them a field access on each call.
 	 */
 	private long luaThread;
 
-	/**
-	 * The yield flag. This field is modified from both the JNI side and Java
-	 * side and signals a pending yield.
-	 */
-	private boolean yield;
-
 	/**
 	 * Ensures proper finalization of this Lua state.
 	 */
@@ -188,6 +251,35 @@ public class LuaState {
 	 */
 	private Converter converter;
 
+	/**
+	 * Whether Lua stack traces are captured for Lua runtime errors.
+	 */
+	private boolean luaStackTraceCapture = true;
+
+	/**
+	 * Whether Java exceptions thrown by Java functions are parked.
+	 */
+	private boolean lightweightJavaErrors;
+
+	/**
+	 * The Java exception thrown by a Java function and parked for lightweight
+	 * error handling, or <code>null</code>. This field is modified exclusively
+	 * on the JNI side and must not be modified on the Java side.
+	 */
+	private Throwable pendingThrowable;
+
+	/**
+	 * The thread this Lua state is confined to, or <code>null</code> if this
+	 * Lua state is not thread-confined.
+	 */
+	private volatile Thread ownerThread;
+
+	/**
+	 * Counts the unsynchronized invocations of this Lua state in
+	 * thread-confined mode.
+	 */
+	private int confinedCount;
+
 	/**
 	 * Set of Lua proxy phantom references for pre-mortem cleanup.
 	 */
@@ -198,6 +290,34 @@ public class LuaState {
 	 */
 	private ReferenceQueue<LuaValueProxyImpl> proxyQueue = new ReferenceQueue<LuaValueProxyImpl>();
 
+	/**
+	 * Byte buffers viewing Lua strings, and the registry references keeping
+	 * the strings alive.
+	 */
+	private Map<ByteBuffer, Integer> byteBuffers = new IdentityHashMap<ByteBuffer, Integer>();
+
+	/**
+	 * Guards the <code>lua_State</code> pointer against closing while it is
+	 * accessed from another thread without synchronizing on this Lua state.
+	 */
+	private final Object asyncLock = new Object();
+
+	/**
+	 * Frame labels of the profiler, indexed by frame identifier.
+	 */
+	private List<String> profilerFrames = new ArrayList<String>();
+
+	/**
+	 * The metrics of this Lua state.
+	 */
+	private LuaMetrics metrics = new LuaMetrics(this);
+
+	/**
+	 * The MBean name of the metrics, or <code>null</code> if the metrics are
+	 * not published.
+	 */
+	private ObjectName metricsName;
+
 	// -- Construction
 	/**
 	 * Creates a new instance. The class loader of this Lua state is set to the
@@ -212,15 +332,48 @@ public class LuaState {
 	 * @see #setConverter(Converter)
 	 */
 	public LuaState() {
-		this(0L);
+		this(0L, Allocator.SYSTEM, ObjectReferences.GLOBAL);
+	}
+
+	/**
+	 * Creates a new instance that allocates memory with the specified
+	 * allocator. The class loader of this Lua state is set to the context
+	 * class loader of the calling thread. The Java reflector and the converter
+	 * are initialized with the default implementations.
+	 * 
+	 * @param allocator
+	 *            the memory allocator
+	 * @since JNLua 1.0.5
+	 */
+	public LuaState(Allocator allocator) {
+		this(0L, allocator, ObjectReferences.GLOBAL);
+	}
+
+	/**
+	 * Creates a new instance that allocates memory with the specified
+	 * allocator and references Java objects as specified. The class loader of
+	 * this Lua state is set to the context class loader of the calling thread.
+	 * The Java reflector and the converter are initialized with the default
+	 * implementations.
+	 * 
+	 * @param allocator
+	 *            the memory allocator
+	 * @param objectReferences
+	 *            how Lua references Java objects
+	 * @since JNLua 1.0.5
+	 */
+	public LuaState(Allocator allocator, ObjectReferences objectReferences) {
+		this(0L, allocator, objectReferences);
 	}
 
 	/**
 	 * Creates a new instance.
 	 */
-	private LuaState(long luaState) {
+	private LuaState(long luaState, Allocator allocator,
+			ObjectReferences objectReferences) {
 		ownState = luaState == 0L;
-		lua_newstate(APIVERSION, luaState);
+		lua_newstate(APIVERSION, luaState, allocator.ordinal(),
+				objectReferences.ordinal());
 		check();
 
 		// Create a finalize guardian
@@ -237,7 +390,7 @@ public class LuaState {
 		for (int i = 0; i < JavaReflector.Metamethod.values().length; i++) {
 			final JavaReflector.Metamethod metamethod = JavaReflector.Metamethod
 					.values()[i];
-			lua_pushjavafunction(new JavaFunction() {
+			lua_pushjavafunction(luaThread, new JavaFunction() {
 				@Override
 				public int invoke(LuaState luaState) {
 					JavaFunction javaFunction = getMetamethod(
@@ -250,14 +403,28 @@ public class LuaState {
 					}
 				}
 			});
-			lua_setfield(-2, metamethod.getMetamethodName());
+			lua_setfield(luaThread, -2, metamethod.getMetamethodName());
 		}
-		lua_pop(1);
+		lua_pop(luaThread, 1);
 
 		// Set fields
 		classLoader = Thread.currentThread().getContextClassLoader();
 		javaReflector = DefaultJavaReflector.getInstance();
 		converter = DefaultConverter.getInstance();
+
+		// Publish metrics
+		if (INSTRUMENTED) {
+			try {
+				ObjectName name = new ObjectName(
+						"com.naef.jnlua:type=LuaState,id="
+								+ METRICS_SEQUENCE.incrementAndGet());
+				ManagementFactory.getPlatformMBeanServer().registerMBean(
+						metrics, name);
+				metricsName = name;
+			} catch (JMException e) {
+				// Metrics remain available from getMetrics()
+			}
+		}
 	}
 
 	// -- Properties
@@ -381,6 +548,128 @@ public class LuaState {
 		this.converter = converter;
 	}
 
+	/**
+	 * Returns whether this Lua state captures Lua stack traces for Lua runtime
+	 * errors.
+	 * 
+	 * @return whether Lua stack traces are captured
+	 * @see #setLuaStackTraceCapture(boolean)
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized boolean isLuaStackTraceCapture() {
+		return luaStackTraceCapture;
+	}
+
+	/**
+	 * Sets whether this Lua state captures Lua stack traces for Lua runtime
+	 * errors. The default is <code>true</code>.
+	 * 
+	 * <p>
+	 * A captured Lua stack trace is kept in a compact form and is converted
+	 * into stack trace elements only when
+	 * {@link LuaRuntimeException#getLuaStackTrace()} is invoked. If Lua stack
+	 * traces are not captured, Lua runtime exceptions have an empty Lua stack
+	 * trace. Scripts raising many errors that are caught and ignored may
+	 * benefit from not capturing Lua stack traces.
+	 * </p>
+	 * 
+	 * @param luaStackTraceCapture
+	 *            whether to capture Lua stack traces
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void setLuaStackTraceCapture(
+			boolean luaStackTraceCapture) {
+		check();
+		lua_setstacktrace(luaThread, luaStackTraceCapture ? 1 : 0);
+		this.luaStackTraceCapture = luaStackTraceCapture;
+	}
+
+	/**
+	 * Returns whether this Lua state handles Java exceptions thrown by Java
+	 * functions as lightweight errors.
+	 * 
+	 * @return whether lightweight Java errors are enabled
+	 * @see #setLightweightJavaErrors(boolean)
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized boolean isLightweightJavaErrors() {
+		return lightweightJavaErrors;
+	}
+
+	/**
+	 * Sets whether this Lua state handles Java exceptions thrown by Java
+	 * functions as lightweight errors. The default is <code>false</code>.
+	 * 
+	 * <p>
+	 * With lightweight errors, a Java exception thrown by a Java function is
+	 * parked in this Lua state and the Lua error is a small value
+	 * representing the parked exception. The Lua error object carrying the
+	 * Java exception is created only when the error reaches Java or is
+	 * converted to a string in Lua. This makes Java exceptions that are caught
+	 * in Lua with <code>pcall</code> considerably cheaper.
+	 * </p>
+	 * 
+	 * <p>
+	 * Only one Java exception is parked at a time. When a further exception is
+	 * parked, or the Lua error object is created, the parked exception is
+	 * moved into its error value, so a caught error value remains valid. The
+	 * parked exception is released when its error value is collected. The
+	 * error value is not a Java object.
+	 * </p>
+	 * 
+	 * @param lightweightJavaErrors
+	 *            whether to enable lightweight Java errors
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void setLightweightJavaErrors(
+			boolean lightweightJavaErrors) {
+		check();
+		lua_setlightweighterrors(luaThread, lightweightJavaErrors ? 1 : 0);
+		this.lightweightJavaErrors = lightweightJavaErrors;
+	}
+
+	/**
+	 * Returns the thread this Lua state is confined to.
+	 * 
+	 * @return the owner thread, or <code>null</code> if this Lua state is not
+	 *         thread-confined
+	 * @see #setOwnerThread(Thread)
+	 * @since JNLua 1.0.5
+	 */
+	public Thread getOwnerThread() {
+		return ownerThread;
+	}
+
+	/**
+	 * Confines this Lua state to the specified thread, or hands a confined
+	 * Lua state off to another thread. Passing <code>null</code> ends the
+	 * confinement. The default is no confinement.
+	 * 
+	 * <p>
+	 * While this Lua state is thread-confined, its methods throw an
+	 * <code>IllegalStateException</code> if they are invoked by a thread
+	 * other than the owner thread. The stack, table, global and call methods
+	 * most frequently used by Java functions then neither synchronize on this
+	 * Lua state nor poll the queue of unreachable Lua value proxies on each
+	 * invocation. Unreachable proxies are released periodically instead. The
+	 * other methods remain synchronized.
+	 * </p>
+	 * 
+	 * <p>
+	 * A thread-confined Lua state can only be handed off by its owner thread.
+	 * The previous owner must not use this Lua state after the handoff. The
+	 * handoff itself publishes the state of this Lua state to the new owner.
+	 * </p>
+	 * 
+	 * @param ownerThread
+	 *            the owner thread, or <code>null</code>
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void setOwnerThread(Thread ownerThread) {
+		check();
+		this.ownerThread = ownerThread;
+	}
+
 	// -- Life cycle
 	/**
 	 * Returns whether this Lua state is open.
@@ -400,10 +689,15 @@ public class LuaState {
 	 * 
 	 * <p>
 	 * The method may be invoked on a closed Lua state and has no effect in that
-	 * case.
+	 * case. A thread-confined Lua state can only be closed by its owner
+	 * thread.
 	 * </p>
 	 */
 	public synchronized void close() {
+		Thread owner = ownerThread;
+		if (owner != null && owner != Thread.currentThread()) {
+			throw new IllegalStateException("Lua state is confined to " + owner);
+		}
 		closeInternal();
 	}
 
@@ -419,7 +713,104 @@ public class LuaState {
 	 */
 	public synchronized int gc(GcAction what, int data) {
 		check();
-		return lua_gc(what.ordinal(), data);
+		return lua_gc(luaThread, what.ordinal(), data);
+	}
+
+	/**
+	 * Returns the number of bytes currently allocated by this Lua state. The
+	 * value is read without running Lua code and is therefore cheap to poll.
+	 * 
+	 * @return the number of bytes allocated
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long getMemoryUsed() {
+		check();
+		return lua_memory(luaThread, MEMORY_USED);
+	}
+
+	/**
+	 * Returns the largest number of bytes allocated by this Lua state at any
+	 * time.
+	 * 
+	 * @return the peak number of bytes allocated
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long getMemoryPeak() {
+		check();
+		return lua_memory(luaThread, MEMORY_PEAK);
+	}
+
+	/**
+	 * Returns the number of allocations performed by this Lua state, including
+	 * reallocations.
+	 * 
+	 * @return the number of allocations
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long getAllocationCount() {
+		check();
+		return lua_memory(luaThread, MEMORY_ALLOCATIONS);
+	}
+
+	/**
+	 * Returns the memory limit of this Lua state in bytes, or <code>0</code>
+	 * if no limit is set.
+	 * 
+	 * @return the memory limit
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long getMemoryLimit() {
+		check();
+		return lua_memory(luaThread, MEMORY_LIMIT);
+	}
+
+	/**
+	 * Returns the number of JNI global references held by the Java objects
+	 * pushed into this Lua state. Each distinct Java object holds one global
+	 * reference until its userdata is collected.
+	 * 
+	 * @return the number of global references
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long getGlobalRefCount() {
+		check();
+		return lua_memory(luaThread, MEMORY_GLOBALREFS);
+	}
+
+	/**
+	 * Returns the number of Java objects referenced by the handle table of
+	 * this Lua state, or <code>0</code> if this Lua state references Java
+	 * objects with global references.
+	 * 
+	 * @return the number of handles
+	 * @see ObjectReferences#HANDLE_TABLE
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long getHandleCount() {
+		check();
+		return lua_memory(luaThread, MEMORY_HANDLES);
+	}
+
+	/**
+	 * Sets the memory limit of this Lua state in bytes. An allocation that
+	 * would make the allocated memory exceed the limit fails, and the
+	 * operation causing it throws a {@link LuaMemoryAllocationException}.
+	 * Memory can always be released, so a limit below the current memory
+	 * usage only prevents further growth. A limit of <code>0</code> removes
+	 * the limit.
+	 * 
+	 * <p>
+	 * While a limit is set, operations otherwise performed without a
+	 * protected call run protected.
+	 * </p>
+	 * 
+	 * @param limit
+	 *            the memory limit, or <code>0</code> for no limit
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void setMemoryLimit(long limit) {
+		check();
+		lua_setmemorylimit(luaThread, limit);
 	}
 
 	// -- Registration
@@ -498,7 +889,7 @@ public class LuaState {
 			pushJavaFunction(namedJavaFunctions[i]);
 			setField(-2, name);
 		}
-		lua_getsubtable(REGISTRYINDEX, "_LOADED");
+		lua_getsubtable(luaThread, REGISTRYINDEX, "_LOADED");
 		pushValue(-2);
 		setField(-2, moduleName);
 		pop(1);
@@ -529,7 +920,7 @@ public class LuaState {
 	public synchronized void load(InputStream inputStream, String chunkName,
 			String mode) throws IOException {
 		check();
-		lua_load(inputStream, chunkName, mode);
+		lua_load(luaThread, inputStream, chunkName, mode);
 	}
 
 	/**
@@ -544,13 +935,94 @@ public class LuaState {
 	public synchronized void load(String chunk, String chunkName) {
 		check();
 		try {
-			load(new ByteArrayInputStream(chunk.getBytes("UTF-8")), chunkName,
-					"t");
+			load(chunk.getBytes("UTF-8"), chunkName, "t");
 		} catch (IOException e) {
 			throw new LuaMemoryAllocationException(e.getMessage(), e);
 		}
 	}
 
+	/**
+	 * Loads a Lua chunk from a byte array and pushes it on the stack as a
+	 * function. Depending on the value of mode, the Lua chunk can either be a
+	 * pre-compiled binary chunk or a UTF-8 encoded text chunk. The chunk is
+	 * passed to Lua as a single piece.
+	 * 
+	 * @param b
+	 *            the byte array containing the chunk
+	 * @param chunkName
+	 *            the name of the chunk for use in error messages
+	 * @param mode
+	 *            <code>"b"</code> to accept binary, <code>"t"</code> to accept
+	 *            text, or <code>"bt"</code> to accept both
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void load(byte[] b, String chunkName, String mode) {
+		check();
+		lua_loadbytearray(luaThread, b, 0, b.length, chunkName, mode);
+	}
+
+	/**
+	 * Loads a Lua chunk from the remaining bytes of a byte buffer and pushes
+	 * it on the stack as a function. Depending on the value of mode, the Lua
+	 * chunk can either be a pre-compiled binary chunk or a UTF-8 encoded
+	 * text chunk. The position of the buffer is not changed. The chunk is
+	 * passed to Lua as a single piece; the memory of a direct buffer is read
+	 * without an intermediate copy.
+	 * 
+	 * @param buffer
+	 *            the byte buffer containing the chunk
+	 * @param chunkName
+	 *            the name of the chunk for use in error messages
+	 * @param mode
+	 *            <code>"b"</code> to accept binary, <code>"t"</code> to accept
+	 *            text, or <code>"bt"</code> to accept both
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void load(ByteBuffer buffer, String chunkName,
+			String mode) {
+		check();
+		if (buffer.isDirect()) {
+			lua_loadbuffer(luaThread, buffer, buffer.position(),
+					buffer.remaining(), chunkName, mode);
+		} else if (buffer.hasArray()) {
+			lua_loadbytearray(luaThread, buffer.array(), buffer.arrayOffset()
+					+ buffer.position(), buffer.remaining(), chunkName, mode);
+		} else {
+			byte[] b = new byte[buffer.remaining()];
+			buffer.duplicate().get(b);
+			lua_loadbytearray(luaThread, b, 0, b.length, chunkName, mode);
+		}
+	}
+
+	/**
+	 * Loads a Lua chunk from a file and pushes it on the stack as a function.
+	 * Depending on the value of mode, the Lua chunk can either be a
+	 * pre-compiled binary chunk or a UTF-8 encoded text chunk. The file is
+	 * mapped into memory and passed to Lua as a single piece.
+	 * 
+	 * @param path
+	 *            the path of the file containing the chunk
+	 * @param chunkName
+	 *            the name of the chunk for use in error messages
+	 * @param mode
+	 *            <code>"b"</code> to accept binary, <code>"t"</code> to accept
+	 *            text, or <code>"bt"</code> to accept both
+	 * @throws IOException
+	 *             if an IO error occurs
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void load(Path path, String chunkName, String mode)
+			throws IOException {
+		check();
+		FileChannel channel = FileChannel.open(path, StandardOpenOption.READ);
+		try {
+			load(channel.map(FileChannel.MapMode.READ_ONLY, 0, channel.size()),
+					chunkName, mode);
+		} finally {
+			channel.close();
+		}
+	}
+
 	/**
 	 * Dumps the function on top of the stack as a pre-compiled binary chunk
 	 * into an output stream.
@@ -562,7 +1034,39 @@ public class LuaState {
 	 */
 	public synchronized void dump(OutputStream outputStream) throws IOException {
 		check();
-		lua_dump(outputStream);
+		lua_dump(luaThread, outputStream);
+	}
+
+	/**
+	 * Dumps the function on top of the stack as a pre-compiled binary chunk
+	 * into a byte array. The chunk is accumulated in native memory and copied
+	 * once. If strip is <code>true</code>, debug information such as line
+	 * numbers and local variable names is omitted from the chunk.
+	 * 
+	 * @param strip
+	 *            whether to strip debug information
+	 * @return the pre-compiled binary chunk
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized byte[] dumpByteArray(boolean strip) {
+		check();
+		return lua_dumpbytearray(luaThread, strip);
+	}
+
+	/**
+	 * Dumps the function on top of the stack as a pre-compiled binary chunk
+	 * into a direct byte buffer. The chunk is accumulated in native memory and
+	 * copied once. If strip is <code>true</code>, debug information such as
+	 * line numbers and local variable names is omitted from the chunk.
+	 * 
+	 * @param strip
+	 *            whether to strip debug information
+	 * @return the pre-compiled binary chunk
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized ByteBuffer dumpByteBuffer(boolean strip) {
+		check();
+		return lua_dumpbytebuffer(luaThread, strip);
 	}
 
 	// -- Call
@@ -574,15 +1078,85 @@ public class LuaState {
 	 * corresponds the to number of values actually returned by the called
 	 * function.
 	 * 
+	 * <p>
+	 * The call is not yieldable. If the called function attempts to yield, for
+	 * example when this method is invoked by a Java function running in a
+	 * thread, the call fails with a {@link LuaRuntimeException}. Resuming the
+	 * call would require suspending the Java stack of the invoking Java
+	 * function, which JNI does not support. Java functions that need to yield
+	 * must return to Lua with {@link #yield(int, JavaFunction)} instead.
+	 * </p>
+	 * 
 	 * @param argCount
 	 *            the number of arguments
 	 * @param returnCount
 	 *            the number of return values, or {@link #MULTRET} to accept all
 	 *            values returned by the function
 	 */
-	public synchronized void call(int argCount, int returnCount) {
+	public void call(int argCount, int returnCount) {
+		if (confined()) {
+			lua_pcall(luaThread, argCount, returnCount, 0, 0);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pcall(luaThread, argCount, returnCount, 0, 0);
+			}
+		}
+	}
+
+	/**
+	 * Calls a Lua function with an execution budget. The method behaves like
+	 * {@link #call(int, int)}, except that the call is stopped with a
+	 * {@link LuaInterruptedException} if it executes more than the specified
+	 * number of Lua instructions or runs longer than the specified timeout.
+	 * The budget is checked every 1000 instructions, and it does not apply
+	 * while a Java function runs. A budget of <code>0</code> is unlimited.
+	 * 
+	 * <p>
+	 * Only the outermost call has a budget. Calls made by Java functions
+	 * during the call run under its budget, and their own budget is ignored.
+	 * </p>
+	 * 
+	 * @param argCount
+	 *            the number of arguments
+	 * @param returnCount
+	 *            the number of return values, or {@link #MULTRET} to accept all
+	 *            values returned by the function
+	 * @param instructionLimit
+	 *            the maximum number of instructions to execute, or
+	 *            <code>0</code> for no limit
+	 * @param timeout
+	 *            the timeout in milliseconds, or <code>0</code> for no timeout
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void call(int argCount, int returnCount,
+			long instructionLimit, long timeout) {
 		check();
-		lua_pcall(argCount, returnCount);
+		lua_pcall(luaThread, argCount, returnCount, instructionLimit, timeout);
+	}
+
+	/**
+	 * Interrupts the call running in this Lua state, if any. The call is
+	 * stopped with a {@link LuaInterruptedException} when it executes its next
+	 * Lua instruction in the main thread, or in any thread if the call has an
+	 * execution budget. A thread resumed by {@link #resume(int, int)} checks
+	 * for interrupts periodically. A Java function running at the time is not
+	 * interrupted.
+	 * 
+	 * <p>
+	 * Unlike the other methods of this class, this method does not
+	 * synchronize on the Lua state and can be invoked from any thread while a
+	 * call is running. It has no effect on a closed Lua state.
+	 * </p>
+	 * 
+	 * @since JNLua 1.0.5
+	 */
+	public void interrupt() {
+		synchronized (asyncLock) {
+			if (luaState != 0) {
+				lua_interrupt(luaState);
+			}
+		}
 	}
 
 	// -- Globals
@@ -592,9 +1166,15 @@ public class LuaState {
 	 * @param name
 	 *            the global variable name
 	 */
-	public synchronized void getGlobal(String name) {
-		check();
-		lua_getglobal(name);
+	public void getGlobal(String name) {
+		if (confined()) {
+			lua_getglobal(luaThread, name);
+		} else {
+			synchronized (this) {
+				check();
+				lua_getglobal(luaThread, name);
+			}
+		}
 	}
 
 	/**
@@ -604,10 +1184,16 @@ public class LuaState {
 	 * @param name
 	 *            the global variable name
 	 */
-	public synchronized void setGlobal(String name)
+	public void setGlobal(String name)
 			throws LuaMemoryAllocationException, LuaRuntimeException {
-		check();
-		lua_setglobal(name);
+		if (confined()) {
+			lua_setglobal(luaThread, name);
+		} else {
+			synchronized (this) {
+				check();
+				lua_setglobal(luaThread, name);
+			}
+		}
 	}
 
 	// -- Stack push
@@ -617,9 +1203,15 @@ public class LuaState {
 	 * @param b
 	 *            the boolean value to push
 	 */
-	public synchronized void pushBoolean(boolean b) {
-		check();
-		lua_pushboolean(b ? 1 : 0);
+	public void pushBoolean(boolean b) {
+		if (confined()) {
+			lua_pushboolean(luaThread, b ? 1 : 0);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushboolean(luaThread, b ? 1 : 0);
+			}
+		}
 	}
 
 	/**
@@ -630,7 +1222,28 @@ public class LuaState {
 	 */
 	public synchronized void pushByteArray(byte[] b) {
 		check();
-		lua_pushbytearray(b);
+		lua_pushbytearray(luaThread, b);
+	}
+
+	/**
+	 * Pushes the remaining bytes of a byte buffer as a string value on the
+	 * stack. The position of the buffer is not changed. The bytes of a direct
+	 * buffer are pushed from its memory without an intermediate copy.
+	 * 
+	 * @param buffer
+	 *            the byte buffer to push
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void pushByteBuffer(ByteBuffer buffer) {
+		check();
+		if (buffer.isDirect()) {
+			lua_pushbytebuffer(luaThread, buffer, buffer.position(),
+					buffer.remaining());
+		} else {
+			byte[] b = new byte[buffer.remaining()];
+			buffer.duplicate().get(b);
+			lua_pushbytearray(luaThread, b);
+		}
 	}
 
 	/**
@@ -639,9 +1252,15 @@ public class LuaState {
 	 * @param n
 	 *            the integer value to push
 	 */
-	public synchronized void pushInteger(int n) {
-		check();
-		lua_pushinteger(n);
+	public void pushInteger(int n) {
+		if (confined()) {
+			lua_pushinteger(luaThread, n);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushinteger(luaThread, n);
+			}
+		}
 	}
 
 	/**
@@ -652,7 +1271,7 @@ public class LuaState {
 	 */
 	public synchronized void pushJavaFunction(JavaFunction javaFunction) {
 		check();
-		lua_pushjavafunction(javaFunction);
+		lua_pushjavafunction(luaThread, javaFunction);
 	}
 
 	/**
@@ -664,9 +1283,15 @@ public class LuaState {
 	 * @see #getConverter()
 	 * @see #setConverter(Converter)
 	 */
-	public synchronized void pushJavaObject(Object object) {
-		check();
-		getConverter().convertJavaObject(this, object);
+	public void pushJavaObject(Object object) {
+		if (confined()) {
+			getConverter().convertJavaObject(this, object);
+		} else {
+			synchronized (this) {
+				check();
+				getConverter().convertJavaObject(this, object);
+			}
+		}
 	}
 
 	/**
@@ -684,21 +1309,39 @@ public class LuaState {
 	 * <code>null</code> to <code>nil</code>.
 	 * </p>
 	 * 
+	 * <p>
+	 * Pushing the same Java object again pushes the same userdata as long as
+	 * that userdata has not been collected. The Java object therefore has a
+	 * stable identity in Lua and can be used as a table key.
+	 * </p>
+	 * 
 	 * @param object
 	 *            the Java object
 	 * @see #pushJavaObject(Object)
 	 */
-	public synchronized void pushJavaObjectRaw(Object object) {
-		check();
-		lua_pushjavaobject(object);
+	public void pushJavaObjectRaw(Object object) {
+		if (confined()) {
+			lua_pushjavaobject(luaThread, object, System.identityHashCode(object));
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushjavaobject(luaThread, object, System.identityHashCode(object));
+			}
+		}
 	}
 
 	/**
 	 * Pushes a nil value on the stack.
 	 */
-	public synchronized void pushNil() {
-		check();
-		lua_pushnil();
+	public void pushNil() {
+		if (confined()) {
+			lua_pushnil(luaThread);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushnil(luaThread);
+			}
+		}
 	}
 
 	/**
@@ -707,9 +1350,15 @@ public class LuaState {
 	 * @param n
 	 *            the number to push
 	 */
-	public synchronized void pushNumber(double n) {
-		check();
-		lua_pushnumber(n);
+	public void pushNumber(double n) {
+		if (confined()) {
+			lua_pushnumber(luaThread, n);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushnumber(luaThread, n);
+			}
+		}
 	}
 
 	/**
@@ -718,9 +1367,15 @@ public class LuaState {
 	 * @param s
 	 *            the string value to push
 	 */
-	public synchronized void pushString(String s) {
-		check();
-		lua_pushstring(s);
+	public void pushString(String s) {
+		if (confined()) {
+			lua_pushstring(luaThread, s);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushstring(luaThread, s);
+			}
+		}
 	}
 
 	// -- Stack type test
@@ -735,9 +1390,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the value is a boolean
 	 */
-	public synchronized boolean isBoolean(int index) {
-		check();
-		return lua_isboolean(index) != 0;
+	public boolean isBoolean(int index) {
+		if (confined()) {
+			return lua_isboolean(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isboolean(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -753,7 +1414,7 @@ public class LuaState {
 	 */
 	public synchronized boolean isCFunction(int index) {
 		check();
-		return lua_iscfunction(index) != 0;
+		return lua_iscfunction(luaThread, index) != 0;
 	}
 
 	/**
@@ -768,9 +1429,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the value is a function
 	 */
-	public synchronized boolean isFunction(int index) {
-		check();
-		return lua_isfunction(index) != 0;
+	public boolean isFunction(int index) {
+		if (confined()) {
+			return lua_isfunction(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isfunction(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -787,7 +1454,7 @@ public class LuaState {
 	 */
 	public synchronized boolean isJavaFunction(int index) {
 		check();
-		return lua_isjavafunction(index) != 0;
+		return lua_isjavafunction(luaThread, index) != 0;
 	}
 
 	/**
@@ -829,9 +1496,15 @@ public class LuaState {
 	 * @return whether the value is a Java object
 	 * @see #isJavaObject(int, Class)
 	 */
-	public synchronized boolean isJavaObjectRaw(int index) {
-		check();
-		return lua_isjavaobject(index) != 0;
+	public boolean isJavaObjectRaw(int index) {
+		if (confined()) {
+			return lua_isjavaobject(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isjavaobject(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -846,9 +1519,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the value is <code>nil</code>
 	 */
-	public synchronized boolean isNil(int index) {
-		check();
-		return lua_isnil(index) != 0;
+	public boolean isNil(int index) {
+		if (confined()) {
+			return lua_isnil(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isnil(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -862,9 +1541,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the stack index is non-valid
 	 */
-	public synchronized boolean isNone(int index) {
-		check();
-		return lua_isnone(index) != 0;
+	public boolean isNone(int index) {
+		if (confined()) {
+			return lua_isnone(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isnone(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -880,9 +1565,15 @@ public class LuaState {
 	 * @return whether the stack index is non-valid or its value is
 	 *         <code>nil</code>
 	 */
-	public synchronized boolean isNoneOrNil(int index) {
-		check();
-		return lua_isnoneornil(index) != 0;
+	public boolean isNoneOrNil(int index) {
+		if (confined()) {
+			return lua_isnoneornil(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isnoneornil(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -897,9 +1588,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the value is a number or a string convertible to a number
 	 */
-	public synchronized boolean isNumber(int index) {
-		check();
-		return lua_isnumber(index) != 0;
+	public boolean isNumber(int index) {
+		if (confined()) {
+			return lua_isnumber(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isnumber(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -914,9 +1611,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the value is a string or a number
 	 */
-	public synchronized boolean isString(int index) {
-		check();
-		return lua_isstring(index) != 0;
+	public boolean isString(int index) {
+		if (confined()) {
+			return lua_isstring(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_isstring(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -930,9 +1633,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return whether the value is a table
 	 */
-	public synchronized boolean isTable(int index) {
-		check();
-		return lua_istable(index) != 0;
+	public boolean isTable(int index) {
+		if (confined()) {
+			return lua_istable(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_istable(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -948,7 +1657,7 @@ public class LuaState {
 	 */
 	public synchronized boolean isThread(int index) {
 		check();
-		return lua_isthread(index) != 0;
+		return lua_isthread(luaThread, index) != 0;
 	}
 
 	// -- Stack query
@@ -973,7 +1682,7 @@ public class LuaState {
 	public synchronized boolean compare(int index1, int index2,
 			RelOperator operator) {
 		check();
-		return lua_compare(index1, index2, operator.ordinal()) != 0;
+		return lua_compare(luaThread, index1, index2, operator.ordinal()) != 0;
 	}
 
 	/**
@@ -1036,9 +1745,15 @@ public class LuaState {
 	 *            the second stack index
 	 * @return whether the values are equal
 	 */
-	public synchronized boolean rawEqual(int index1, int index2) {
-		check();
-		return lua_rawequal(index1, index2) != 0;
+	public boolean rawEqual(int index1, int index2) {
+		if (confined()) {
+			return lua_rawequal(luaThread, index1, index2) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_rawequal(luaThread, index1, index2) != 0;
+			}
+		}
 	}
 
 	/**
@@ -1051,9 +1766,15 @@ public class LuaState {
 	 * @return the length
 	 * @since JNLua 1.0.0
 	 */
-	public synchronized int rawLen(int index) {
-		check();
-		return lua_rawlen(index);
+	public int rawLen(int index) {
+		if (confined()) {
+			return lua_rawlen(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_rawlen(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1066,9 +1787,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return the boolean representation of the value
 	 */
-	public synchronized boolean toBoolean(int index) {
-		check();
-		return lua_toboolean(index) != 0;
+	public boolean toBoolean(int index) {
+		if (confined()) {
+			return lua_toboolean(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_toboolean(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -1083,7 +1810,56 @@ public class LuaState {
 	 */
 	public synchronized byte[] toByteArray(int index) {
 		check();
-		return lua_tobytearray(index);
+		return lua_tobytearray(luaThread, index);
+	}
+
+	/**
+	 * Returns a read-only direct byte buffer viewing the memory of the value
+	 * at the specified stack index. The value must be a string or a number. If
+	 * the value is a number, it is in place converted to a string. Otherwise,
+	 * the method returns <code>null</code>.
+	 * 
+	 * <p>
+	 * The string is kept alive by a reference in the registry until the buffer
+	 * is released. The buffer must not be accessed after it has been released
+	 * or after this Lua state has been closed.
+	 * </p>
+	 * 
+	 * @param index
+	 *            the stack index
+	 * @return the byte buffer viewing the value
+	 * @see #releaseByteBuffer(ByteBuffer)
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized ByteBuffer toByteBuffer(int index) {
+		check();
+		ByteBuffer buffer = lua_tobytebuffer(luaThread, index);
+		if (buffer == null) {
+			return null;
+		}
+		lua_pushvalue(luaThread, index);
+		int reference = lua_ref(luaThread, REGISTRYINDEX);
+		buffer = buffer.asReadOnlyBuffer();
+		byteBuffers.put(buffer, Integer.valueOf(reference));
+		return buffer;
+	}
+
+	/**
+	 * Releases a byte buffer previously returned by
+	 * {@link #toByteBuffer(int)}. The string viewed by the buffer is no longer
+	 * kept alive.
+	 * 
+	 * @param buffer
+	 *            the byte buffer to release
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void releaseByteBuffer(ByteBuffer buffer) {
+		check();
+		Integer reference = byteBuffers.remove(buffer);
+		if (reference == null) {
+			throw new IllegalArgumentException("unknown byte buffer");
+		}
+		lua_unref(luaThread, REGISTRYINDEX, reference.intValue());
 	}
 
 	/**
@@ -1095,9 +1871,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return the integer representation, or <code>0</code>
 	 */
-	public synchronized int toInteger(int index) {
-		check();
-		return lua_tointeger(index);
+	public int toInteger(int index) {
+		if (confined()) {
+			return lua_tointeger(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_tointeger(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1112,7 +1894,7 @@ public class LuaState {
 	 */
 	public synchronized Integer toIntegerX(int index) {
 		check();
-		return lua_tointegerx(index);
+		return lua_tointegerx(luaThread, index);
 	}
 
 	/**
@@ -1125,7 +1907,7 @@ public class LuaState {
 	 */
 	public synchronized JavaFunction toJavaFunction(int index) {
 		check();
-		return lua_tojavafunction(index);
+		return lua_tojavafunction(luaThread, index);
 	}
 
 	/**
@@ -1144,9 +1926,15 @@ public class LuaState {
 	 * @see #getConverter()
 	 * @see #setConverter(Converter)
 	 */
-	public synchronized <T> T toJavaObject(int index, Class<T> type) {
-		check();
-		return converter.convertLuaValue(this, index, type);
+	public <T> T toJavaObject(int index, Class<T> type) {
+		if (confined()) {
+			return converter.convertLuaValue(this, index, type);
+		} else {
+			synchronized (this) {
+				check();
+				return converter.convertLuaValue(this, index, type);
+			}
+		}
 	}
 
 	/**
@@ -1164,9 +1952,15 @@ public class LuaState {
 	 * @return the Java object, or <code>null</code>
 	 * @see #toJavaObject(int, Class)
 	 */
-	public synchronized Object toJavaObjectRaw(int index) {
-		check();
-		return lua_tojavaobject(index);
+	public Object toJavaObjectRaw(int index) {
+		if (confined()) {
+			return lua_tojavaobject(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_tojavaobject(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1178,9 +1972,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return the number representation, or <code>0.0</code>
 	 */
-	public synchronized double toNumber(int index) {
-		check();
-		return lua_tonumber(index);
+	public double toNumber(int index) {
+		if (confined()) {
+			return lua_tonumber(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_tonumber(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1195,7 +1995,7 @@ public class LuaState {
 	 */
 	public synchronized Double toNumberX(int index) {
 		check();
-		return lua_tonumberx(index);
+		return lua_tonumberx(luaThread, index);
 	}
 
 	/**
@@ -1211,7 +2011,7 @@ public class LuaState {
 	 */
 	public synchronized long toPointer(int index) {
 		check();
-		return lua_topointer(index);
+		return lua_topointer(luaThread, index);
 	}
 
 	/**
@@ -1224,9 +2024,15 @@ public class LuaState {
 	 *            the stack index
 	 * @return the string representation, or <code>null</code>
 	 */
-	public synchronized String toString(int index) {
-		check();
-		return lua_tostring(index);
+	public String toString(int index) {
+		if (confined()) {
+			return lua_tostring(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_tostring(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1240,10 +2046,50 @@ public class LuaState {
 	 *            the stack index
 	 * @return the type, or <code>null</code> if the stack index is non-valid
 	 */
-	public synchronized LuaType type(int index) {
-		check();
-		int type = lua_type(index);
-		return type >= 0 ? LuaType.values()[type] : null;
+	public LuaType type(int index) {
+		if (confined()) {
+			int type = lua_type(luaThread, index);
+			return type >= 0 ? LuaType.values()[type] : null;
+		} else {
+			synchronized (this) {
+				check();
+				int type = lua_type(luaThread, index);
+				return type >= 0 ? LuaType.values()[type] : null;
+			}
+		}
+	}
+
+	/**
+	 * Describes the values in a range of stack indexes in a single native
+	 * call. For each value, the method stores a type code in the types array.
+	 * For Java objects, it also stores the Java object in the Java objects
+	 * array. The other elements of the Java objects array are left unchanged,
+	 * which lets callers reuse cleared arrays. The type code is the ordinal of
+	 * the {@link LuaType} of the value, with the {@link #DESCRIBE_JAVA} flag
+	 * set for Java functions and Java objects. The range is empty if the
+	 * absolute <code>to</code> index is less than the absolute
+	 * <code>from</code> index.
+	 * 
+	 * @param from
+	 *            the stack index of the first value
+	 * @param to
+	 *            the stack index of the last value
+	 * @param types
+	 *            receives the type codes
+	 * @param javaObjects
+	 *            receives the Java objects
+	 * @since JNLua 1.0.5
+	 */
+	public void describeStack(int from, int to, int[] types,
+			Object[] javaObjects) {
+		if (confined()) {
+			lua_describestack(luaThread, from, to, types, javaObjects);
+		} else {
+			synchronized (this) {
+				check();
+				lua_describestack(luaThread, from, to, types, javaObjects);
+			}
+		}
 	}
 
 	/**
@@ -1298,9 +2144,15 @@ public class LuaState {
 	 * @return the absolute stack index
 	 * @since JNLua 1.0.0
 	 */
-	public synchronized int absIndex(int index) {
-		check();
-		return lua_absindex(index);
+	public int absIndex(int index) {
+		if (confined()) {
+			return lua_absindex(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_absindex(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1313,7 +2165,7 @@ public class LuaState {
 	 */
 	public synchronized void arith(ArithOperator operator) {
 		check();
-		lua_arith(operator.ordinal());
+		lua_arith(luaThread, operator.ordinal());
 	}
 
 	/**
@@ -1325,7 +2177,7 @@ public class LuaState {
 	 */
 	public synchronized void concat(int n) {
 		check();
-		lua_concat(n);
+		lua_concat(luaThread, n);
 	}
 
 	/**
@@ -1338,9 +2190,15 @@ public class LuaState {
 	 *            the index to copy to
 	 * @since JNLua 1.0.0
 	 */
-	public synchronized void copy(int fromIndex, int toIndex) {
-		check();
-		lua_copy(fromIndex, toIndex);
+	public void copy(int fromIndex, int toIndex) {
+		if (confined()) {
+			lua_copy(luaThread, fromIndex, toIndex);
+		} else {
+			synchronized (this) {
+				check();
+				lua_copy(luaThread, fromIndex, toIndex);
+			}
+		}
 	}
 
 	/**
@@ -1348,9 +2206,15 @@ public class LuaState {
 	 * 
 	 * @return the number of values on the tack
 	 */
-	public synchronized int getTop() {
-		check();
-		return lua_gettop();
+	public int getTop() {
+		if (confined()) {
+			return lua_gettop(luaThread);
+		} else {
+			synchronized (this) {
+				check();
+				return lua_gettop(luaThread);
+			}
+		}
 	}
 
 	/**
@@ -1364,7 +2228,7 @@ public class LuaState {
 	 */
 	public synchronized void len(int index) {
 		check();
-		lua_len(index);
+		lua_len(luaThread, index);
 	}
 
 	/**
@@ -1374,9 +2238,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index
 	 */
-	public synchronized void insert(int index) {
-		check();
-		lua_insert(index);
+	public void insert(int index) {
+		if (confined()) {
+			lua_insert(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_insert(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1385,9 +2255,15 @@ public class LuaState {
 	 * @param count
 	 *            the number of values to pop
 	 */
-	public synchronized void pop(int count) {
-		check();
-		lua_pop(count);
+	public void pop(int count) {
+		if (confined()) {
+			lua_pop(luaThread, count);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pop(luaThread, count);
+			}
+		}
 	}
 
 	/**
@@ -1396,9 +2272,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index
 	 */
-	public synchronized void pushValue(int index) {
-		check();
-		lua_pushvalue(index);
+	public void pushValue(int index) {
+		if (confined()) {
+			lua_pushvalue(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_pushvalue(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1408,9 +2290,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index
 	 */
-	public synchronized void remove(int index) {
-		check();
-		lua_remove(index);
+	public void remove(int index) {
+		if (confined()) {
+			lua_remove(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_remove(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1420,9 +2308,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index
 	 */
-	public synchronized void replace(int index) {
-		check();
-		lua_replace(index);
+	public void replace(int index) {
+		if (confined()) {
+			lua_replace(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_replace(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1436,9 +2330,15 @@ public class LuaState {
 	 * @param index
 	 *            the index of the new top of the stack
 	 */
-	public synchronized void setTop(int index) {
-		check();
-		lua_settop(index);
+	public void setTop(int index) {
+		if (confined()) {
+			lua_settop(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_settop(luaThread, index);
+			}
+		}
 	}
 
 	// -- Table
@@ -1450,9 +2350,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index containing the table
 	 */
-	public synchronized void getTable(int index) {
-		check();
-		lua_gettable(index);
+	public void getTable(int index) {
+		if (confined()) {
+			lua_gettable(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_gettable(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1464,17 +2370,29 @@ public class LuaState {
 	 * @param key
 	 *            the string key
 	 */
-	public synchronized void getField(int index, String key) {
-		check();
-		lua_getfield(index, key);
+	public void getField(int index, String key) {
+		if (confined()) {
+			lua_getfield(luaThread, index, key);
+		} else {
+			synchronized (this) {
+				check();
+				lua_getfield(luaThread, index, key);
+			}
+		}
 	}
 
 	/**
 	 * Creates a new table and pushes it on the stack.
 	 */
-	public synchronized void newTable() {
-		check();
-		lua_newtable();
+	public void newTable() {
+		if (confined()) {
+			lua_newtable(luaThread);
+		} else {
+			synchronized (this) {
+				check();
+				lua_newtable(luaThread);
+			}
+		}
 	}
 
 	/**
@@ -1486,9 +2404,15 @@ public class LuaState {
 	 * @param recordCount
 	 *            the number of record elements
 	 */
-	public synchronized void newTable(int arrayCount, int recordCount) {
-		check();
-		lua_createtable(arrayCount, recordCount);
+	public void newTable(int arrayCount, int recordCount) {
+		if (confined()) {
+			lua_createtable(luaThread, arrayCount, recordCount);
+		} else {
+			synchronized (this) {
+				check();
+				lua_createtable(luaThread, arrayCount, recordCount);
+			}
+		}
 	}
 
 	/**
@@ -1501,9 +2425,15 @@ public class LuaState {
 	 *            the stack index containing the table
 	 * @return whether there is a next key
 	 */
-	public synchronized boolean next(int index) {
-		check();
-		return lua_next(index) != 0;
+	public boolean next(int index) {
+		if (confined()) {
+			return lua_next(luaThread, index) != 0;
+		} else {
+			synchronized (this) {
+				check();
+				return lua_next(luaThread, index) != 0;
+			}
+		}
 	}
 
 	/**
@@ -1514,9 +2444,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index containing the table
 	 */
-	public synchronized void rawGet(int index) {
-		check();
-		lua_rawget(index);
+	public void rawGet(int index) {
+		if (confined()) {
+			lua_rawget(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_rawget(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1528,9 +2464,15 @@ public class LuaState {
 	 * @param key
 	 *            the integer key
 	 */
-	public synchronized void rawGet(int index, int key) {
-		check();
-		lua_rawgeti(index, key);
+	public void rawGet(int index, int key) {
+		if (confined()) {
+			lua_rawgeti(luaThread, index, key);
+		} else {
+			synchronized (this) {
+				check();
+				lua_rawgeti(luaThread, index, key);
+			}
+		}
 	}
 
 	/**
@@ -1542,9 +2484,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index containing the table
 	 */
-	public synchronized void rawSet(int index) {
-		check();
-		lua_rawset(index);
+	public void rawSet(int index) {
+		if (confined()) {
+			lua_rawset(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_rawset(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1557,9 +2505,15 @@ public class LuaState {
 	 * @param key
 	 *            the integer key
 	 */
-	public synchronized void rawSet(int index, int key) {
-		check();
-		lua_rawseti(index, key);
+	public void rawSet(int index, int key) {
+		if (confined()) {
+			lua_rawseti(luaThread, index, key);
+		} else {
+			synchronized (this) {
+				check();
+				lua_rawseti(luaThread, index, key);
+			}
+		}
 	}
 
 	/**
@@ -1570,9 +2524,15 @@ public class LuaState {
 	 * @param index
 	 *            the stack index containing the table
 	 */
-	public synchronized void setTable(int index) {
-		check();
-		lua_settable(index);
+	public void setTable(int index) {
+		if (confined()) {
+			lua_settable(luaThread, index);
+		} else {
+			synchronized (this) {
+				check();
+				lua_settable(luaThread, index);
+			}
+		}
 	}
 
 	/**
@@ -1584,9 +2544,15 @@ public class LuaState {
 	 * @param key
 	 *            the string key
 	 */
-	public synchronized void setField(int index, String key) {
-		check();
-		lua_setfield(index, key);
+	public void setField(int index, String key) {
+		if (confined()) {
+			lua_setfield(luaThread, index, key);
+		} else {
+			synchronized (this) {
+				check();
+				lua_setfield(luaThread, index, key);
+			}
+		}
 	}
 
 	// -- Metatable
@@ -1604,7 +2570,7 @@ public class LuaState {
 	 */
 	public synchronized boolean getMetafield(int index, String key) {
 		check();
-		return lua_getmetafield(index, key) != 0;
+		return lua_getmetafield(luaThread, index, key) != 0;
 	}
 
 	/**
@@ -1618,7 +2584,7 @@ public class LuaState {
 	 */
 	public synchronized boolean getMetatable(int index) {
 		check();
-		return lua_getmetatable(index) != 0;
+		return lua_getmetatable(luaThread, index) != 0;
 	}
 
 	/**
@@ -1631,7 +2597,7 @@ public class LuaState {
 	 */
 	public synchronized void setMetatable(int index) {
 		check();
-		lua_setmetatable(index);
+		lua_setmetatable(luaThread, index);
 	}
 
 	// -- Thread
@@ -1642,7 +2608,7 @@ public class LuaState {
 	 */
 	public synchronized void newThread() {
 		check();
-		lua_newthread();
+		lua_newthread(luaThread);
 	}
 
 	/**
@@ -1659,7 +2625,7 @@ public class LuaState {
 	 */
 	public synchronized int resume(int index, int argCount) {
 		check();
-		return lua_resume(index, argCount);
+		return lua_resume(luaThread, index, argCount);
 	}
 
 	/**
@@ -1675,7 +2641,7 @@ public class LuaState {
 	 */
 	public synchronized int status(int index) {
 		check();
-		return lua_status(index);
+		return lua_status(luaThread, index);
 	}
 
 	/**
@@ -1691,7 +2657,37 @@ public class LuaState {
 	 */
 	public synchronized int yield(int returnCount) {
 		check();
-		yield = true;
+		lua_yield(luaThread, null);
+		return returnCount;
+	}
+
+	/**
+	 * Yields the running thread like {@link #yield(int)} and continues the
+	 * Java function with the specified continuation when the thread is
+	 * resumed. The continuation is invoked like a Java function. The stack
+	 * holds the values of the Java function that were not passed to the
+	 * resuming thread, followed by the values passed to the resume. The
+	 * return value of the continuation is the return value of the Java
+	 * function, and the continuation may yield again.
+	 * 
+	 * <p>
+	 * Java functions can yield when called from Lua, including under
+	 * <code>pcall</code> and in metamethods. A Java function called by a
+	 * Java method, such as {@link #call(int, int)}, cannot yield across that
+	 * method since the Java stack cannot be suspended.
+	 * </p>
+	 * 
+	 * @param returnCount
+	 *            the number of results to pass
+	 * @param continuation
+	 *            the continuation, or <code>null</code> to return the values
+	 *            passed to the resume to the caller of the Java function
+	 * @return the return value of the Java function
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized int yield(int returnCount, JavaFunction continuation) {
+		check();
+		lua_yield(luaThread, continuation);
 		return returnCount;
 	}
 
@@ -1708,7 +2704,7 @@ public class LuaState {
 	 */
 	public synchronized int ref(int index) {
 		check();
-		return lua_ref(index);
+		return lua_ref(luaThread, index);
 
 	}
 
@@ -1726,7 +2722,7 @@ public class LuaState {
 	 */
 	public synchronized void unref(int index, int reference) {
 		check();
-		lua_unref(index, reference);
+		lua_unref(luaThread, index, reference);
 	}
 
 	// -- Optimization
@@ -1744,7 +2740,7 @@ public class LuaState {
 	 */
 	public synchronized int tableSize(int index) {
 		check();
-		return lua_tablesize(index);
+		return lua_tablesize(luaThread, index);
 	}
 
 	/**
@@ -1767,7 +2763,253 @@ public class LuaState {
 	 */
 	public synchronized void tableMove(int index, int from, int to, int count) {
 		check();
-		lua_tablemove(index, from, to, count);
+		lua_tablemove(luaThread, index, from, to, count);
+	}
+
+	/**
+	 * Pushes a double array as a table on the stack. The table is created with
+	 * its array part presized and filled in a single native call.
+	 * 
+	 * @param a
+	 *            the array to push
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void pushArray(double[] a) {
+		check();
+		lua_pusharray(luaThread, a, DOUBLE_ARRAY);
+	}
+
+	/**
+	 * Pushes an integer array as a table on the stack. The table is created
+	 * with its array part presized and filled in a single native call.
+	 * 
+	 * @param a
+	 *            the array to push
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void pushArray(int[] a) {
+		check();
+		lua_pusharray(luaThread, a, INT_ARRAY);
+	}
+
+	/**
+	 * Pushes a long array as a table on the stack. The table is created with
+	 * its array part presized and filled in a single native call. Values
+	 * beyond the precision of a Lua number are rounded.
+	 * 
+	 * @param a
+	 *            the array to push
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void pushArray(long[] a) {
+		check();
+		lua_pusharray(luaThread, a, LONG_ARRAY);
+	}
+
+	/**
+	 * Pushes a boolean array as a table on the stack. The table is created
+	 * with its array part presized and filled in a single native call.
+	 * 
+	 * @param a
+	 *            the array to push
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void pushArray(boolean[] a) {
+		check();
+		lua_pusharray(luaThread, a, BOOLEAN_ARRAY);
+	}
+
+	/**
+	 * Pushes a string array as a table on the stack. The table is created with
+	 * its array part presized and filled in a single native call. Array
+	 * elements that are <code>null</code> are left <code>nil</code>.
+	 * 
+	 * @param a
+	 *            the array to push
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void pushArray(String[] a) {
+		check();
+		lua_pusharray(luaThread, a, STRING_ARRAY);
+	}
+
+	/**
+	 * Returns the elements of the table at the specified stack index as a
+	 * double array. The array has the length of the table. If the value is not
+	 * a table, or an element of the table is not a number, the method returns
+	 * <code>null</code>.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @return the double array, or <code>null</code>
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized double[] toDoubleArray(int index) {
+		check();
+		return (double[]) lua_toarray(luaThread, index, DOUBLE_ARRAY);
+	}
+
+	/**
+	 * Returns the elements of the table at the specified stack index as an
+	 * integer array. The array has the length of the table. If the value is
+	 * not a table, or an element of the table is not a number, the method
+	 * returns <code>null</code>.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @return the integer array, or <code>null</code>
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized int[] toIntArray(int index) {
+		check();
+		return (int[]) lua_toarray(luaThread, index, INT_ARRAY);
+	}
+
+	/**
+	 * Returns the elements of the table at the specified stack index as a
+	 * long array. The array has the length of the table. If the value is not a
+	 * table, or an element of the table is not a number, the method returns
+	 * <code>null</code>.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @return the long array, or <code>null</code>
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized long[] toLongArray(int index) {
+		check();
+		return (long[]) lua_toarray(luaThread, index, LONG_ARRAY);
+	}
+
+	/**
+	 * Returns the elements of the table at the specified stack index as a
+	 * boolean array. The array has the length of the table. If the value is
+	 * not a table, or an element of the table is not a boolean, the method
+	 * returns <code>null</code>.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @return the boolean array, or <code>null</code>
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized boolean[] toBooleanArray(int index) {
+		check();
+		return (boolean[]) lua_toarray(luaThread, index, BOOLEAN_ARRAY);
+	}
+
+	/**
+	 * Returns the elements of the table at the specified stack index as a
+	 * string array. The array has the length of the table. If the value is not
+	 * a table, or an element of the table is not a string, the method returns
+	 * <code>null</code>.
+	 * 
+	 * @param index
+	 *            the stack index containing the table
+	 * @return the string array, or <code>null</code>
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized String[] toStringArray(int index) {
+		check();
+		return (String[]) lua_toarray(luaThread, index, STRING_ARRAY);
+	}
+
+	/**
+	 * Executes a batch of stack operations. The recorded operations are
+	 * executed in order. If an operation fails, execution stops at that
+	 * operation and the corresponding exception is thrown. The results of the
+	 * batch can be read from the batch after execution.
+	 * 
+	 * <p>
+	 * The method provides optimized performance over a Java implementation of
+	 * the same functionality due to the reduced number of JNI transitions.
+	 * </p>
+	 * 
+	 * @param batch
+	 *            the batch to execute
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void execute(LuaBatch batch) {
+		check();
+		batch.prepare();
+		lua_batch(luaThread, batch.getCommands(), batch.getCommandSize(),
+				batch.getPool(), batch.getResults(), batch.getStrings());
+	}
+
+	// -- Profiling
+	/**
+	 * Starts the sampling profiler. While the profiler runs, the stack of the
+	 * running Lua code is sampled at the specified interval and recorded in a
+	 * native sample buffer, which is drained by means of the
+	 * {@link #drainProfiler(LuaProfile)} method. Samples are taken while Lua
+	 * functions run; time spent in Java functions is not sampled. The profiler
+	 * samples the current thread and the coroutines it creates.
+	 * 
+	 * @param interval
+	 *            the sampling interval in microseconds
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void startProfiler(int interval) {
+		check();
+		lua_startprofiler(luaThread, interval);
+	}
+
+	/**
+	 * Stops the sampling profiler. Samples not yet drained remain in the
+	 * sample buffer.
+	 * 
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void stopProfiler() {
+		check();
+		lua_stopprofiler(luaThread);
+	}
+
+	/**
+	 * Drains the sample buffer of the sampling profiler into the specified
+	 * profile.
+	 * 
+	 * @param profile
+	 *            the profile to add the samples to
+	 * @since JNLua 1.0.5
+	 */
+	public synchronized void drainProfiler(LuaProfile profile) {
+		check();
+		int[] samples = lua_drainprofiler(luaThread);
+		String[] frames = lua_profilerframes(luaThread, profilerFrames.size());
+		for (int i = 0; i < frames.length; i++) {
+			profilerFrames.add(frames[i]);
+		}
+		profile.addDropped(samples[0]);
+		StringBuilder sb = new StringBuilder();
+		int i = 1;
+		while (i < samples.length) {
+			int depth = samples[i++];
+			sb.setLength(0);
+			for (int j = 0; j < depth; j++) {
+				if (j > 0) {
+					sb.append(';');
+				}
+				sb.append(profilerFrames.get(samples[i++]));
+			}
+			profile.add(sb.toString(), 1);
+		}
+	}
+
+	/**
+	 * Returns the metrics of this Lua state. The metrics include native method
+	 * crossing counts and latencies if instrumentation is enabled, as well as
+	 * memory and monitor contention figures.
+	 * 
+	 * <p>
+	 * The method may be invoked on a closed Lua state.
+	 * </p>
+	 * 
+	 * @return the metrics
+	 * @see #INSTRUMENTED
+	 * @since JNLua 1.0.5
+	 */
+	public LuaMetrics getMetrics() {
+		return metrics;
 	}
 
 	// -- Argument checking
@@ -2181,6 +3423,43 @@ public class LuaState {
 		}
 	}
 
+	// -- Package private methods
+	/**
+	 * Returns the names of the native methods, indexed like the native
+	 * metrics.
+	 */
+	static String[] getNativeNames() {
+		return lua_nativenames();
+	}
+
+	/**
+	 * Returns a snapshot of the native metrics without synchronizing on this
+	 * Lua state, or <code>null</code> if this Lua state is closed.
+	 */
+	long[] getMetricsSnapshot() {
+		synchronized (asyncLock) {
+			return luaState != 0L ? lua_metrics(luaState) : null;
+		}
+	}
+
+	/**
+	 * Returns a snapshot of the memory figures without synchronizing on this
+	 * Lua state, or <code>null</code> if this Lua state is closed.
+	 */
+	long[] getMemorySnapshot() {
+		synchronized (asyncLock) {
+			if (luaState == 0L) {
+				return null;
+			}
+			return new long[] { lua_memory(luaState, MEMORY_USED),
+					lua_memory(luaState, MEMORY_PEAK),
+					lua_memory(luaState, MEMORY_ALLOCATIONS),
+					lua_memory(luaState, MEMORY_LIMIT),
+					lua_memory(luaState, MEMORY_GLOBALREFS),
+					lua_memory(luaState, MEMORY_HANDLES) };
+		}
+	}
+
 	// -- Private methods
 	/**
 	 * Returns whether this Lua state is open.
@@ -2194,10 +3473,23 @@ public class LuaState {
 	 */
 	private void closeInternal() {
 		if (isOpenInternal()) {
-			lua_close(ownState);
+			synchronized (asyncLock) {
+				lua_close(ownState);
+			}
 			if (isOpenInternal()) {
 				throw new IllegalStateException("cannot close");
 			}
+			byteBuffers.clear();
+			profilerFrames.clear();
+			if (metricsName != null) {
+				try {
+					ManagementFactory.getPlatformMBeanServer().unregisterMBean(
+							metricsName);
+				} catch (JMException e) {
+					// Already unregistered
+				}
+				metricsName = null;
+			}
 		}
 	}
 
@@ -2210,11 +3502,47 @@ public class LuaState {
 			throw new IllegalStateException("Lua state is closed");
 		}
 
+		// Check owner
+		Thread owner = ownerThread;
+		if (owner != null && owner != Thread.currentThread()) {
+			throw new IllegalStateException("Lua state is confined to " + owner);
+		}
+
 		// Check proxy queue
+		pollProxyQueue();
+	}
+
+	/**
+	 * Returns whether this Lua state is confined to the current thread, in
+	 * which case the invoking method runs without synchronizing. This performs
+	 * the checks of {@link #check()}, polling the proxy queue only
+	 * periodically.
+	 */
+	private boolean confined() {
+		Thread owner = ownerThread;
+		if (owner == null) {
+			return false;
+		}
+		if (owner != Thread.currentThread()) {
+			throw new IllegalStateException("Lua state is confined to " + owner);
+		}
+		if (!isOpenInternal()) {
+			throw new IllegalStateException("Lua state is closed");
+		}
+		if ((++confinedCount & PROXY_POLL_MASK) == 0) {
+			pollProxyQueue();
+		}
+		return true;
+	}
+
+	/**
+	 * Releases the Lua values of unreachable Lua value proxies.
+	 */
+	private void pollProxyQueue() {
 		LuaValueProxyRef luaValueProxyRef;
 		while ((luaValueProxyRef = (LuaValueProxyRef) proxyQueue.poll()) != null) {
 			proxySet.remove(luaValueProxyRef);
-			lua_unref(REGISTRYINDEX, luaValueProxyRef.getReference());
+			lua_unref(luaThread, REGISTRYINDEX, luaValueProxyRef.getReference());
 		}
 	}
 
@@ -2238,9 +3566,9 @@ public class LuaState {
 
 		// Get execution point
 		String name = null, nameWhat = null;
-		LuaDebug luaDebug = lua_getstack(0);
+		LuaDebug luaDebug = lua_getstack(luaThread, 0);
 		if (luaDebug != null) {
-			lua_getinfo("n", luaDebug);
+			lua_getinfo(luaThread, "n", luaDebug);
 			name = luaDebug.getName();
 			nameWhat = luaDebug.getNameWhat();
 		}
@@ -2268,164 +3596,236 @@ public class LuaState {
 
 	private static native String lua_version();
 
-	private native void lua_newstate(int apiversion, long luaState);
+	private native void lua_newstate(int apiversion, long luaState,
+			int allocator, int references);
 
 	private native void lua_close(boolean ownState);
 
-	private native int lua_gc(int what, int data);
+	private static native int lua_gc(long luaThread, int what, int data);
+
+	private static native long lua_memory(long luaThread, int what);
+
+	private static native void lua_setmemorylimit(long luaThread, long limit);
+
+	private static native void lua_instrument();
+
+	private static native long[] lua_metrics(long luaState);
+
+	private static native String[] lua_nativenames();
+
+	private static native void lua_openlib(long luaThread, int lib);
+
+	private static native void lua_load(long luaThread, InputStream inputStream,
+			String chunkname, String mode) throws IOException;
+
+	private static native void lua_loadbuffer(long luaThread,
+			ByteBuffer buffer, int position, int length, String chunkname,
+			String mode);
+
+	private static native void lua_loadbytearray(long luaThread, byte[] b,
+			int offset, int length, String chunkname, String mode);
+
+	private static native void lua_dump(long luaThread,
+			OutputStream outputStream) throws IOException;
+
+	private static native byte[] lua_dumpbytearray(long luaThread,
+			boolean strip);
 
-	private native void lua_openlib(int lib);
+	private static native ByteBuffer lua_dumpbytebuffer(long luaThread,
+			boolean strip);
 
-	private native void lua_load(InputStream inputStream, String chunkname,
-			String mode) throws IOException;
+	private static native void lua_pcall(long luaThread, int nargs,
+			int nresults, long instructions, long timeout);
 
-	private native void lua_dump(OutputStream outputStream) throws IOException;
+	private static native void lua_interrupt(long luaState);
 
-	private native void lua_pcall(int nargs, int nresults);
+	private static native void lua_getglobal(long luaThread, String name);
 
-	private native void lua_getglobal(String name);
+	private static native void lua_setglobal(long luaThread, String name);
 
-	private native void lua_setglobal(String name);
+	private static native void lua_pushboolean(long luaThread, int b);
 
-	private native void lua_pushboolean(int b);
+	private static native void lua_pushbytearray(long luaThread, byte[] b);
 
-	private native void lua_pushbytearray(byte[] b);
+	private static native void lua_pushbytebuffer(long luaThread,
+			ByteBuffer buffer, int position, int length);
 	
-	private native void lua_pushinteger(int n);
+	private static native void lua_pushinteger(long luaThread, int n);
 
-	private native void lua_pushjavafunction(JavaFunction f);
+	private static native void lua_pushjavafunction(long luaThread,
+			JavaFunction f);
 
-	private native void lua_pushjavaobject(Object object);
+	private static native void lua_pushjavaobject(long luaThread, Object object,
+			int hash);
 
-	private native void lua_pushnil();
+	private static native void lua_pushnil(long luaThread);
 
-	private native void lua_pushnumber(double n);
+	private static native void lua_pushnumber(long luaThread, double n);
 
-	private native void lua_pushstring(String s);
+	private static native void lua_pushstring(long luaThread, String s);
 
-	private native int lua_isboolean(int index);
+	private static native int lua_isboolean(long luaThread, int index);
 
-	private native int lua_iscfunction(int index);
+	private static native int lua_iscfunction(long luaThread, int index);
 
-	private native int lua_isfunction(int index);
+	private static native int lua_isfunction(long luaThread, int index);
 
-	private native int lua_isjavafunction(int index);
+	private static native int lua_isjavafunction(long luaThread, int index);
 
-	private native int lua_isjavaobject(int index);
+	private static native int lua_isjavaobject(long luaThread, int index);
 
-	private native int lua_isnil(int index);
+	private static native int lua_isnil(long luaThread, int index);
 
-	private native int lua_isnone(int index);
+	private static native int lua_isnone(long luaThread, int index);
 
-	private native int lua_isnoneornil(int index);
+	private static native int lua_isnoneornil(long luaThread, int index);
 
-	private native int lua_isnumber(int index);
+	private static native int lua_isnumber(long luaThread, int index);
 
-	private native int lua_isstring(int index);
+	private static native int lua_isstring(long luaThread, int index);
 
-	private native int lua_istable(int index);
+	private static native int lua_istable(long luaThread, int index);
 
-	private native int lua_isthread(int index);
+	private static native int lua_isthread(long luaThread, int index);
 
-	private native int lua_compare(int index1, int index2, int operator);
+	private static native int lua_compare(long luaThread, int index1, int index2,
+			int operator);
 
-	private native int lua_rawequal(int index1, int index2);
+	private static native int lua_rawequal(long luaThread, int index1,
+			int index2);
 
-	private native int lua_rawlen(int index);
+	private static native int lua_rawlen(long luaThread, int index);
 
-	private native int lua_toboolean(int index);
+	private static native int lua_toboolean(long luaThread, int index);
 
-	private native byte[] lua_tobytearray(int index);
+	private static native byte[] lua_tobytearray(long luaThread, int index);
+
+	private static native ByteBuffer lua_tobytebuffer(long luaThread, int index);
 	
-	private native int lua_tointeger(int index);
+	private static native int lua_tointeger(long luaThread, int index);
+
+	private static native Integer lua_tointegerx(long luaThread, int index);
+
+	private static native JavaFunction lua_tojavafunction(long luaThread,
+			int index);
+
+	private static native Object lua_tojavaobject(long luaThread, int index);
+
+	private static native double lua_tonumber(long luaThread, int index);
+
+	private static native Double lua_tonumberx(long luaThread, int index);
+
+	private static native long lua_topointer(long luaThread, int index);
+
+	private static native String lua_tostring(long luaThread, int index);
 
-	private native Integer lua_tointegerx(int index);
+	private static native int lua_type(long luaThread, int index);
 
-	private native JavaFunction lua_tojavafunction(int index);
+	private static native void lua_describestack(long luaThread, int from,
+			int to, int[] types, Object[] javaObjects);
 
-	private native Object lua_tojavaobject(int index);
+	private static native int lua_absindex(long luaThread, int index);
 
-	private native double lua_tonumber(int index);
+	private static native int lua_arith(long luaThread, int operator);
 
-	private native Double lua_tonumberx(int index);
+	private static native void lua_concat(long luaThread, int n);
 
-	private native long lua_topointer(int index);
+	private static native int lua_copy(long luaThread, int fromIndex,
+			int toIndex);
 
-	private native String lua_tostring(int index);
+	private static native int lua_gettop(long luaThread);
 
-	private native int lua_type(int index);
+	private static native void lua_len(long luaThread, int index);
 
-	private native int lua_absindex(int index);
+	private static native void lua_insert(long luaThread, int index);
 
-	private native int lua_arith(int operator);
+	private static native void lua_pop(long luaThread, int n);
 
-	private native void lua_concat(int n);
+	private static native void lua_pushvalue(long luaThread, int index);
 
-	private native int lua_copy(int fromIndex, int toIndex);
+	private static native void lua_remove(long luaThread, int index);
 
-	private native int lua_gettop();
+	private static native void lua_replace(long luaThread, int index);
 
-	private native void lua_len(int index);
+	private static native void lua_settop(long luaThread, int index);
 
-	private native void lua_insert(int index);
+	private static native void lua_createtable(long luaThread, int narr,
+			int nrec);
 
-	private native void lua_pop(int n);
+	private static native int lua_getsubtable(long luaThread, int idx,
+			String fname);
 
-	private native void lua_pushvalue(int index);
+	private static native void lua_gettable(long luaThread, int index);
 
-	private native void lua_remove(int index);
+	private static native void lua_getfield(long luaThread, int index, String k);
 
-	private native void lua_replace(int index);
+	private static native void lua_newtable(long luaThread);
 
-	private native void lua_settop(int index);
+	private static native int lua_next(long luaThread, int index);
 
-	private native void lua_createtable(int narr, int nrec);
+	private static native void lua_rawget(long luaThread, int index);
 
-	private native int lua_getsubtable(int idx, String fname);
+	private static native void lua_rawgeti(long luaThread, int index, int n);
 
-	private native void lua_gettable(int index);
+	private static native void lua_rawset(long luaThread, int index);
 
-	private native void lua_getfield(int index, String k);
+	private static native void lua_rawseti(long luaThread, int index, int n);
 
-	private native void lua_newtable();
+	private static native void lua_settable(long luaThread, int index);
 
-	private native int lua_next(int index);
+	private static native void lua_setfield(long luaThread, int index, String k);
 
-	private native void lua_rawget(int index);
+	private static native int lua_getmetatable(long luaThread, int index);
 
-	private native void lua_rawgeti(int index, int n);
+	private static native void lua_setmetatable(long luaThread, int index);
 
-	private native void lua_rawset(int index);
+	private static native int lua_getmetafield(long luaThread, int index,
+			String k);
 
-	private native void lua_rawseti(int index, int n);
+	private static native void lua_newthread(long luaThread);
 
-	private native void lua_settable(int index);
+	private static native int lua_resume(long luaThread, int index, int nargs);
 
-	private native void lua_setfield(int index, String k);
+	private static native int lua_status(long luaThread, int index);
 
-	private native int lua_getmetatable(int index);
+	private static native void lua_yield(long luaThread,
+			JavaFunction continuation);
 
-	private native void lua_setmetatable(int index);
+	private static native void lua_setstacktrace(long luaThread, int enabled);
 
-	private native int lua_getmetafield(int index, String k);
+	private static native void lua_setlightweighterrors(long luaThread,
+			int enabled);
 
-	private native void lua_newthread();
+	private static native int lua_ref(long luaThread, int index);
 
-	private native int lua_resume(int index, int nargs);
+	private static native void lua_unref(long luaThread, int index, int ref);
 
-	private native int lua_status(int index);
+	private static native LuaDebug lua_getstack(long luaThread, int level);
 
-	private native int lua_ref(int index);
+	private static native int lua_getinfo(long luaThread, String what,
+			LuaDebug ar);
 
-	private native void lua_unref(int index, int ref);
+	private static native void lua_startprofiler(long luaThread, int interval);
 
-	private native LuaDebug lua_getstack(int level);
+	private static native void lua_stopprofiler(long luaThread);
 
-	private native int lua_getinfo(String what, LuaDebug ar);
+	private static native int[] lua_drainprofiler(long luaThread);
 
-	private native int lua_tablesize(int index);
+	private static native String[] lua_profilerframes(long luaThread, int first);
 
-	private native void lua_tablemove(int index, int from, int to, int count);
+	private static native int lua_tablesize(long luaThread, int index);
+
+	private static native void lua_tablemove(long luaThread, int index, int from,
+			int to, int count);
+
+	private static native void lua_pusharray(long luaThread, Object array,
+			int type);
+
+	private static native Object lua_toarray(long luaThread, int index,
+			int type);
+
+	private static native void lua_batch(long luaThread, ByteBuffer commands,
+			int size, ByteBuffer pool, ByteBuffer results, Object[] strings);
 
 	// -- Enumerated types
 	/**
@@ -2648,6 +4048,49 @@ public class LuaState {
 		LE
 	}
 
+	/**
+	 * Represents a memory allocator of a Lua state.
+	 * 
+	 * @since JNLua 1.0.5
+	 */
+	public enum Allocator {
+		/**
+		 * Allocates all memory with the system allocator.
+		 */
+		SYSTEM,
+
+		/**
+		 * Allocates small blocks from pools per size class and larger blocks
+		 * with the system allocator. The pools are private to the Lua state,
+		 * which avoids fragmentation and lock contention in the system
+		 * allocator when many Lua states are used. Memory held in the pools is
+		 * returned to the system when the Lua state is closed.
+		 */
+		POOL
+	}
+
+	/**
+	 * Represents how a Lua state references the Java objects pushed into it.
+	 * 
+	 * @since JNLua 1.0.5
+	 */
+	public enum ObjectReferences {
+		/**
+		 * References each Java object with a JNI global reference.
+		 */
+		GLOBAL,
+
+		/**
+		 * References Java objects by their slot in a Java array private to the
+		 * Lua state. Slots are reused through a free list and the array grows
+		 * as needed. Java objects collected by Lua are released from the array
+		 * in batches, and at the latest when a full garbage collection is
+		 * requested or the Lua state is closed. This avoids the cost of the JNI
+		 * global reference table when Lua holds many Java objects.
+		 */
+		HANDLE_TABLE
+	}
+
 	// -- Nested types
 	/**
 	 * Phantom reference to a Lua value proxy for pre-mortem cleanup.
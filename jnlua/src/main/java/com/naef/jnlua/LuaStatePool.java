@@ -0,0 +1,322 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua;
+
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentLinkedQueue;
+import java.util.concurrent.ForkJoinPool;
+import java.util.concurrent.ForkJoinWorkerThread;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.function.Consumer;
+import java.util.function.Function;
+
+/**
+ * Executes work on a pool of Lua states shared by a pool of worker threads.
+ *
+ * <p>
+ * Each worker thread owns one Lua state, which is confined to the worker
+ * thread while the worker uses it. The Lua states are created by a common
+ * initializer, which typically opens libraries, registers modules and runs
+ * bootstrap chunks. The workers keep per-worker queues and steal work from
+ * each other when idle. An idle worker that terminates returns its Lua state
+ * to the pool for the next worker. A Lua state is closed and replaced by a
+ * new one after a configurable number of uses, or when its memory usage
+ * exceeds a configurable threshold. The replacement is created and
+ * initialized by the worker right after the work that reached the limit has
+ * completed.
+ * </p>
+ *
+ * <p>
+ * Work that waits for other submitted work may cause the worker thread to
+ * execute that work while waiting. Such nested work runs on a Lua state of
+ * its own.
+ * </p>
+ *
+ * <p>
+ * Work must leave the Lua state in a state that is suitable for subsequent
+ * work. The stack is cleared after each unit of work.
+ * </p>
+ *
+ * @since JNLua 1.0.5
+ */
+public class LuaStatePool {
+	// -- State
+	private final Consumer<LuaState> initializer;
+	private final int maxUses;
+	private final long memoryThreshold;
+	private final ForkJoinPool executor;
+	private final ConcurrentLinkedQueue<LuaState> prewarmed = new ConcurrentLinkedQueue<LuaState>();
+	private final AtomicLong recycleCount = new AtomicLong();
+	private boolean closed;
+
+	// -- Construction
+	/**
+	 * Creates a new instance with one worker per available processor and no
+	 * recycling.
+	 *
+	 * @param initializer
+	 *            initializes new Lua states
+	 */
+	public LuaStatePool(Consumer<LuaState> initializer) {
+		this(Runtime.getRuntime().availableProcessors(), initializer, 0, 0L);
+	}
+
+	/**
+	 * Creates a new instance. The Lua states of the workers are created and
+	 * initialized in advance.
+	 *
+	 * @param size
+	 *            the number of workers
+	 * @param initializer
+	 *            initializes new Lua states
+	 * @param maxUses
+	 *            the number of units of work after which a Lua state is
+	 *            replaced, or <code>0</code> for no limit
+	 * @param memoryThreshold
+	 *            the memory usage in bytes above which a Lua state is
+	 *            replaced, or <code>0</code> for no threshold
+	 */
+	public LuaStatePool(int size, Consumer<LuaState> initializer, int maxUses,
+			long memoryThreshold) {
+		if (size <= 0) {
+			throw new IllegalArgumentException("illegal size: " + size);
+		}
+		if (maxUses < 0) {
+			throw new IllegalArgumentException("illegal max uses: " + maxUses);
+		}
+		if (memoryThreshold < 0) {
+			throw new IllegalArgumentException("illegal memory threshold: "
+					+ memoryThreshold);
+		}
+		this.initializer = initializer;
+		this.maxUses = maxUses;
+		this.memoryThreshold = memoryThreshold;
+		for (int i = 0; i < size; i++) {
+			prewarmed.add(newLuaState());
+		}
+		executor = new ForkJoinPool(size, pool -> new Worker(pool), null, true);
+	}
+
+	// -- Properties
+	/**
+	 * Returns the number of Lua states that have been replaced.
+	 *
+	 * @return the number of replaced Lua states
+	 */
+	public long getRecycleCount() {
+		return recycleCount.get();
+	}
+
+	// -- Operations
+	/**
+	 * Executes the specified work on the Lua state of a worker thread. The
+	 * returned future completes with the result of the work, or exceptionally
+	 * with the exception thrown by the work.
+	 *
+	 * @param work
+	 *            the work
+	 * @return the future result
+	 */
+	public <T> CompletableFuture<T> submit(final Function<LuaState, T> work) {
+		final CompletableFuture<T> result = new CompletableFuture<T>();
+		executor.execute(() -> ((Worker) Thread.currentThread()).execute(work,
+				result));
+		return result;
+	}
+
+	/**
+	 * Closes this pool. Submitted work is completed and the Lua states are
+	 * closed. If the submitted work does not complete within the timeout, the
+	 * Lua states still in use are closed when their workers terminate.
+	 *
+	 * @param timeout
+	 *            the maximum time to wait for the submitted work
+	 * @param unit
+	 *            the unit of the timeout
+	 * @return whether the submitted work has completed
+	 * @throws InterruptedException
+	 *             if the calling thread is interrupted
+	 */
+	public boolean close(long timeout, TimeUnit unit)
+			throws InterruptedException {
+		executor.shutdown();
+		boolean terminated = executor.awaitTermination(timeout, unit);
+		synchronized (prewarmed) {
+			closed = true;
+		}
+		LuaState luaState;
+		while ((luaState = prewarmed.poll()) != null) {
+			luaState.close();
+		}
+		return terminated;
+	}
+
+	// -- Private methods
+	/**
+	 * Creates and initializes a new Lua state.
+	 */
+	private LuaState newLuaState() {
+		LuaState luaState = new LuaState();
+		try {
+			if (initializer != null) {
+				initializer.accept(luaState);
+			}
+			luaState.setTop(0);
+		} catch (RuntimeException e) {
+			luaState.close();
+			throw e;
+		}
+		return luaState;
+	}
+
+	/**
+	 * Takes a prewarmed Lua state, or creates a new one if there is none, and
+	 * confines it to the current thread.
+	 */
+	private LuaState takeLuaState() {
+		LuaState luaState = prewarmed.poll();
+		if (luaState == null) {
+			luaState = newLuaState();
+		}
+		luaState.setOwnerThread(Thread.currentThread());
+		return luaState;
+	}
+
+	/**
+	 * Returns a Lua state that is not used by a worker to the pool, or closes
+	 * it if the pool is closed.
+	 */
+	private void release(LuaState luaState) {
+		luaState.setOwnerThread(null);
+		synchronized (prewarmed) {
+			if (!closed) {
+				prewarmed.add(luaState);
+				return;
+			}
+		}
+		luaState.close();
+	}
+
+	// -- Nested types
+	/**
+	 * A worker thread owning a Lua state.
+	 */
+	private class Worker extends ForkJoinWorkerThread {
+		// -- State
+		private LuaState luaState;
+		private int uses;
+		private boolean busy;
+
+		// -- Construction
+		/**
+		 * Creates a new instance.
+		 */
+		public Worker(ForkJoinPool pool) {
+			super(pool);
+			setName("JNLua worker " + getPoolIndex());
+			setDaemon(true);
+		}
+
+		// -- Operations
+		/**
+		 * Executes work on the Lua state of this worker and completes the
+		 * future with its outcome.
+		 */
+		public <T> void execute(Function<LuaState, T> work,
+				CompletableFuture<T> result) {
+			if (busy) {
+				executeNested(work, result);
+				return;
+			}
+			try {
+				if (luaState == null) {
+					luaState = takeLuaState();
+					uses = 0;
+				}
+			} catch (RuntimeException e) {
+				result.completeExceptionally(e);
+				return;
+			}
+			busy = true;
+			try {
+				result.complete(work.apply(luaState));
+			} catch (Throwable e) {
+				result.completeExceptionally(e);
+			} finally {
+				busy = false;
+				recycle();
+			}
+		}
+
+		// -- Thread methods
+		@Override
+		protected void onTermination(Throwable exception) {
+			try {
+				if (luaState != null) {
+					release(luaState);
+					luaState = null;
+				}
+			} finally {
+				super.onTermination(exception);
+			}
+		}
+
+		// -- Private methods
+		/**
+		 * Executes work submitted while this worker is executing other work,
+		 * on a Lua state of its own that is returned to the pool afterwards.
+		 */
+		private <T> void executeNested(Function<LuaState, T> work,
+				CompletableFuture<T> result) {
+			LuaState nested;
+			try {
+				nested = takeLuaState();
+			} catch (RuntimeException e) {
+				result.completeExceptionally(e);
+				return;
+			}
+			try {
+				result.complete(work.apply(nested));
+			} catch (Throwable e) {
+				result.completeExceptionally(e);
+			} finally {
+				if (nested.isOpen()) {
+					nested.setTop(0);
+					release(nested);
+				}
+			}
+		}
+
+		/**
+		 * Clears the Lua state after work. If the Lua state has reached its
+		 * maximum uses or memory threshold, it is closed and replaced by a new
+		 * Lua state.
+		 */
+		private void recycle() {
+			if (!luaState.isOpen()) {
+				luaState = null;
+				return;
+			}
+			luaState.setTop(0);
+			uses++;
+			if ((maxUses > 0 && uses >= maxUses)
+					|| (memoryThreshold > 0
+							&& luaState.getMemoryUsed() > memoryThreshold)) {
+				luaState.close();
+				luaState = null;
+				recycleCount.incrementAndGet();
+				try {
+					luaState = newLuaState();
+					luaState.setOwnerThread(this);
+					uses = 0;
+				} catch (RuntimeException e) {
+					// The next work retries and reports the error
+				}
+			}
+		}
+	}
+}
@@ -5,10 +5,8 @@
 
 package com.naef.jnlua.script;
 
-import java.io.ByteArrayOutputStream;
 import java.io.IOException;
 import java.io.InputStream;
-import java.io.OutputStream;
 import java.io.Reader;
 import java.nio.ByteBuffer;
 import java.nio.CharBuffer;
@@ -93,30 +91,30 @@ class LuaScriptEngine extends AbstractScriptEngine implements Compilable,
 	// -- Compilable method
 	@Override
 	public CompiledScript compile(String script) throws ScriptException {
-		ByteArrayOutputStream out = new ByteArrayOutputStream();
+		byte[] chunk;
 		synchronized (luaState) {
 			loadChunk(script, null);
 			try {
-				dumpChunk(out);
+				chunk = dumpChunk();
 			} finally {
 				luaState.pop(1);
 			}
 		}
-		return new CompiledLuaScript(this, out.toByteArray());
+		return new CompiledLuaScript(this, chunk);
 	}
 
 	@Override
 	public CompiledScript compile(Reader script) throws ScriptException {
-		ByteArrayOutputStream out = new ByteArrayOutputStream();
+		byte[] chunk;
 		synchronized (luaState) {
 			loadChunk(script, null);
 			try {
-				dumpChunk(out);
+				chunk = dumpChunk();
 			} finally {
 				luaState.pop(1);
 			}
 		}
-		return new CompiledLuaScript(this, out.toByteArray());
+		return new CompiledLuaScript(this, chunk);
 	}
 
 	// -- Invocable methods
@@ -300,18 +298,14 @@ class LuaScriptEngine extends AbstractScriptEngine implements Compilable,
 	}
 
 	/**
-	 * Dumps a loaded chunk into an output stream. The chunk is left on the
-	 * stack.
+	 * Dumps a loaded chunk into a byte array. The chunk is left on the stack.
 	 */
-	void dumpChunk(OutputStream out) throws ScriptException {
+	byte[] dumpChunk() throws ScriptException {
 		try {
-			luaState.dump(out);
+			return luaState.dumpByteArray(false);
 		} catch (LuaException e) {
 			throw new ScriptException(e);
-		} catch (IOException e) {
-			throw new ScriptException(e);
 		}
-
 	}
 
 	// -- Private methods
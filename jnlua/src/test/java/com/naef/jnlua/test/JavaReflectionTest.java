@@ -5,8 +5,13 @@
 
 package com.naef.jnlua.test;
 
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertTrue;
+
 import org.junit.Test;
 
+import com.naef.jnlua.DefaultJavaReflector;
+
 /**
  * Contains unit tests for Java reflection.
  */
@@ -19,4 +24,82 @@ public class JavaReflectionTest extends AbstractLuaTest {
 	public void testReflection() throws Exception {
 		runTest("com/naef/jnlua/test/Reflection.lua", "Reflection");
 	}
+
+	/**
+	 * Tests invocations with more arguments than the initial scratch arrays
+	 * hold.
+	 */
+	@Test
+	public void testManyArguments() throws Exception {
+		luaState.openLibs();
+		luaState.load("local String = java.require(\"java.lang.String\")\n"
+				+ "for i = 1, 3 do\n"
+				+ "  assert(String:format(\"%s%s%s%s%s%s%s%s%s%s\", \"a\", \"b\", "
+				+ "\"c\", \"d\", \"e\", \"f\", \"g\", \"h\", \"i\", \"j\") "
+				+ "== \"abcdefghij\")\n"
+				+ "  assert(String:valueOf(true) == \"true\")\n"
+				+ "end\n", "=testManyArguments");
+		luaState.call(0, 0);
+	}
+
+	/**
+	 * Tests Java reflection from Lua through method handles.
+	 */
+	@Test
+	public void testMethodHandleReflection() throws Exception {
+		luaState.setJavaReflector(DefaultJavaReflector.getMethodHandleInstance());
+		runTest("com/naef/jnlua/test/Reflection.lua", "Reflection");
+	}
+
+	/**
+	 * Tests the primitive arguments, return values and exceptions of method
+	 * handle invocations.
+	 */
+	@Test
+	public void testMethodHandleInvocation() throws Exception {
+		luaState.openLibs();
+		luaState.setJavaReflector(DefaultJavaReflector.getMethodHandleInstance());
+		luaState.load("local Math = java.require(\"java.lang.Math\")\n"
+				+ "local Integer = java.require(\"java.lang.Integer\")\n"
+				+ "local Long = java.require(\"java.lang.Long\")\n"
+				+ "local Short = java.require(\"java.lang.Short\")\n"
+				+ "local Boolean = java.require(\"java.lang.Boolean\")\n"
+				+ "local Character = java.require(\"java.lang.Character\")\n"
+				+ "local StringBuilder = java.require(\"java.lang.StringBuilder\")\n"
+				+ "for i = 1, 3 do\n"
+				+ "  assert(Math:hypot(3, 4) == 5)\n"
+				+ "  assert(Integer:bitCount(7) == 3)\n"
+				+ "  assert(Long:numberOfTrailingZeros(8) == 3)\n"
+				+ "  assert(Short:reverseBytes(1) == 256)\n"
+				+ "  assert(Boolean:logicalXor(true, false) == true)\n"
+				+ "  assert(Character:forDigit(11, 16) == 98)\n"
+				+ "  assert(Integer:toHexString(255) == \"ff\")\n"
+				+ "  assert(Integer:parseInt(\"42\") == 42)\n"
+				+ "  local sb = StringBuilder:new(\"a\")\n"
+				+ "  assert(sb:append(\"b\") == sb)\n"
+				+ "  assert(sb:length() == 2)\n"
+				+ "  assert(sb:toString() == \"ab\")\n"
+				+ "  local ok, msg = pcall(Integer.parseInt, Integer, \"x\")\n"
+				+ "  assert(not ok)\n"
+				+ "  assert(string.find(tostring(msg), \"NumberFormatException\"))\n"
+				+ "end\n", "=testMethodHandleInvocation");
+		luaState.call(0, 0);
+	}
+
+	/**
+	 * Tests the inline caches of overloaded methods.
+	 */
+	@Test
+	public void testInlineCache() throws Exception {
+		DefaultJavaReflector reflector = DefaultJavaReflector.getInstance();
+		long hits = reflector.getInlineCacheHitCount();
+		StringBuilder sb = new StringBuilder();
+		luaState.pushJavaObject(sb);
+		luaState.setGlobal("sb");
+		luaState.load("for i = 1, 10 do sb:append(\"x\") sb:append(true) end",
+				"=testInlineCache");
+		luaState.call(0, 0);
+		assertEquals(50, sb.length());
+		assertTrue(reflector.getInlineCacheHitCount() - hits >= 18);
+	}
 }
@@ -6,9 +6,13 @@
 package com.naef.jnlua.test;
 
 import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertFalse;
 import static org.junit.Assert.assertNotNull;
+import static org.junit.Assert.assertNull;
 import static org.junit.Assert.assertTrue;
 
+import java.lang.reflect.Field;
+
 import org.junit.Test;
 
 import com.naef.jnlua.JavaFunction;
@@ -68,6 +72,28 @@ public class LuaExceptionTest extends AbstractLuaTest {
 				luaStackTrace[4]);
 	}
 
+	/**
+	 * Tests a Lua error without Lua stack trace capture.
+	 */
+	@Test
+	public void testLuaErrorNoStackTrace() throws Exception {
+		// Setup program
+		luaState.openLibs();
+		luaState.setLuaStackTraceCapture(false);
+		assertFalse(luaState.isLuaStackTraceCapture());
+		luaState.load("error(\"msg\")", "=testLuaErrorNoStackTrace");
+
+		// Run
+		LuaRuntimeException luaRuntimeException = null;
+		try {
+			luaState.call(0, 0);
+		} catch (LuaRuntimeException e) {
+			luaRuntimeException = e;
+		}
+		assertTrue(luaRuntimeException.getMessage().endsWith("msg"));
+		assertEquals(0, luaRuntimeException.getLuaStackTrace().length);
+	}
+
 	/**
 	 * Tests the call of a Java function which throws a Java runtime exception.
 	 */
@@ -89,6 +115,74 @@ public class LuaExceptionTest extends AbstractLuaTest {
 		assertTrue(cause instanceof ArithmeticException);
 	}
 
+	/**
+	 * Tests Java functions throwing Java runtime exceptions with lightweight
+	 * Java errors.
+	 */
+	@Test
+	public void testLightweightJavaErrors() throws Exception {
+		// Caught in Lua
+		luaState.openLibs();
+		luaState.setLightweightJavaErrors(true);
+		assertTrue(luaState.isLightweightJavaErrors());
+		luaState.pushJavaFunction(new RuntimeExceptionFunction());
+		luaState.setGlobal("f");
+		luaState.load("local n = 0\n"
+				+ "for i = 1, 100 do if not pcall(f) then n = n + 1 end end\n"
+				+ "local ok, err = pcall(f)\n" + "return n, tostring(err)",
+				"=testLightweightJavaErrors");
+		luaState.call(0, 2);
+		assertEquals(100, luaState.toInteger(1));
+		assertTrue(luaState.toString(2).indexOf("ArithmeticException") >= 0);
+		luaState.pop(2);
+
+		// Escaping to Java
+		luaState.getGlobal("f");
+		LuaRuntimeException luaRuntimeException = null;
+		try {
+			luaState.call(0, 0);
+		} catch (LuaRuntimeException e) {
+			luaRuntimeException = e;
+		}
+		assertNotNull(luaRuntimeException);
+		assertTrue(luaRuntimeException.getCause() instanceof ArithmeticException);
+	}
+
+	/**
+	 * Tests nested Java errors caught in Lua with lightweight Java errors. The
+	 * outer error value must keep its exception and location while the inner
+	 * one is parked, and no exception remains parked afterwards.
+	 */
+	@Test
+	public void testNestedLightweightJavaErrors() throws Exception {
+		luaState.openLibs();
+		luaState.setLightweightJavaErrors(true);
+		luaState.pushJavaFunction(new RuntimeExceptionFunction());
+		luaState.setGlobal("f");
+		luaState.pushJavaFunction(new IllegalStateExceptionFunction());
+		luaState.setGlobal("g");
+		luaState.load("local ok, outer = pcall(function () f() end)\n"
+				+ "local ok, inner = pcall(function ()\n"
+				+ "  local ok, err = pcall(function () g() end)\n"
+				+ "  error(err, 0)\n" + "end)\n"
+				+ "assert(tostring(inner):find(\"IllegalStateException\"))\n"
+				+ "error(outer, 0)", "=testNestedLightweightJavaErrors");
+		LuaRuntimeException luaRuntimeException = null;
+		try {
+			luaState.call(0, 0);
+		} catch (LuaRuntimeException e) {
+			luaRuntimeException = e;
+		}
+		assertNotNull(luaRuntimeException);
+		assertTrue(luaRuntimeException.getCause() instanceof ArithmeticException);
+		assertTrue(luaRuntimeException.getMessage().startsWith(
+				"testNestedLightweightJavaErrors:1: "));
+		Field pendingThrowable = LuaState.class
+				.getDeclaredField("pendingThrowable");
+		pendingThrowable.setAccessible(true);
+		assertNull(pendingThrowable.get(luaState));
+	}
+
 	/**
 	 * Tests the call of a Java function which throws a Lua runtime exception.
 	 */
@@ -157,6 +251,15 @@ public class LuaExceptionTest extends AbstractLuaTest {
 		}
 	}
 	
+	/**
+	 * Provides a function throwing an illegal state exception.
+	 */
+	private class IllegalStateExceptionFunction implements JavaFunction {
+		public int invoke(LuaState luaState) {
+			throw new IllegalStateException("illegal state");
+		}
+	}
+
 	/**
 	 * Provides a function throwing a Lua runtime exception with a cause.
 	 */
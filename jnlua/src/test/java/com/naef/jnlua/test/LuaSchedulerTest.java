@@ -0,0 +1,94 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua.test;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertTrue;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.TimeUnit;
+
+import org.junit.Test;
+
+import com.naef.jnlua.LuaRuntimeException;
+import com.naef.jnlua.LuaScheduler;
+import com.naef.jnlua.LuaState;
+import com.naef.jnlua.NamedJavaFunction;
+
+/**
+ * Contains unit tests for the coroutine scheduler.
+ */
+public class LuaSchedulerTest extends AbstractLuaTest {
+	// -- Test cases
+	/**
+	 * Tests coroutines awaiting futures completed by another thread.
+	 */
+	@Test
+	public void testScheduler() throws Exception {
+		// Setup
+		final ExecutorService io = Executors.newFixedThreadPool(4);
+		final LuaScheduler scheduler = new LuaScheduler(luaState);
+		luaState.openLibs();
+		luaState.register(new NamedJavaFunction() {
+			public int invoke(LuaState luaState) {
+				final int value = luaState.checkInteger(1);
+				CompletableFuture<Integer> future = CompletableFuture
+						.supplyAsync(() -> {
+							if (value < 0) {
+								throw new IllegalArgumentException("negative");
+							}
+							return Integer.valueOf(value * 2);
+						}, io);
+				return scheduler.await(luaState, future);
+			}
+
+			public String getName() {
+				return "fetch";
+			}
+		});
+		luaState.load("function work(n)\n"
+				+ "  local a = fetch(n)\n"
+				+ "  coroutine.yield()\n"
+				+ "  return a + fetch(a)\n"
+				+ "end\n", "=testScheduler");
+		luaState.call(0, 0);
+
+		// Run
+		List<CompletableFuture<Object[]>> futures = new ArrayList<CompletableFuture<Object[]>>();
+		for (int i = 0; i < 100; i++) {
+			futures.add(scheduler.submit("work", Integer.valueOf(i)));
+		}
+		for (int i = 0; i < 100; i++) {
+			Object[] results = futures.get(i).get(10, TimeUnit.SECONDS);
+			assertEquals(1, results.length);
+			assertEquals(6.0 * i, ((Number) results[0]).doubleValue(), 0.0);
+		}
+
+		// Error
+		try {
+			scheduler.submit("work", Integer.valueOf(-1)).get(10,
+					TimeUnit.SECONDS);
+			assertTrue(false);
+		} catch (ExecutionException e) {
+			assertTrue(e.getCause() instanceof LuaRuntimeException);
+			Throwable cause = e.getCause();
+			while (cause.getCause() != null) {
+				cause = cause.getCause();
+			}
+			assertTrue(cause instanceof IllegalArgumentException);
+		}
+		assertEquals(0, scheduler.getTaskCount());
+
+		// Finish
+		scheduler.close();
+		io.shutdown();
+	}
+}
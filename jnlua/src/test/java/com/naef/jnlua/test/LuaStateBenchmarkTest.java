@@ -0,0 +1,165 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua.test;
+
+import static org.junit.Assert.assertTrue;
+
+import org.junit.Test;
+
+import com.naef.jnlua.JavaFunction;
+import com.naef.jnlua.LuaRuntimeException;
+import com.naef.jnlua.LuaState;
+
+/**
+ * Measures the cost of frequently used Lua state operations. The test runs
+ * with the other unit tests and prints the time per operation in
+ * nanoseconds, so that builds can be compared by their test output.
+ */
+public class LuaStateBenchmarkTest extends AbstractLuaTest {
+	// -- Static
+	private static final int WARMUP_ITERATIONS = 100000;
+	private static final int ITERATIONS = 1000000;
+	private static final int LUA_ITERATIONS = 100000;
+
+	// -- State
+	private double sink;
+
+	// -- Test cases
+	/**
+	 * Measures stack operations.
+	 */
+	@Test
+	public void testStackBenchmark() throws Exception {
+		measure("pushNumber/pop", new Operation() {
+			public void run(int i) {
+				luaState.pushNumber(i);
+				luaState.pop(1);
+			}
+		});
+		luaState.pushNumber(1.0);
+		measure("toNumber", new Operation() {
+			public void run(int i) {
+				sink += luaState.toNumber(1);
+			}
+		});
+		luaState.pop(1);
+		measure("getTop", new Operation() {
+			public void run(int i) {
+				sink += luaState.getTop();
+			}
+		});
+	}
+
+	/**
+	 * Measures table and global access with the collector running.
+	 */
+	@Test
+	public void testTableBenchmark() throws Exception {
+		luaState.openLibs();
+		luaState.pushNumber(0.0);
+		luaState.setGlobal("x");
+		measure("getGlobal/pop", new Operation() {
+			public void run(int i) {
+				luaState.getGlobal("x");
+				luaState.pop(1);
+			}
+		});
+		measure("setGlobal", new Operation() {
+			public void run(int i) {
+				luaState.pushNumber(i);
+				luaState.setGlobal("x");
+			}
+		});
+		luaState.newTable();
+		measure("rawSet", new Operation() {
+			public void run(int i) {
+				luaState.pushNumber(i & 0xff);
+				luaState.pushNumber(i);
+				luaState.rawSet(1);
+			}
+		});
+		luaState.pop(1);
+		final Object object = new Object();
+		measure("pushJavaObject/pop", new Operation() {
+			public void run(int i) {
+				luaState.pushJavaObject(object);
+				luaState.pop(1);
+			}
+		});
+	}
+
+	/**
+	 * Measures calls from Lua into Java.
+	 */
+	@Test
+	public void testCallBenchmark() throws Exception {
+		luaState.openLibs();
+		luaState.pushJavaObject(new StringBuilder());
+		luaState.setGlobal("sb");
+		measureLua("reflective call", "sb:setLength(0)");
+		luaState.pushJavaFunction(new JavaFunction() {
+			public int invoke(LuaState luaState) {
+				throw new LuaRuntimeException("error");
+			}
+		});
+		luaState.setGlobal("fail");
+		measureLua("caught Java error", "pcall(fail)");
+		luaState.load("error(\"error\")", "=error");
+		luaState.setGlobal("raise");
+		measureLua("caught Lua error", "pcall(raise)");
+	}
+
+	// -- Private methods
+	/**
+	 * Measures an operation invoked from Java, and prints the time per
+	 * invocation.
+	 */
+	private void measure(String name, Operation operation) {
+		for (int i = 0; i < WARMUP_ITERATIONS; i++) {
+			operation.run(i);
+		}
+		long start = System.nanoTime();
+		for (int i = 0; i < ITERATIONS; i++) {
+			operation.run(i);
+		}
+		report(name, (System.nanoTime() - start) / (double) ITERATIONS);
+	}
+
+	/**
+	 * Measures a Lua statement executed in a Lua loop, and prints the time
+	 * per execution.
+	 */
+	private void measureLua(String name, String statement) {
+		luaState.load("local n = ... for i = 1, n do " + statement + " end",
+				"=" + name);
+		luaState.pushValue(-1);
+		luaState.pushInteger(LUA_ITERATIONS / 10);
+		luaState.call(1, 0);
+		luaState.pushInteger(LUA_ITERATIONS);
+		long start = System.nanoTime();
+		luaState.call(1, 0);
+		report(name, (System.nanoTime() - start) / (double) LUA_ITERATIONS);
+	}
+
+	/**
+	 * Prints a result.
+	 */
+	private void report(String name, double nanos) {
+		assertTrue(nanos > 0.0 && !Double.isInfinite(nanos));
+		System.out.println(String.format("%-20s %8.1f ns/op", name, nanos));
+	}
+
+	// -- Nested types
+	/**
+	 * An operation to measure.
+	 */
+	private interface Operation {
+		/**
+		 * Runs the operation once.
+		 */
+		void run(int i);
+	}
+}
@@ -12,10 +12,12 @@ import java.io.ByteArrayOutputStream;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
 
 import org.junit.Test;
 
 import com.naef.jnlua.JavaFunction;
+import com.naef.jnlua.LuaBatch;
 import com.naef.jnlua.LuaRuntimeException;
 import com.naef.jnlua.LuaState;
 import com.naef.jnlua.LuaState.ArithOperator;
@@ -205,6 +207,28 @@ public class LuaStateErrorTest extends AbstractLuaTest {
 		luaState.dump(new ByteArrayOutputStream());
 	}
 
+	/**
+	 * setMemoryLimit(long) with a negative limit.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalMemoryLimit() throws Exception {
+		luaState.setMemoryLimit(-1);
+	}
+
+	/**
+	 * dumpByteArray(boolean) with a Java function.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalDumpByteArray() throws Exception {
+		luaState.pushJavaFunction(new JavaFunction() {
+			@Override
+			public int invoke(LuaState luaState) {
+				return 0;
+			}
+		});
+		luaState.dumpByteArray(true);
+	}
+
 	// -- Call tests
 	/**
 	 * Call(int, int) with insufficient arguments.
@@ -249,6 +273,44 @@ public class LuaStateErrorTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	/**
+	 * Call(int, int, long, long) with an illegal instruction limit.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalCall3() {
+		luaState.openLibs();
+		luaState.getGlobal("print");
+		luaState.call(0, 0, -1, 0);
+	}
+
+	/**
+	 * Call(int, int, long, long) with an illegal timeout.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalCall4() {
+		luaState.openLibs();
+		luaState.getGlobal("print");
+		luaState.call(0, 0, 0, -1);
+	}
+
+	/**
+	 * Call(int, int) with a Java function whose upvalue has been replaced.
+	 */
+	@Test(expected = LuaRuntimeException.class)
+	public void testIllegalCall5() {
+		luaState.openLibs();
+		luaState.pushJavaFunction(new JavaFunction() {
+			@Override
+			public int invoke(LuaState luaState) {
+				return 0;
+			}
+		});
+		luaState.setGlobal("f");
+		luaState.load("debug.setupvalue(f, 1, io.stdout)\n" + "f()",
+				"=testIllegalCall5");
+		luaState.call(0, 0);
+	}
+
 	// -- Global tests
 	/**
 	 * getGlobal(String) with null.
@@ -419,6 +481,32 @@ public class LuaStateErrorTest extends AbstractLuaTest {
 		luaState.toString(getIllegalIndex());
 	}
 
+	/**
+	 * toByteBuffer(int) with illegal index.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalToByteBuffer() {
+		luaState.toByteBuffer(getIllegalIndex());
+	}
+
+	/**
+	 * describeStack(int, int, int[], Object[]) with a short array.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalDescribeStack() {
+		luaState.pushNil();
+		luaState.pushNil();
+		luaState.describeStack(1, 2, new int[1], new Object[2]);
+	}
+
+	/**
+	 * releaseByteBuffer(ByteBuffer) with unknown buffer.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalReleaseByteBuffer() {
+		luaState.releaseByteBuffer(ByteBuffer.allocateDirect(1));
+	}
+
 	// -- Stack operation test
 	/**
 	 * arith(ArithOperator) with two missing arguments for addition.
@@ -958,6 +1046,51 @@ public class LuaStateErrorTest extends AbstractLuaTest {
 		luaState.tableMove(1, 1, 1, -1);
 	}
 
+	/**
+	 * pushArray(double[]) with null array.
+	 */
+	@Test(expected = NullPointerException.class)
+	public void testNullPushArray() {
+		luaState.pushArray((double[]) null);
+	}
+
+	/**
+	 * toDoubleArray(int) with illegal index.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalToDoubleArray() {
+		luaState.toDoubleArray(getIllegalIndex());
+	}
+
+	/**
+	 * execute(LuaBatch) with null batch.
+	 */
+	@Test(expected = NullPointerException.class)
+	public void testNullExecute() {
+		luaState.execute(null);
+	}
+
+	/**
+	 * execute(LuaBatch) with illegal index.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalExecute1() {
+		LuaBatch batch = new LuaBatch();
+		batch.pushValue(getIllegalIndex());
+		luaState.execute(batch);
+	}
+
+	/**
+	 * execute(LuaBatch) with illegal table.
+	 */
+	@Test(expected = IllegalArgumentException.class)
+	public void testIllegalExecute2() {
+		LuaBatch batch = new LuaBatch();
+		batch.pushNil();
+		batch.getField(1, "key");
+		luaState.execute(batch);
+	}
+
 	// -- Argument checking tests
 	/**
 	 * checkArg(int, boolean, String) with false condition.
@@ -0,0 +1,67 @@
+/*
+ * $Id$
+ * See LICENSE.txt for license terms.
+ */
+
+package com.naef.jnlua.test;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertTrue;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.TimeUnit;
+
+import org.junit.Test;
+
+import com.naef.jnlua.LuaStatePool;
+
+/**
+ * Contains unit tests for the Lua state pool.
+ */
+public class LuaStatePoolTest {
+	// -- Test cases
+	/**
+	 * Tests executing work on pooled Lua states.
+	 */
+	@Test
+	public void testLuaStatePool() throws Exception {
+		// Create
+		LuaStatePool pool = new LuaStatePool(4, luaState -> {
+			luaState.openLibs();
+			luaState.load("function square(x) return x * x end", "=bootstrap");
+			luaState.call(0, 0);
+		}, 10, 0L);
+
+		// Run
+		List<CompletableFuture<Double>> futures = new ArrayList<CompletableFuture<Double>>();
+		for (int i = 0; i < 100; i++) {
+			final int value = i;
+			futures.add(pool.submit(luaState -> {
+				assertTrue(luaState.getOwnerThread() == Thread.currentThread());
+				luaState.getGlobal("square");
+				luaState.pushInteger(value);
+				luaState.call(1, 1);
+				return Double.valueOf(luaState.toNumber(-1));
+			}));
+		}
+		for (int i = 0; i < 100; i++) {
+			assertEquals(i * i, futures.get(i).get(10, TimeUnit.SECONDS)
+					.doubleValue(), 0.0);
+		}
+		assertTrue(pool.getRecycleCount() > 0);
+
+		// Nested work runs on a Lua state of its own
+		assertTrue(pool.submit(luaState -> {
+			luaState.pushInteger(1);
+			boolean other = pool.submit(
+					nested -> Boolean.valueOf(nested != luaState
+							&& nested.getTop() == 0)).join().booleanValue();
+			return Boolean.valueOf(other && luaState.getTop() == 1);
+		}).get(10, TimeUnit.SECONDS).booleanValue());
+
+		// Close
+		assertTrue(pool.close(10, TimeUnit.SECONDS));
+	}
+}
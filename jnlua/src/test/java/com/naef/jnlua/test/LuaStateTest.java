@@ -12,13 +12,19 @@ import static org.junit.Assert.assertNotNull;
 import static org.junit.Assert.assertNull;
 import static org.junit.Assert.assertSame;
 import static org.junit.Assert.assertTrue;
+import static org.junit.Assert.fail;
 
 import java.io.ByteArrayInputStream;
 import java.io.ByteArrayOutputStream;
 import java.io.InputStream;
+import java.io.StringWriter;
+import java.nio.ByteBuffer;
+import java.nio.file.Files;
+import java.nio.file.Path;
 import java.util.ArrayList;
 import java.util.List;
 import java.util.Map;
+import java.util.concurrent.CountDownLatch;
 
 import org.junit.Test;
 
@@ -27,6 +33,11 @@ import com.naef.jnlua.DefaultConverter;
 import com.naef.jnlua.DefaultJavaReflector;
 import com.naef.jnlua.JavaFunction;
 import com.naef.jnlua.JavaReflector;
+import com.naef.jnlua.LuaBatch;
+import com.naef.jnlua.LuaInterruptedException;
+import com.naef.jnlua.LuaMemoryAllocationException;
+import com.naef.jnlua.LuaMetrics;
+import com.naef.jnlua.LuaProfile;
 import com.naef.jnlua.LuaRuntimeException;
 import com.naef.jnlua.JavaReflector.Metamethod;
 import com.naef.jnlua.LuaState;
@@ -180,6 +191,103 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.gc(GcAction.INC, 0));
 	}
 
+	/**
+	 * Tests stack and table operations while the collector is stopped.
+	 */
+	@Test
+	public void testGcStopped() throws Exception {
+		Object value = new Object();
+		luaState.gc(GcAction.STOP, 0);
+		luaState.newTable(1, 1);
+		luaState.pushString("value");
+		luaState.setField(1, "key");
+		luaState.pushJavaObject(value);
+		luaState.rawSet(1, 1);
+		luaState.pushString("value");
+		luaState.setGlobal("global");
+		luaState.getField(1, "key");
+		assertEquals("value", luaState.toString(-1));
+		luaState.rawGet(1, 1);
+		assertSame(value, luaState.toJavaObject(-1, Object.class));
+		luaState.getGlobal("global");
+		assertEquals("value", luaState.toString(-1));
+		luaState.pop(4);
+		luaState.gc(GcAction.RESTART, 0);
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
+	/**
+	 * Tests that stores under existing keys and lookups of cached keys run
+	 * without a protected call while the collector is running. A protected
+	 * call is counted by a call hook.
+	 */
+	@Test
+	public void testFastPath() throws Exception {
+		// Prepare a table and cache the keys
+		luaState.openLibs();
+		assertTrue(luaState.gc(GcAction.ISRUNNING, 0) != 0);
+		luaState.newTable();
+		luaState.pushString("value");
+		luaState.setField(1, "key");
+		luaState.pushString("value");
+		luaState.rawSet(1, 1);
+		luaState.pushString("value");
+		luaState.setGlobal("global");
+		luaState.pushString("key");
+		luaState.newTable();
+		luaState.pushInteger(0);
+		luaState.rawSet(3, 1);
+		luaState.pushValue(3);
+		luaState.setGlobal("counter");
+		luaState.load("debug.sethook(function () counter[1] = counter[1] + 1 end, \"c\")",
+				"=testFastPath");
+		luaState.call(0, 0);
+		luaState.rawGet(3, 1);
+		int count = luaState.toInteger(-1);
+		luaState.pop(1);
+
+		// Existing keys
+		luaState.getField(1, "key");
+		assertEquals("value", luaState.toString(-1));
+		luaState.pop(1);
+		luaState.pushValue(2);
+		luaState.setField(1, "key");
+		luaState.getGlobal("global");
+		assertEquals("value", luaState.toString(-1));
+		luaState.pop(1);
+		luaState.pushValue(2);
+		luaState.setGlobal("global");
+		luaState.pushValue(2);
+		luaState.pushValue(2);
+		luaState.rawSet(1);
+		luaState.pushValue(2);
+		luaState.pushValue(2);
+		luaState.setTable(1);
+		luaState.pushValue(2);
+		luaState.getTable(1);
+		assertEquals("key", luaState.toString(-1));
+		luaState.pop(1);
+		luaState.pushValue(2);
+		luaState.rawSet(1, 1);
+		luaState.rawGet(3, 1);
+		assertEquals(count, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// New key
+		luaState.pushValue(2);
+		luaState.setField(1, "other");
+		luaState.rawGet(3, 1);
+		assertTrue(luaState.toInteger(-1) > count);
+		luaState.pop(1);
+		assertTrue(luaState.gc(GcAction.ISRUNNING, 0) != 0);
+		luaState.pop(3);
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
 	/**
 	 * Tests the close method.
 	 */
@@ -189,6 +297,143 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertFalse(luaState.isOpen());
 	}
 
+	/**
+	 * Tests a Lua state with a pool allocator.
+	 */
+	@Test
+	public void testPoolAllocator() throws Exception {
+		LuaState poolState = new LuaState(LuaState.Allocator.POOL);
+		try {
+			poolState.openLibs();
+			poolState.load("local t = {}\n"
+					+ "for i = 1, 10000 do t[i] = { i, tostring(i) } end\n"
+					+ "local s = string.rep(\"x\", 1000)\n"
+					+ "t = nil\n" + "collectgarbage()\n" + "return #s",
+					"=testPoolAllocator");
+			poolState.call(0, 1);
+			assertEquals(1000, poolState.toInteger(-1));
+			poolState.pop(1);
+		} finally {
+			poolState.close();
+		}
+		assertFalse(poolState.isOpen());
+	}
+
+	/**
+	 * Tests a Lua state referencing Java objects with a handle table.
+	 */
+	@Test
+	public void testHandleTable() throws Exception {
+		LuaState handleState = new LuaState(LuaState.Allocator.SYSTEM,
+				LuaState.ObjectReferences.HANDLE_TABLE);
+		try {
+			long globalRefs = handleState.getGlobalRefCount();
+			long handles = handleState.getHandleCount();
+			int count = 5000;
+			Object object = new Object();
+			handleState.pushJavaObjectRaw(object);
+			handleState.pushJavaObjectRaw(object);
+			assertTrue(handleState.rawEqual(1, 2));
+			assertSame(object, handleState.toJavaObjectRaw(1));
+			handleState.pop(2);
+			handleState.newTable();
+			for (int i = 0; i < count; i++) {
+				handleState.pushJavaObjectRaw(Integer.valueOf(i));
+				handleState.rawSet(1, i + 1);
+			}
+			assertEquals(handles + count + 1, handleState.getHandleCount());
+			assertEquals(globalRefs, handleState.getGlobalRefCount());
+			for (int i = 0; i < count; i++) {
+				handleState.rawGet(1, i + 1);
+				assertEquals(Integer.valueOf(i), handleState.toJavaObjectRaw(-1));
+				handleState.pop(1);
+			}
+			handleState.pop(1);
+			handleState.gc(GcAction.COLLECT, 0);
+			assertEquals(handles, handleState.getHandleCount());
+			handleState.pushJavaObjectRaw(object);
+			assertSame(object, handleState.toJavaObjectRaw(-1));
+			handleState.pop(1);
+		} finally {
+			handleState.close();
+		}
+		assertFalse(handleState.isOpen());
+	}
+
+	/**
+	 * Tests the memory accounting and memory limit methods.
+	 */
+	@Test
+	public void testMemoryLimit() throws Exception {
+		// Accounting
+		long used = luaState.getMemoryUsed();
+		assertTrue(used > 0);
+		assertTrue(luaState.getMemoryPeak() >= used);
+		long allocations = luaState.getAllocationCount();
+		assertTrue(allocations > 0);
+		luaState.newTable();
+		assertTrue(luaState.getMemoryUsed() > used);
+		assertTrue(luaState.getAllocationCount() > allocations);
+		luaState.pop(1);
+		assertEquals(0, luaState.getMemoryLimit());
+
+		// Limit
+		luaState.openLibs();
+		long limit = luaState.getMemoryUsed() + 1000000;
+		luaState.setMemoryLimit(limit);
+		assertEquals(limit, luaState.getMemoryLimit());
+		luaState.load("local t = {}\n"
+				+ "while true do t[#t + 1] = string.rep(\"x\", 1000) end",
+				"=testMemoryLimit");
+		try {
+			luaState.call(0, 0);
+			fail("memory limit not enforced");
+		} catch (LuaMemoryAllocationException e) {
+			// expected
+		}
+		assertTrue(luaState.getMemoryPeak() <= luaState.getMemoryLimit());
+
+		// Release
+		luaState.setMemoryLimit(0);
+		assertEquals(0, luaState.getMemoryLimit());
+		luaState.gc(GcAction.COLLECT, 0);
+		luaState.pushString("test");
+		assertEquals("test", luaState.toString(-1));
+		luaState.pop(1);
+	}
+
+	/**
+	 * Tests the identity of pushed Java objects.
+	 */
+	@Test
+	public void testJavaObjectIdentity() throws Exception {
+		// Same userdata
+		long globalRefs = luaState.getGlobalRefCount();
+		Object object = new Object();
+		luaState.pushJavaObjectRaw(object);
+		luaState.pushJavaObjectRaw(object);
+		assertTrue(luaState.rawEqual(1, 2));
+		assertEquals(globalRefs + 1, luaState.getGlobalRefCount());
+		luaState.pushJavaObjectRaw(new Object());
+		assertFalse(luaState.rawEqual(1, 3));
+		assertEquals(globalRefs + 2, luaState.getGlobalRefCount());
+		luaState.pop(3);
+
+		// Table key
+		luaState.newTable();
+		luaState.pushJavaObjectRaw(object);
+		luaState.pushString("test");
+		luaState.setTable(1);
+		luaState.pushJavaObjectRaw(object);
+		luaState.getTable(1);
+		assertEquals("test", luaState.toString(-1));
+		luaState.pop(2);
+
+		// Release
+		luaState.gc(GcAction.COLLECT, 0);
+		assertEquals(globalRefs, luaState.getGlobalRefCount());
+	}
+
 	// -- Registration tests
 	/**
 	 * Tests the openLib method.
@@ -277,6 +522,39 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(LuaType.NUMBER, luaState.type(-1));
 		luaState.pop(1);
 
+		// load(byte[])
+		luaState.load("return 3".getBytes("UTF-8"), "=testLoad", "t");
+		luaState.call(0, 1);
+		assertEquals(3, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// load(ByteBuffer)
+		byte[] chunk = "return 4".getBytes("UTF-8");
+		ByteBuffer buffer = ByteBuffer.allocateDirect(chunk.length);
+		buffer.put(chunk);
+		buffer.flip();
+		luaState.load(buffer, "=testLoad", "t");
+		assertEquals(0, buffer.position());
+		luaState.call(0, 1);
+		assertEquals(4, luaState.toInteger(-1));
+		luaState.pop(1);
+		luaState.load(ByteBuffer.wrap(chunk), "=testLoad", "t");
+		luaState.call(0, 1);
+		assertEquals(4, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// load(Path)
+		Path path = Files.createTempFile("testLoad", ".lua");
+		try {
+			Files.write(path, "return 5".getBytes("UTF-8"));
+			luaState.load(path, "@testLoad.lua", "t");
+			luaState.call(0, 1);
+			assertEquals(5, luaState.toInteger(-1));
+			luaState.pop(1);
+		} finally {
+			Files.delete(path);
+		}
+
 		// Finish
 		assertEquals(0, luaState.getTop());
 	}
@@ -298,6 +576,28 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals((byte) 'a', bytes[3]);
 		luaState.pop(1);
 
+		// dumpByteArray()
+		luaState.load("local x = 1\nreturn x + 1", "=testDump");
+		byte[] full = luaState.dumpByteArray(false);
+		byte[] stripped = luaState.dumpByteArray(true);
+		luaState.pop(1);
+		assertTrue(stripped.length < full.length);
+		luaState.load(stripped, "=testDump", "b");
+		luaState.call(0, 1);
+		assertEquals(2, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// dumpByteBuffer()
+		luaState.load("return 3", "=testDump");
+		ByteBuffer buffer = luaState.dumpByteBuffer(false);
+		luaState.pop(1);
+		assertTrue(buffer.isDirect());
+		assertEquals((byte) 27, buffer.get(0));
+		luaState.load(buffer, "=testDump", "b");
+		luaState.call(0, 1);
+		assertEquals(3, luaState.toInteger(-1));
+		luaState.pop(1);
+
 		// Finish
 		assertEquals(0, luaState.getTop());
 	}
@@ -322,6 +622,95 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	/**
+	 * Tests the call method with an execution budget.
+	 */
+	@Test
+	public void testCallBudget() throws Exception {
+		luaState.openLibs();
+
+		// Within budget
+		luaState.load("local n = 0 for i = 1, 100 do n = n + i end return n",
+				"=testCallBudget");
+		luaState.call(0, 1, 1000000, 10000);
+		assertEquals(5050, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// Instruction limit; the error cannot be absorbed by pcall
+		luaState.load("while true do pcall(function () while true do end end) end",
+				"=testCallBudget");
+		try {
+			luaState.call(0, 0, 100000, 0);
+			fail("instruction limit not enforced");
+		} catch (LuaInterruptedException e) {
+			assertTrue(e.getMessage().contains("instruction limit exceeded"));
+		}
+
+		// Timeout
+		luaState.load("while true do end", "=testCallBudget");
+		try {
+			luaState.call(0, 0, 0, 100);
+			fail("timeout not enforced");
+		} catch (LuaInterruptedException e) {
+			assertTrue(e.getMessage().contains("timeout"));
+		}
+
+		// Interrupt
+		Thread interrupter = new Thread() {
+			@Override
+			public void run() {
+				try {
+					Thread.sleep(100);
+				} catch (InterruptedException e) {
+					return;
+				}
+				luaState.interrupt();
+			}
+		};
+		interrupter.start();
+		luaState.load("while true do end", "=testCallBudget");
+		try {
+			luaState.call(0, 0);
+			fail("interrupt not effective");
+		} catch (LuaInterruptedException e) {
+			assertTrue(e.getMessage().contains("interrupted"));
+		}
+		interrupter.join();
+
+		// Interrupt a resumed thread
+		interrupter = new Thread() {
+			@Override
+			public void run() {
+				try {
+					Thread.sleep(100);
+				} catch (InterruptedException e) {
+					return;
+				}
+				luaState.interrupt();
+			}
+		};
+		interrupter.start();
+		luaState.load("while true do end", "=testCallBudget");
+		luaState.newThread();
+		try {
+			luaState.resume(1, 0);
+			fail("interrupt not effective");
+		} catch (LuaInterruptedException e) {
+			assertTrue(e.getMessage().contains("interrupted"));
+		}
+		interrupter.join();
+		luaState.pop(1);
+
+		// Subsequent calls are unaffected
+		luaState.load("return 1", "=testCallBudget");
+		luaState.call(0, 1);
+		assertEquals(1, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
 	// -- Globals tests
 	/**
 	 * Tests the globals methods.
@@ -370,6 +759,31 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	/**
+	 * Tests the pushByteBuffer method.
+	 */
+	@Test
+	public void testPushByteBuffer() throws Exception {
+		// Direct buffer
+		ByteBuffer buffer = ByteBuffer.allocateDirect(4);
+		buffer.put(new byte[] { 1, 2, 3, 4 });
+		buffer.position(1);
+		buffer.limit(3);
+		luaState.pushByteBuffer(buffer);
+		assertEquals(LuaType.STRING, luaState.type(1));
+		assertArrayEquals(new byte[] { 2, 3 }, luaState.toByteArray(1));
+		assertEquals(1, buffer.position());
+		luaState.pop(1);
+
+		// Heap buffer
+		luaState.pushByteBuffer(ByteBuffer.wrap(new byte[] { 1, 2 }));
+		assertArrayEquals(new byte[] { 1, 2 }, luaState.toByteArray(1));
+		luaState.pop(1);
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
 	/**
 	 * Tests the stack push methods.
 	 */
@@ -481,6 +895,35 @@ public class LuaStateTest extends AbstractLuaTest {
 		luaState.pop(1);
 	}
 
+	/**
+	 * Tests the pushString method with strings that are not plain ASCII.
+	 */
+	@Test
+	public void testPushStringUtf8() throws Exception {
+		// NUL and supplementary characters
+		String s = "a\u0000b\ud83d\ude00";
+		luaState.pushString(s);
+		assertEquals(7, luaState.rawLen(1));
+		assertEquals(s, luaState.toString(1));
+		luaState.pop(1);
+
+		// Unpaired surrogate
+		luaState.pushString("\ud83d");
+		assertEquals(3, luaState.rawLen(1));
+		assertEquals("\ufffd", luaState.toString(1));
+		luaState.pop(1);
+
+		// Long string
+		StringBuilder sb = new StringBuilder();
+		for (int i = 0; i < 1000; i++) {
+			sb.append("test\u00e4");
+		}
+		luaState.pushString(sb.toString());
+		assertEquals(6000, luaState.rawLen(1));
+		assertEquals(sb.toString(), luaState.toString(1));
+		luaState.pop(1);
+	}
+
 	// -- Stack type tests
 	/**
 	 * Tests the isBoolean method.
@@ -970,6 +1413,35 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	/**
+	 * Tests the toByteBuffer method.
+	 */
+	@Test
+	public void testToByteBuffer() throws Exception {
+		// Setup stack
+		luaState.openLibs();
+		makeStack();
+
+		// Test
+		assertNull(luaState.toByteBuffer(1));
+		assertNull(luaState.toByteBuffer(2));
+		ByteBuffer buffer = luaState.toByteBuffer(4);
+		assertTrue(buffer.isDirect());
+		assertTrue(buffer.isReadOnly());
+		byte[] b = new byte[buffer.remaining()];
+		buffer.get(b);
+		assertArrayEquals(new byte[] { 't', 'e', 's', 't' }, b);
+		luaState.releaseByteBuffer(buffer);
+		buffer = luaState.toByteBuffer(5);
+		assertEquals(1, buffer.remaining());
+		assertEquals('1', buffer.get(0));
+		luaState.releaseByteBuffer(buffer);
+
+		// Finish
+		luaState.pop(10);
+		assertEquals(0, luaState.getTop());
+	}
+
 	/**
 	 * Tests the toInteger method.
 	 */
@@ -1260,6 +1732,63 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	/**
+	 * Tests the describeStack method.
+	 */
+	@Test
+	public void testDescribeStack() throws Exception {
+		// Setup stack
+		luaState.openLibs();
+		makeStack();
+
+		// Test
+		int[] types = new int[10];
+		Object[] javaObjects = new Object[10];
+		luaState.describeStack(1, -1, types, javaObjects);
+		assertEquals(LuaType.NIL.ordinal(), types[0]);
+		assertEquals(LuaType.NUMBER.ordinal(), types[2]);
+		assertEquals(LuaType.TABLE.ordinal(), types[5]);
+		assertEquals(LuaType.FUNCTION.ordinal() | LuaState.DESCRIBE_JAVA,
+				types[6]);
+		assertEquals(LuaType.USERDATA.ordinal() | LuaState.DESCRIBE_JAVA,
+				types[7]);
+		assertSame(object, javaObjects[7]);
+		assertEquals(LuaType.FUNCTION.ordinal(), types[8]);
+		assertEquals(LuaType.FUNCTION.ordinal(), types[9]);
+		assertNull(javaObjects[6]);
+
+		// Elements of other values are left unchanged
+		Object marker = new Object();
+		for (int i = 0; i < javaObjects.length; i++) {
+			javaObjects[i] = marker;
+		}
+		luaState.describeStack(1, -1, types, javaObjects);
+		assertSame(marker, javaObjects[0]);
+		assertSame(marker, javaObjects[6]);
+		assertSame(object, javaObjects[7]);
+		luaState.pop(10);
+
+		// Test more values than a chunk of type codes
+		for (int i = 0; i < 69; i++) {
+			luaState.pushInteger(i);
+		}
+		luaState.pushJavaObject(object);
+		types = new int[70];
+		javaObjects = new Object[70];
+		luaState.describeStack(1, -1, types, javaObjects);
+		for (int i = 0; i < 69; i++) {
+			assertEquals(LuaType.NUMBER.ordinal(), types[i]);
+			assertNull(javaObjects[i]);
+		}
+		assertEquals(LuaType.USERDATA.ordinal() | LuaState.DESCRIBE_JAVA,
+				types[69]);
+		assertSame(object, javaObjects[69]);
+
+		// Finish
+		luaState.pop(70);
+		assertEquals(0, luaState.getTop());
+	}
+
 	// -- Stack operation tests
 	/**
 	 * Tests the absIndex method.
@@ -1631,6 +2160,148 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	/**
+	 * Tests yielding Java functions with continuations.
+	 */
+	@Test
+	public void testContinuation() throws Exception {
+		// Create thread
+		luaState.openLibs();
+		luaState.register(new NamedJavaFunction() {
+			public int invoke(LuaState luaState) {
+				final int value = luaState.toInteger(1);
+				luaState.pushInteger(value);
+				return luaState.yield(1, new JavaFunction() {
+					public int invoke(LuaState luaState) {
+						luaState.pushInteger(value + luaState.toInteger(-1));
+						return 1;
+					}
+				});
+			}
+
+			public String getName() {
+				return "yieldfunc";
+			}
+		});
+		luaState.load("local ok, result = pcall(yieldfunc, ...)\n"
+				+ "return result * 2\n", "=testContinuation");
+		luaState.newThread();
+
+		// Start
+		luaState.pushInteger(1);
+		assertEquals(1, luaState.resume(1, 1));
+		assertEquals(LuaState.YIELD, luaState.status(1));
+		assertEquals(1, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// Resume
+		luaState.pushInteger(10);
+		assertEquals(1, luaState.resume(1, 1));
+		assertEquals(LuaState.OK, luaState.status(1));
+		assertEquals(22, luaState.toInteger(-1));
+		luaState.pop(1);
+
+		// Cleanup
+		luaState.pop(1);
+		assertEquals(0, luaState.getTop());
+	}
+
+	// -- Thread confinement tests
+	/**
+	 * Tests thread confinement and handoff.
+	 */
+	@Test
+	public void testThreadConfinement() throws Exception {
+		// Confine
+		luaState.setOwnerThread(Thread.currentThread());
+		assertSame(Thread.currentThread(), luaState.getOwnerThread());
+		luaState.pushInteger(1);
+		assertEquals(1, luaState.getTop());
+
+		// Access from another thread
+		final boolean[] failed = new boolean[2];
+		Thread thread = new Thread() {
+			@Override
+			public void run() {
+				try {
+					luaState.getTop();
+				} catch (IllegalStateException e) {
+					failed[0] = true;
+				}
+				try {
+					luaState.gc(GcAction.COUNT, 0);
+				} catch (IllegalStateException e) {
+					failed[1] = true;
+				}
+			}
+		};
+		thread.start();
+		thread.join();
+		assertTrue(failed[0]);
+		assertTrue(failed[1]);
+
+		// Hand off
+		final int[] top = new int[1];
+		thread = new Thread() {
+			@Override
+			public void run() {
+				top[0] = luaState.getTop();
+				luaState.pop(1);
+				luaState.setOwnerThread(null);
+			}
+		};
+		luaState.setOwnerThread(thread);
+		thread.start();
+		thread.join();
+		assertEquals(1, top[0]);
+		assertNull(luaState.getOwnerThread());
+		assertEquals(0, luaState.getTop());
+	}
+
+	/**
+	 * Tests that the stack and table methods of a thread-confined Lua state
+	 * do not synchronize on the Lua state.
+	 */
+	@Test(timeout = 10000)
+	public void testThreadConfinementUnsynchronized() throws Exception {
+		// Hold the monitor of the Lua state in another thread
+		luaState.setOwnerThread(Thread.currentThread());
+		final CountDownLatch locked = new CountDownLatch(1);
+		final CountDownLatch release = new CountDownLatch(1);
+		Thread thread = new Thread() {
+			@Override
+			public void run() {
+				synchronized (luaState) {
+					locked.countDown();
+					try {
+						release.await();
+					} catch (InterruptedException e) {
+						// Release
+					}
+				}
+			}
+		};
+		thread.start();
+		locked.await();
+
+		// Stack and table operations proceed
+		try {
+			luaState.newTable();
+			luaState.pushInteger(1);
+			luaState.setField(1, "key");
+			luaState.getField(1, "key");
+			assertEquals(1, luaState.toInteger(-1));
+			luaState.pushValue(1);
+			luaState.setGlobal("t");
+			luaState.pop(2);
+			assertEquals(0, luaState.getTop());
+		} finally {
+			release.countDown();
+			thread.join();
+		}
+		luaState.setOwnerThread(null);
+	}
+
 	// -- Reference tests
 	/**
 	 * Tests the reference functions.
@@ -1658,6 +2329,189 @@ public class LuaStateTest extends AbstractLuaTest {
 		assertEquals(0, luaState.getTop());
 	}
 
+	// -- Optimization tests
+	/**
+	 * Tests the array transfer methods.
+	 */
+	@Test
+	public void testArray() throws Exception {
+		// Primitive arrays
+		double[] d = new double[1000];
+		for (int i = 0; i < d.length; i++) {
+			d[i] = i * 0.5;
+		}
+		luaState.pushArray(d);
+		assertEquals(LuaType.TABLE, luaState.type(1));
+		assertEquals(1000, luaState.rawLen(1));
+		luaState.rawGet(1, 3);
+		assertEquals(1.0, luaState.toNumber(-1), 0.0);
+		luaState.pop(1);
+		assertArrayEquals(d, luaState.toDoubleArray(1), 0.0);
+		luaState.pop(1);
+		luaState.pushArray(new int[] { 1, -2, 3 });
+		assertArrayEquals(new int[] { 1, -2, 3 }, luaState.toIntArray(1));
+		luaState.pop(1);
+		luaState.pushArray(new long[] { 1L << 40, -1L });
+		assertArrayEquals(new long[] { 1L << 40, -1L },
+				luaState.toLongArray(1));
+		luaState.pop(1);
+		luaState.pushArray(new boolean[] { true, false });
+		boolean[] b = luaState.toBooleanArray(1);
+		assertEquals(2, b.length);
+		assertTrue(b[0]);
+		assertFalse(b[1]);
+		luaState.pop(1);
+
+		// String arrays
+		luaState.pushArray(new String[] { "a", "b\u00e4" });
+		assertArrayEquals(new String[] { "a", "b\u00e4" },
+				luaState.toStringArray(1));
+		luaState.pop(1);
+
+		// Mismatching elements
+		luaState.pushArray(new String[] { "a" });
+		assertNull(luaState.toDoubleArray(1));
+		assertNull(luaState.toBooleanArray(1));
+		luaState.pop(1);
+		luaState.pushNumber(1.0);
+		assertNull(luaState.toIntArray(1));
+		luaState.pop(1);
+
+		// Converter
+		luaState.pushArray(new int[] { 4, 5 });
+		assertArrayEquals(new int[] { 4, 5 },
+				luaState.toJavaObject(1, int[].class));
+		luaState.pop(1);
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
+	/**
+	 * Tests the execute method.
+	 */
+	@Test
+	public void testBatch() throws Exception {
+		// Build table
+		LuaBatch batch = new LuaBatch(8);
+		batch.newTable(2, 1);
+		batch.pushString("value");
+		batch.setField(1, "key");
+		batch.pushNumber(1.5);
+		batch.rawSet(1, 1);
+		batch.pushInteger(2);
+		batch.rawSet(1, 2);
+		batch.pushBoolean(true);
+		batch.setGlobal("flag");
+		int top = batch.getTop();
+		int len = batch.rawLen(1);
+		batch.getField(1, "key");
+		int string = batch.toString(-1);
+		int type = batch.type(-1);
+		int none = batch.type(10);
+		batch.rawGet(1, 1);
+		int number = batch.toNumber(-1);
+		batch.getGlobal("flag");
+		int flag = batch.toBoolean(-1);
+		batch.pop(3);
+		luaState.execute(batch);
+		assertEquals(8, batch.getResultCount());
+		assertEquals(1, batch.getInteger(top));
+		assertEquals(2, batch.getInteger(len));
+		assertEquals("value", batch.getString(string));
+		assertEquals(LuaType.STRING, batch.getType(type));
+		assertNull(batch.getType(none));
+		assertEquals(1.5, batch.getNumber(number), 0.0);
+		assertTrue(batch.getBoolean(flag));
+		assertEquals(1, luaState.getTop());
+		luaState.getField(1, "key");
+		assertEquals("value", luaState.toString(-1));
+		luaState.pop(1);
+
+		// Embedded zero
+		batch.clear();
+		batch.pushString("a\0b");
+		int embedded = batch.rawLen(-1);
+		batch.pop(2);
+		luaState.execute(batch);
+		assertEquals(3, batch.getInteger(embedded));
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
+	// -- Profiling tests
+	/**
+	 * Tests the profiling methods.
+	 */
+	@Test
+	public void testProfiler() throws Exception {
+		// Profile
+		luaState.startProfiler(100);
+		luaState.load("local function hot()\n"
+				+ "  local x = 0 for i = 1, 100000 do x = x + i end return x\n"
+				+ "end\n" + "for i = 1, 200 do hot() end", "=testProfiler");
+		luaState.call(0, 0);
+		luaState.stopProfiler();
+		LuaProfile profile = new LuaProfile();
+		luaState.drainProfiler(profile);
+		assertTrue(profile.getSampleCount() > 0);
+		boolean found = false;
+		for (String stack : profile.getStacks().keySet()) {
+			if (stack.startsWith("main chunk (testProfiler:4);hot (testProfiler:2)")) {
+				found = true;
+			}
+		}
+		assertTrue(found);
+
+		// Folded stacks
+		StringWriter writer = new StringWriter();
+		profile.writeFolded(writer);
+		assertTrue(writer.toString().contains(";hot (testProfiler:2) "));
+
+		// Drained
+		profile.clear();
+		luaState.drainProfiler(profile);
+		assertEquals(0, profile.getSampleCount());
+
+		// Finish
+		assertEquals(0, luaState.getTop());
+	}
+
+	/**
+	 * Tests the metrics.
+	 */
+	@Test
+	public void testMetrics() throws Exception {
+		// Memory
+		LuaMetrics metrics = luaState.getMetrics();
+		assertTrue(metrics.isOpen());
+		assertEquals(luaState.getMemoryUsed(), metrics.getMemoryUsed());
+		assertTrue(metrics.getMemoryPeak() >= metrics.getMemoryUsed());
+		assertTrue(metrics.getAllocationCount() > 0);
+		assertEquals(0, metrics.getBlockedThreadCount());
+
+		// Crossings
+		for (int i = 0; i < 100; i++) {
+			luaState.pushInteger(i);
+			luaState.pop(1);
+		}
+		if (LuaState.INSTRUMENTED) {
+			assertTrue(metrics.getCrossingCounts().get("lua_pushinteger") >= 100);
+			assertTrue(metrics.getLatencyPercentile("lua_pushinteger", 50.0) > 0);
+			assertTrue(metrics.getTotalCrossings() >= 200);
+		} else {
+			assertEquals(0, metrics.getTotalCrossings());
+			assertEquals(-1, metrics.getLatencyPercentile("lua_pushinteger", 50.0));
+		}
+		assertEquals(0, metrics.getLatencyHistogram("unknown").length);
+
+		// Closed
+		luaState.close();
+		assertFalse(metrics.isOpen());
+		assertEquals(0, metrics.getMemoryUsed());
+	}
+
 	// -- Argument check tests
 	/**
 	 * Tests the checkArg method.